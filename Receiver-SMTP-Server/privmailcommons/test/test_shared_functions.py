@@ -43,6 +43,14 @@ def test_separate_words_from_text_valid_input(test_input, expected_result):
     assert shr.separate_words_from_text(test_input) == expected_result
 
 
+@pytest.mark.parametrize("test_input, test_stopwords, expected_result",
+                         [("the test and the test", {"the", "and"}, [('test', [1, 4])]),
+                          ("the", {"the"}, []),
+                          ("The test", {"the"}, [('The', [0]), ('test', [1])])])
+def test_separate_words_from_text_with_stopwords(test_input, test_stopwords, expected_result):
+    assert shr.separate_words_from_text(test_input, test_stopwords) == expected_result
+
+
 @pytest.mark.parametrize("test_input", [(0), ({"test" : 1})])
 def test_separate_words_from_text_invalid_input(test_input):
     with pytest.raises(Exception):
@@ -63,6 +71,59 @@ def test_bucket_keyword_invalid_input(test_input):
         shr.bucket_keyword(test_input, logger)
 
 
+@pytest.mark.parametrize("test_input, expected_result",
+                         [("Hello  world\n\tagain", "Hello world again"),
+                          ("Hi,\n\nOn Mon, Bob wrote:\n> old text\n>> older text\nThanks", "Hi, Thanks"),
+                          ("Text\n-- \nAlice\nPhone", "Text"),
+                          ("<p>Fish &amp; chips</p><br>", "Fish & chips"),
+                          ("Note\n\nForwarded part\n\nForwarded  part", "Note Forwarded part"),
+                          ("", "")])
+def test_normalize_mail_text_valid_input(test_input, expected_result):
+    assert shr.normalize_mail_text(test_input) == expected_result
+
+
+@pytest.mark.parametrize("test_input", [(0), (["text"])])
+def test_normalize_mail_text_invalid_input(test_input):
+    with pytest.raises(Exception):
+        shr.normalize_mail_text(test_input)
+
+
+@pytest.mark.parametrize("test_input, test_length_classes, expected_result",
+                         [(0, [], 0),
+                          (0, [4, 8], 4),
+                          (5, [4, 8], 8),
+                          (8, [8, 4], 8),
+                          (9, [4, 8], 16),
+                          (17, [8], 24)])
+def test_get_length_class_valid_input(test_input, test_length_classes, expected_result):
+    assert shr.get_length_class(test_input, test_length_classes) == expected_result
+
+
+@pytest.mark.parametrize("test_input, test_length_classes",
+                         [(-1, [4]), ("test", [4]), (1, [0]), (1, [2.5])])
+def test_get_length_class_invalid_input(test_input, test_length_classes):
+    with pytest.raises(Exception):
+        shr.get_length_class(test_input, test_length_classes)
+
+
+@pytest.mark.parametrize("test_input, test_length_classes, expected_result",
+                         [("test", [], "test"),
+                          ("test", [8, 16], "test" + shr.PADDING_CHARACTER * 4),
+                          ("test", [16, 4], "test"),
+                          ("", [4], shr.PADDING_CHARACTER * 4),
+                          ("x" * 9, [4, 8], "x" * 9 + shr.PADDING_CHARACTER * 7),
+                          ("x" * 16, [4, 8], "x" * 16)])
+def test_pad_to_length_class_valid_input(test_input, test_length_classes, expected_result):
+    assert shr.pad_to_length_class(test_input, test_length_classes) == expected_result
+
+
+@pytest.mark.parametrize("test_input, test_length_classes",
+                         [(0, [4]), ("test", [0]), ("test", [-4, 8]), ("test", ["invalid"])])
+def test_pad_to_length_class_invalid_input(test_input, test_length_classes):
+    with pytest.raises(Exception):
+        shr.pad_to_length_class(test_input, test_length_classes)
+
+
 @pytest.mark.parametrize("test_input, expected_result",
                          [(0, [0, 0, 0, 0, 0, 0]),
                           (1, [128, 0, 0, 0, 0, 0]),
@@ -89,6 +150,147 @@ def test_create_length_mask_invalid_input(test_input):
         shr.create_length_mask(test_input)
 
 
+@pytest.mark.parametrize("test_input, expected_result",
+                         [("a?#", ("a?0", [64, 0, 0, 0, 0, 0], [32, 0, 0, 0, 0, 0])),
+                          ("test", ("test", [0] * 6, [0] * 6)),
+                          ("##?########", ("00?00000000", [32, 0, 0, 0, 0, 0], [223, 224, 0, 0, 0, 0]))])
+def test_create_pattern_masks_valid_input(test_input, expected_result):
+    assert shr.create_pattern_masks(test_input) == expected_result
+
+
+@pytest.mark.parametrize("test_input", [(0), ("?" * (shr.PATTERN_MASK_SIZE + 1))])
+def test_create_pattern_masks_invalid_input(test_input):
+    with pytest.raises(Exception):
+        shr.create_pattern_masks(test_input)
+
+
+@pytest.mark.parametrize("test_positions, test_size, expected_result",
+                         [([], 8, [0]),
+                          ([0, 2], 8, [160]),
+                          ([2, 0, 2], 8, [160]),
+                          ([8, 15], 16, [0, 129]),
+                          ([7, 9], 24, [1, 64, 0]),
+                          ])
+def test_create_bit_array_valid_input(test_positions, test_size, expected_result):
+    assert shr.create_bit_array(test_positions, test_size) == expected_result
+
+
+@pytest.mark.parametrize("test_positions, test_size",
+                         [([8], 8), ([-1], 8), ([0], 7), ([0], "invalid")])
+def test_create_bit_array_invalid_input(test_positions, test_size):
+    with pytest.raises(Exception):
+        shr.create_bit_array(test_positions, test_size)
+
+
+@pytest.mark.parametrize("test_input", [("word"), ("Word"), ("a"), ("")])
+def test_bloom_filter_positions_valid_input(test_input):
+    positions = shr.bloom_filter_positions(test_input)
+    assert len(positions) == shr.BLOOM_FILTER_NUM_HASHES
+    assert all(0 <= position < shr.BLOOM_FILTER_SIZE for position in positions)
+    assert positions == shr.bloom_filter_positions(test_input.upper())
+
+
+def run_dfa(pattern, text):
+    """Run the DFA of a pattern over the special encoding of a text."""
+    symbol_classes, transitions, accepting = shr.compile_pattern_dfa(pattern)
+    state = 0
+    for character in text:
+        state = transitions[state][symbol_classes[shr.SPECIAL_ENCODING[ord(character)]]]
+    return accepting[state]
+
+
+@pytest.mark.parametrize("test_pattern, test_text, expected_result",
+                         [(r"INV-\d{6}", "Your invoice INV-123456 is due", True),
+                          (r"INV-\d{6}", "Your invoice INV-12345 is due", False),
+                          (r"inv-\d{6}", "INV-123456", True),
+                          (r"\d{2}\.\d{2}\.\d{4}", "on 01.02.2023.", True),
+                          (r"\d{2}\.\d{2}\.\d{4}", "on 01.02.23", False),
+                          (r"(foo|bar)+baz", "xxbarfoobaz", True),
+                          (r"(foo|bar)+baz", "xxbaz", False),
+                          (r"a[^0-9]c", "a1c abc", True),
+                          (r"x{2,3}y", "xy xxxy", True),
+                          (r"x{2,}y", "xy", False),
+                          (r"\w+@\w+\.com", "mail me@host.com", True),
+                          (r"a?", "", True),
+                          ])
+def test_compile_pattern_dfa_valid_input(test_pattern, test_text, expected_result):
+    assert run_dfa(test_pattern, test_text) == expected_result
+
+
+@pytest.mark.parametrize("test_pattern",
+                         [(""), (0), ("(ab"), ("ab)"), ("*a"), ("[a-"), ("[z-a]"), ("a{3,1}"), ("a{100}"),
+                          ("ä"), ("(a|b|c|d|e|f|g|h|i|j|k|l|m|n|o|p|q|r|s|t|u|v|w|x|y){32}"),
+                          ])
+def test_compile_pattern_dfa_invalid_input(test_pattern):
+    with pytest.raises(Exception):
+        shr.compile_pattern_dfa(test_pattern)
+
+
+@pytest.mark.parametrize("test_pattern, test_text",
+                         [(r"INV-\d{6}", "INV-123456"), (r"INV-\d{6}", "INV-12345"), (r"[a-c]\d+", "x b7"),
+                          (r"\d{20}", "DE" + "1" * 20), (r"\d{20}", "1" * 19)])
+def test_create_dfa_tables_valid_input(test_pattern, test_text):
+    num_of_states, num_of_classes, classes, transitions, accepting = shr.create_dfa_tables(test_pattern)
+    state_bitlen = num_of_states.bit_length() - 1
+    class_bitlen = num_of_classes.bit_length() - 1
+    assert num_of_states == 1 << state_bitlen and num_of_states >= shr.DFA_MIN_NUM_OF_STATES
+    assert num_of_classes == 1 << class_bitlen and num_of_classes >= shr.DFA_MIN_NUM_OF_CLASSES
+
+    # Run the DFA on the bit arrays of the tables, as the servers do on their shares
+    def bits(int_array, first, bitlen):
+        return sum((int_array[(first + bit) // 8] >> (7 - (first + bit) % 8) & 1) << bit for bit in range(bitlen))
+
+    state = 0
+    for character in test_text:
+        symbol_class = bits(classes, shr.SPECIAL_ENCODING[ord(character)] * class_bitlen, class_bitlen)
+        state = bits(transitions, (state * num_of_classes + symbol_class) * state_bitlen, state_bitlen)
+    assert bits(accepting, state, 1) == run_dfa(test_pattern, test_text)
+
+
+@pytest.mark.parametrize("test_input", [(0), (["word"])])
+def test_bloom_filter_positions_invalid_input(test_input):
+    with pytest.raises(Exception):
+        shr.bloom_filter_positions(test_input)
+
+
+@pytest.mark.parametrize("test_words", [(["alice", "bob"]), ([]), (["alice"])])
+def test_create_bloom_filter_valid_input(test_words):
+    bloom_filter = shr.create_bloom_filter(test_words)
+    assert len(bloom_filter) == shr.BLOOM_FILTER_SIZE // 8
+    for word in test_words:
+        for position in shr.bloom_filter_positions(word):
+            assert bloom_filter[position // 8] & (128 >> (position % 8))
+
+
+@pytest.mark.parametrize("test_position, test_size",
+                         [(0, 8), (7, 8), (0, 128), (127, 128), (128, 136), (925, 1024), (3999, 4000)])
+def test_create_dpf_keys_valid_input(test_position, test_size):
+    keys = shr.create_dpf_keys(test_position, test_size)
+    shares = [shr.expand_dpf_key(key) for key in keys]
+    assert [lhs ^ rhs for lhs, rhs in zip(*shares)] == shr.create_bit_array([test_position], test_size)
+    assert shares[0] != shares[1]
+
+
+def test_create_dpf_keys_compact():
+    size = 1 << 20
+    keys = shr.create_dpf_keys(12345, size)
+    assert all(len(key) < 512 for key in keys)
+    assert len(shr.expand_dpf_key(keys[0])) == size // 8
+
+
+@pytest.mark.parametrize("test_position, test_size",
+                         [(8, 8), (-1, 8), (0, 7), (0, 0), ("0", 8)])
+def test_create_dpf_keys_invalid_input(test_position, test_size):
+    with pytest.raises(Exception):
+        shr.create_dpf_keys(test_position, test_size)
+
+
+@pytest.mark.parametrize("test_key", [(""), ("AAAACA=="), ("invalid!")])
+def test_expand_dpf_key_invalid_input(test_key):
+    with pytest.raises(Exception):
+        shr.expand_dpf_key(test_key)
+
+
 @pytest.mark.parametrize("test_modifier_arguments, test_sequence_arguments, expected_result",
                          [(["NOT", "NOT", "NOT", "NOT", "NOT"], ["OR", "OR", "OR", "OR", ""], [255, 128]),
                           (["NOT", "NOT", "NOT", "NOT"], ["OR", "OR", "OR", ""], [254]),
@@ -90,15 +90,18 @@ class CustomSMTPHandler:  # pylint: disable=R0913,R0903
             mail_secret_share_block = ""
             mail_secret_share_truncated_block = ""
             mail_secret_share_bucket_blocks = {}
+            mail_secret_share_bloom_filter = ""
 
             secret_share_block_flag = False
             secret_share_truncated_block_flag = False
             secret_share_bucket_block_flag = False
+            secret_share_bloom_filter_flag = False
             secret_share_bucket_size = 0
 
             normal_block_scheme = (shr.START, shr.END)
             truncated_block_scheme = (shr.START_TRUNCATED, shr.END_TRUNCATED)
             bucket_block_scheme = (shr.START_BUCKET, shr.END_BUCKET)
+            bloom_filter_scheme = (shr.START_BLOOM, shr.END_BLOOM)
 
             for line in mail.body.splitlines():
                 start_or_end_found_flag = False
@@ -131,6 +134,14 @@ class CustomSMTPHandler:  # pylint: disable=R0913,R0903
                 mail_secret_share_bucket_blocks = bucket_blocks_result[2]
                 secret_share_bucket_size = bucket_blocks_result[3]
 
+                # Handle the Bloom filter blocks
+                bloom_filter_result = shr.handle_block_type(line, bloom_filter_scheme,
+                                                            secret_share_bloom_filter_flag,
+                                                            start_or_end_found_flag)
+
+                secret_share_bloom_filter_flag = bloom_filter_result[0]
+                start_or_end_found_flag = bloom_filter_result[1]
+
                 if start_or_end_found_flag:
                     continue
                 if secret_share_block_flag:
@@ -142,16 +153,20 @@ class CustomSMTPHandler:  # pylint: disable=R0913,R0903
                 if secret_share_bucket_block_flag:
                     mail_secret_share_bucket_blocks[secret_share_bucket_size].append(line)
                     continue
+                if secret_share_bloom_filter_flag:
+                    mail_secret_share_bloom_filter += line
+                    continue
 
                 # If not in any block, add to the body
                 mail_body += line
 
-            if secret_share_block_flag or secret_share_truncated_block_flag:
+            if secret_share_block_flag or secret_share_truncated_block_flag or secret_share_bloom_filter_flag:
                 log.warning("A secret share block did not have an ending")
 
             mail_dict[shr.YAML_STRINGS.BODY.value] = mail_body
             mail_dict[shr.YAML_STRINGS.SECRET_SHARE_BLOCK.value] = mail_secret_share_block
             mail_dict[shr.YAML_STRINGS.SECRET_SHARE_TRUNCATED_BLOCK.value] = mail_secret_share_truncated_block
+            mail_dict[shr.YAML_STRINGS.SECRET_SHARE_BLOOM_FILTER.value] = mail_secret_share_bloom_filter
 
             mail_dict[shr.YAML_STRINGS.SECRET_SHARE_BUCKET_BLOCKS.value] = {}
             for bucket_size in mail_secret_share_bucket_blocks:
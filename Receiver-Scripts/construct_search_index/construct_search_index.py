@@ -122,29 +122,100 @@ def construct_occurrence_array(search_index_dict):
     1010 0000 in binary representation.
     """
     # NOTE: Possibly move to privmail-commons
-    occurrence_list_encoding_array = [128, 64, 32, 16, 8, 4, 2, 1]
-    # Above follows from: [ 2^7, 2^6, 2^5, ..., 2^0 ]
-
     search_index_size = search_index_dict[shr.YAML_STRINGS.NUM_OF_EMAILS.value]
     for bucket_size, bucket_words in search_index_dict[shr.YAML_STRINGS.INDEX_BUCKETS.value].items():
         for word, sequence_numbers in bucket_words.items():
+            search_index_dict[shr.YAML_STRINGS.INDEX_BUCKETS.value][bucket_size][word] = \
+                encode_occurrence_array(sequence_numbers, search_index_size)
 
-            encoding_occurrence_list = []
-            encoding_result = 0
+    return search_index_dict
 
-            # Iterate through entire list of sequence_numbers
-            for sequence_number in range(search_index_size):
-                if sequence_number % 8 == 0 and sequence_number != 0:
-                    # Store current encoding result and reset for next byte
-                    encoding_occurrence_list.append(encoding_result)
-                    encoding_result = 0
-                if sequence_number in sequence_numbers:
-                    encoding_result += occurrence_list_encoding_array[sequence_number % 8]
+
+def encode_occurrence_array(sequence_numbers, search_index_size):
+    """Encode the sequence numbers of the mails that contain a word as an occurrence array.
+
+    See `construct_occurrence_array` for the encoding.
+    """
+    occurrence_list_encoding_array = [128, 64, 32, 16, 8, 4, 2, 1]
+    # Above follows from: [ 2^7, 2^6, 2^5, ..., 2^0 ]
+
+    encoding_occurrence_list = []
+    encoding_result = 0
+
+    # Iterate through entire list of sequence_numbers
+    for sequence_number in range(search_index_size):
+        if sequence_number % 8 == 0 and sequence_number != 0:
+            # Store current encoding result and reset for next byte
             encoding_occurrence_list.append(encoding_result)
+            encoding_result = 0
+        if sequence_number in sequence_numbers:
+            encoding_result += occurrence_list_encoding_array[sequence_number % 8]
+    encoding_occurrence_list.append(encoding_result)
 
-            search_index_dict[shr.YAML_STRINGS.INDEX_BUCKETS.value][bucket_size][word] = encoding_occurrence_list
+    return encoding_occurrence_list
 
-    return search_index_dict
+
+def posting_size_class(num_of_postings):
+    """Return the public size class of a posting list, i.e., the next power of two."""
+    size_class = 1
+    while size_class < num_of_postings:
+        size_class *= 2
+    return size_class
+
+
+def encode_posting_list(sequence_numbers, size_class, posting_bitlen):
+    """Encode the sequence numbers of the mails that contain a word as a padded posting list.
+
+    The posting list is a bit array (see `shr.create_bit_array`) of `size_class` postings with
+    `posting_bitlen` bits each (most significant bit first). A posting is the sequence number plus
+    one, and the padding postings after the actual ones are 0. E.g., the sequence numbers [0, 1]
+    in a size class of 4 with 2 bits each give [96], which is 0110 0000 in binary representation.
+    """
+    if len(sequence_numbers) > size_class:
+        raise Exception(f"Expected at most {size_class} sequence numbers but got: {len(sequence_numbers)}")
+
+    postings = [sequence_number + 1 for sequence_number in sorted(sequence_numbers)]
+    if any(not 0 < posting < 2 ** posting_bitlen for posting in postings):
+        raise Exception(f"Expected the sequence numbers plus one to fit in {posting_bitlen} bits "
+                        f"but got: {sequence_numbers}")
+    postings += [0] * (size_class - len(postings))
+    positions = []
+    for index, posting in enumerate(postings):
+        for bit in range(posting_bitlen):
+            if posting & (1 << (posting_bitlen - 1 - bit)):
+                positions.append(index * posting_bitlen + bit)
+    return shr.create_bit_array(positions, -(-size_class * posting_bitlen // 8) * 8)
+
+
+def secret_share_posting_lists(bucket_words_dict, search_index_size, num_shares, logger):
+    """Secret share each word and its padded posting list, grouped by the size classes of the posting lists."""
+    posting_bitlen = search_index_size.bit_length()
+    shared_posting_lists = collections.defaultdict(list)
+    for bucket in bucket_words_dict.values():
+        for word, sequence_numbers in bucket.items():
+            size_class = posting_size_class(len(sequence_numbers))
+            posting_list = encode_posting_list(sequence_numbers, size_class, posting_bitlen)
+            shared_posting_lists[size_class].append(
+                (shr.construct_shares(word, num_shares, logger, True),
+                 shr.construct_shares_from_array(posting_list, num_shares, logger))
+            )
+    return dict(shared_posting_lists), posting_bitlen
+
+
+def construct_ngram_occurrences(reconstructed_mail_dict):
+    """Collect the sequence numbers of the mails that contain each character n-gram.
+
+    The n-grams (of length shr.NGRAM_LENGTH) are taken from the truncated block, i.e., the same
+    text that the normal and hidden search modes scan. A keyword can only be a substring of a
+    mail if all of its n-grams occur in that mail.
+    """
+    ngram_occurrences = collections.defaultdict(set)
+    for mail in reconstructed_mail_dict:
+        text = mail.get(shr.YAML_STRINGS.SECRET_SHARE_TRUNCATED_BLOCK.value, "")
+        for position in range(len(text) - shr.NGRAM_LENGTH + 1):
+            ngram_occurrences[text[position:position + shr.NGRAM_LENGTH]].add(
+                mail[shr.YAML_STRINGS.SEQUENCE_NUMBER.value])
+    return dict(ngram_occurrences)
 
 
 def secret_share_index(bucket_words_dict, num_shares, logger):
@@ -160,7 +231,20 @@ def secret_share_index(bucket_words_dict, num_shares, logger):
     return shared_search_index_dict
 
 
-def construct_search_index(reconstructed_mail_dict, num_shares, index_name, logger):
+def secret_share_ngram_index(ngram_occurrences, search_index_size, num_shares, logger):
+    """Secret share each n-gram and its occurrence array for the n-gram search index."""
+    shared_ngram_index = []
+    for ngram, sequence_numbers in ngram_occurrences.items():
+        occurrence_array = encode_occurrence_array(sequence_numbers, search_index_size)
+        shared_ngram_index.append(
+            (shr.construct_shares(ngram, num_shares, logger, True),
+             shr.construct_shares_from_array(occurrence_array, num_shares, logger))
+        )
+    return shared_ngram_index
+
+
+def construct_search_index(reconstructed_mail_dict, num_shares, index_name, logger,  # pylint: disable=R0913
+                           ngram=False, postings=False):
     """Construct search_index file from a dictionary of mail data.
 
     The function expects the mail dictionary to contain the following fields:
@@ -175,6 +259,10 @@ def construct_search_index(reconstructed_mail_dict, num_shares, index_name, logg
 
     The function returns a search index representing the occurrence of each word for each mail.
     Where a '0' denotes that the word did not appear in a mail and '1' denotes that it did.
+    If `ngram` is set, the index additionally contains the occurrence of each character n-gram
+    of the truncated blocks (for substring search with the n-gram search mode).
+    If `postings` is set, the index contains a padded posting list of sequence numbers for each word
+    instead of the occurrence arrays (see `secret_share_posting_lists`).
     """
     search_index_dict = {}
     word_occurrence_string_dict = collections.defaultdict(list)
@@ -193,6 +281,9 @@ def construct_search_index(reconstructed_mail_dict, num_shares, index_name, logg
             flattened_word_list = list(itertools.chain(*bucket_words))
 
             for word in flattened_word_list:
+                # Skip the dummy words that pad the buckets of the mail
+                if word == shr.PADDING_CHARACTER * len(word):
+                    continue
                 if bucket_size not in word_occurrence_string_dict:
                     word_occurrence_string_dict[bucket_size] = collections.defaultdict(list)
                 word_occurrence_string_dict[bucket_size][word].append(mail[shr.YAML_STRINGS.
@@ -204,6 +295,15 @@ def construct_search_index(reconstructed_mail_dict, num_shares, index_name, logg
     # Convert to dict from defaultdict
     search_index_dict[shr.YAML_STRINGS.INDEX_BUCKETS.value] = \
         dict(search_index_dict[shr.YAML_STRINGS.INDEX_BUCKETS.value])
+
+    shared_posting_lists = {}
+    posting_bitlen = 0
+    if postings:
+        # The posting lists replace the occurrence arrays
+        shared_posting_lists, posting_bitlen = secret_share_posting_lists(
+            search_index_dict[shr.YAML_STRINGS.INDEX_BUCKETS.value],
+            search_index_dict[shr.YAML_STRINGS.NUM_OF_EMAILS.value], num_shares, logger)
+        search_index_dict[shr.YAML_STRINGS.INDEX_BUCKETS.value] = {}
     search_index_dict = construct_occurrence_array(search_index_dict)
 
     # Create UID for the query
@@ -217,6 +317,14 @@ def construct_search_index(reconstructed_mail_dict, num_shares, index_name, logg
 
     log.debug(f'Shared search index dict: {shared_search_index_dict}')
 
+    shared_ngram_index = []
+    if ngram:
+        ngram_occurrences = construct_ngram_occurrences(reconstructed_mail_dict)
+        log.debug(f'N-gram occurrences: {ngram_occurrences}')
+        shared_ngram_index = secret_share_ngram_index(ngram_occurrences,
+                                                      search_index_dict[shr.YAML_STRINGS.NUM_OF_EMAILS.value],
+                                                      num_shares, logger)
+
     # Store the shares in separate search index files
     for share_index in range(num_shares):
         this_search_index_dict = {}
@@ -232,6 +340,20 @@ def construct_search_index(reconstructed_mail_dict, num_shares, index_name, logg
                     {word_and_occurrance_shares[0][share_index]: word_and_occurrance_shares[1][share_index]}
                 )
 
+        if postings:
+            this_search_index_dict[shr.YAML_STRINGS.POSTING_BITLEN.value] = posting_bitlen
+            this_search_index_dict[shr.YAML_STRINGS.POSTING_LISTS.value] = {
+                size_class: [{word_and_posting_shares[0][share_index]: word_and_posting_shares[1][share_index]}
+                             for word_and_posting_shares in word_and_posting_list]
+                for size_class, word_and_posting_list in shared_posting_lists.items()
+            }
+
+        if ngram:
+            this_search_index_dict[shr.YAML_STRINGS.NGRAM_INDEX.value] = [
+                {ngram_and_occurrence_shares[0][share_index]: ngram_and_occurrence_shares[1][share_index]}
+                for ngram_and_occurrence_shares in shared_ngram_index
+            ]
+
         shr.generate_yaml_share_file(this_search_index_dict, shr.YAML_STRINGS.INDEX_FILE_NAME.value,
                                      share_index, index_name)
 
@@ -252,6 +374,12 @@ def generate_arg_parser():
                         help="Set the mail directory paths")
     parser.add_argument("-n", "--name", dest="name", type=str, default="",
                         help="Set fixed filename for the index shares (helpful for benchmark scripts)")
+    parser.add_argument("--ngram", dest="ngram", action="store_true",
+                        help="Add the character n-gram index for substring search (n-gram search mode)")
+    parser.add_argument("--postings", dest="postings", action="store_true",
+                        help="Store a padded posting list of sequence numbers for each word instead of an "
+                             "occurrence array over all mails (the index search mode then only finds whole words, "
+                             "not the words that start with a keyword)")
 
     return parser.parse_args()
 
@@ -264,7 +392,7 @@ def main():
 
     reconstructed_mail_dict, num_shares = reconstruct_mails_from_shares(args.paths, log)
 
-    construct_search_index(reconstructed_mail_dict, num_shares, args.name, log)
+    construct_search_index(reconstructed_mail_dict, num_shares, args.name, log, args.ngram, args.postings)
 
 
 if __name__ == "__main__":
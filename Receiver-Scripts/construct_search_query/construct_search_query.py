@@ -13,8 +13,12 @@ import privmailcommons.shared as shr  # noqa
 logging.basicConfig()
 log = logging.getLogger('csq')
 
+# Search modes of the PrivMail search, the empty one keeps the search mode of the query
+SEARCH_MODES = ['', 'normal', 'hidden', 'bucket', 'index', 'ngram', 'bloom', 'dfa']
 
-def secret_share_and_store(argument_list, num_shares):
+
+def secret_share_and_store(argument_list, num_shares, search_modes=None, patterns=False,  # pylint: disable=R0913
+                           regex=False):
     """Generate secret share of query and store in file.
 
     Returns True status if executed successfully
@@ -25,15 +29,43 @@ def secret_share_and_store(argument_list, num_shares):
     - argument_list[1]: field arguments
     - argument_list[2]: field modifiers (NOT arguments)
     - argument_list[3]: sequence share arguments
+
+    The optional search modes name the evaluation method of each keyword,
+    an empty string keeps the search mode of the whole query.
+
+    If `patterns` is set, the wildcard and digit class characters of the keywords are
+    secret shared as masks (see `shr.create_pattern_masks`).
+
+    If `regex` is set, each keyword is also compiled as a regular expression and its DFA is
+    secret shared for the dfa search mode (see `shr.create_dfa_tables`).
     """
     uid = shr.construct_uid(shr.UID_BYTE_LEN)
     keyword_shares = []
     length_shares = []
     truncated_keyword_shares = []
     bucketed_keyword_shares = []
+    bloom_position_shares = []
+    pattern_mask_shares = []
+    dfa_shares = []
 
     # Create keyword, truncated, keyword_length and bucketed_keyword shares
     for keyword in argument_list[0]:
+        pattern_masks = None
+        if patterns and (shr.WILDCARD_CHARACTER in keyword or shr.DIGIT_CLASS_CHARACTER in keyword):
+            keyword, wildcard_mask, digit_mask = shr.create_pattern_masks(keyword)
+            pattern_masks = (shr.construct_shares_from_array(wildcard_mask, num_shares, log),
+                             shr.construct_shares_from_array(digit_mask, num_shares, log))
+        pattern_mask_shares.append(pattern_masks)
+
+        dfa_tables = None
+        if regex and keyword:
+            num_of_states, num_of_classes, classes, transitions, accepting = shr.create_dfa_tables(keyword)
+            dfa_tables = (num_of_states, num_of_classes,
+                          shr.construct_shares_from_array(classes, num_shares, log),
+                          shr.construct_shares_from_array(transitions, num_shares, log),
+                          shr.construct_shares_from_array(accepting, num_shares, log))
+        dfa_shares.append(dfa_tables)
+
         keyword_shares.append(shr.construct_shares(keyword, num_shares, log))
         truncated_keyword_shares.append(shr.construct_shares(keyword, num_shares, log, True))
 
@@ -44,6 +76,17 @@ def secret_share_and_store(argument_list, num_shares):
         bucketed_keyword_shares.append((shr.construct_shares(
             bucketed_keyword, num_shares, log, True), len(bucketed_keyword)))
 
+        # One-hot bit arrays of the keyword's positions in the Bloom filters of the mails. Two servers get the
+        # compact DPF keys of the bit arrays, more servers their shares, which no two of them can combine
+        if num_shares == 2:
+            bloom_position_shares.append([shr.create_dpf_keys(position, shr.BLOOM_FILTER_SIZE)
+                                          for position in shr.bloom_filter_positions(keyword)])
+        else:
+            bloom_position_shares.append([
+                shr.construct_shares_from_array(shr.create_bit_array([position], shr.BLOOM_FILTER_SIZE),
+                                                num_shares, log)
+                for position in shr.bloom_filter_positions(keyword)])
+
     # Create encoded modifier shares
     encoded_modifier_argument_list = shr.create_modifier_argument_encoding(argument_list[2], argument_list[3], log)
     log.debug(f"Encoded modifier list: {encoded_modifier_argument_list}")
@@ -100,6 +143,32 @@ def secret_share_and_store(argument_list, num_shares):
                     bucketed_keyword_shares[index][0][share_index]
                 secret_share_dict_keywords[index][shr.YAML_STRINGS.KEYWORD_BUCKET_SIZE.value] = \
                     bucketed_keyword_shares[index][1]
+                bloom_positions_name = shr.YAML_STRINGS.KEYWORD_BLOOM_KEYS if num_shares == 2 \
+                    else shr.YAML_STRINGS.KEYWORD_BLOOM_POSITIONS
+                secret_share_dict_keywords[index][bloom_positions_name.value] = \
+                    [position_shares[share_index] for position_shares in bloom_position_shares[index]]
+                # The search mode is not secret, the servers need it to construct the search circuit
+                if search_modes and search_modes[index]:
+                    secret_share_dict_keywords[index][shr.YAML_STRINGS.KEYWORD_SEARCH_MODE.value] = \
+                        search_modes[index]
+                if pattern_mask_shares[index]:
+                    secret_share_dict_keywords[index][shr.YAML_STRINGS.KEYWORD_WILDCARD_MASK.value] = \
+                        pattern_mask_shares[index][0][share_index]
+                    secret_share_dict_keywords[index][shr.YAML_STRINGS.KEYWORD_DIGIT_MASK.value] = \
+                        pattern_mask_shares[index][1][share_index]
+                if dfa_shares[index]:
+                    # The padded sizes of the DFA are public, its tables are secret shared
+                    num_of_states, num_of_classes, classes, transitions, accepting = dfa_shares[index]
+                    secret_share_dict_keywords[index][shr.YAML_STRINGS.KEYWORD_DFA_NUM_OF_STATES.value] = \
+                        num_of_states
+                    secret_share_dict_keywords[index][shr.YAML_STRINGS.KEYWORD_DFA_NUM_OF_CLASSES.value] = \
+                        num_of_classes
+                    secret_share_dict_keywords[index][shr.YAML_STRINGS.KEYWORD_DFA_CLASSES.value] = \
+                        classes[share_index]
+                    secret_share_dict_keywords[index][shr.YAML_STRINGS.KEYWORD_DFA_TRANSITIONS.value] = \
+                        transitions[share_index]
+                    secret_share_dict_keywords[index][shr.YAML_STRINGS.KEYWORD_DFA_ACCEPTING.value] = \
+                        accepting[share_index]
 
         secret_shared_dict['bucket_scheme'] = shr.BUCKET_SCHEME
 
@@ -132,9 +201,40 @@ def generate_arg_parser():
     parser.add_argument("--share", dest="share_num", type=int, required=True,
                         help='Set the number of shares to split the search query')
 
+    parser.add_argument("--search-modes", dest="search_modes", type=str, default=None,
+                        help="Set the search mode of each keyword, an empty one keeps the mode of the query.\
+                        Example: index,'',hidden")
+
+    parser.add_argument("--patterns", dest="patterns", action="store_true",
+                        help=f"Treat '{shr.WILDCARD_CHARACTER}' in the keywords as any character and "
+                             f"'{shr.DIGIT_CLASS_CHARACTER}' as any digit")
+
+    parser.add_argument("--regex", dest="regex", action="store_true",
+                        help="Also compile each keyword as a regular expression for the dfa search mode.\
+                        Example: 'INV-\\d{6}'")
+
     return parser.parse_args()
 
 
+def split_keywords(argument, regex=False):
+    """Split the keyword argument at its commas, except those within {} or [] of regular expressions."""
+    if not regex:
+        return argument.split(',')
+
+    keywords = ['']
+    depth = 0
+    for character in argument:
+        if character in '{[':
+            depth += 1
+        elif character in '}]':
+            depth = max(depth - 1, 0)
+        if character == ',' and depth == 0:
+            keywords.append('')
+        else:
+            keywords[-1] += character
+    return keywords
+
+
 def bad_arguments(argument_list):
     """Check for bad arguments."""
     if len(argument_list) != 4:
@@ -169,19 +269,34 @@ def parse_input_arguments(args):
 
     # 1. Create argument list:
     argument_list = []
-    for argument in namespace_dict[shr.YAML_STRINGS.KEYWORDS.value]:
-        argument_list.append(argument.split(','))
+    for index, argument in enumerate(namespace_dict[shr.YAML_STRINGS.KEYWORDS.value]):
+        argument_list.append(split_keywords(argument, args.regex and index == 0))
 
     # 2. Check for bad arguments
     if bad_arguments(argument_list):
         return False, ""
 
+    search_modes = None
+    if args.search_modes is not None:
+        search_modes = args.search_modes.split(',')
+        if len(search_modes) != len(argument_list[0]):
+            log.error(f"Expected a search mode for each keyword but got: {search_modes}")
+            return False, ""
+        for search_mode in search_modes:
+            if search_mode not in SEARCH_MODES:
+                log.error(f"Expected search mode to be one of {SEARCH_MODES} but got: {search_mode}")
+                return False, ""
+
     # 3. Create secret shares
     if args.share_num < 2:
         log.error(f"Expected argument to be greater or equal to 2 but got: {args.share_num}")
         return False, ""
 
-    status = secret_share_and_store(argument_list, args.share_num)
+    try:
+        status = secret_share_and_store(argument_list, args.share_num, search_modes, args.patterns, args.regex)
+    except Exception as exception:  # pylint: disable=W0703
+        log.error(f"Constructing the search query failed: {exception}")
+        return False, ""
     # Check for error status
     if not status:
         return False, ""
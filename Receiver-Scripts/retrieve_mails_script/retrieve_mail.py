@@ -0,0 +1,136 @@
+"""Privmail Private Retrieval Client (PRC) Python script."""
+
+import argparse
+import base64
+import logging
+import sys
+
+import yaml
+
+# Import package from parent directory
+sys.path.append('..')
+import privmailcommons.shared as shr  # noqa
+
+
+logging.basicConfig()
+log = logging.getLogger('prc')
+
+# Number of servers that answer the retrieval keys of a share, they must hold the same share blocks
+NUM_OF_SERVERS = 2
+
+
+def construct_retrieval_keys(sequence_numbers, num_of_emails):
+    """Construct the retrieval keys of each server for the given sequence numbers.
+
+    The retrieval keys of a sequence number are the DPF keys of a one-hot bit array with a bit per mail
+    (see `shr.create_dpf_keys`), which the servers expand to their shares of it.
+    Return a list of NUM_OF_SERVERS lists, each with a key per sequence number.
+    """
+    if num_of_emails <= 0:
+        raise Exception(f"Expected the number of emails to be positive but got: {num_of_emails}")
+
+    # Round up to whole bytes, the servers ignore the bits beyond the last mail
+    size = (num_of_emails + 7) // 8 * 8
+
+    keys = [[] for _ in range(NUM_OF_SERVERS)]
+    for sequence_number in sequence_numbers:
+        if not 0 <= sequence_number < num_of_emails:
+            raise Exception(f"Expected sequence number to be in the range [0, {num_of_emails - 1}] "
+                            f"but got: {sequence_number}")
+        for server, key in enumerate(shr.create_dpf_keys(sequence_number, size)):
+            keys[server].append(key)
+    return keys
+
+
+def combine_retrieval_answers(answers):
+    """Combine the answers of the servers to the secret share blocks of the retrieved mails.
+
+    Expects a list with the list of base64 answers of each server and returns a base64 block per key.
+    """
+    blocks = []
+    for key_answers in zip(*answers):
+        decoded_answers = [base64.b64decode(answer, validate=True) for answer in key_answers]
+        block = bytes(len(decoded_answers[0]))
+        for answer in decoded_answers:
+            block = bytes(a ^ b for a, b in zip(block, answer))
+        blocks.append(base64.b64encode(block).decode(encoding="ascii"))
+    return blocks
+
+
+def reconstruct_retrieved_mails(blocks_per_provider):
+    """Reconstruct the mails from the retrieved secret share blocks of all providers.
+
+    The answers are padded with zeros to the longest block of the mailbox, which is removed here
+    since the mails only contain printable ASCII characters.
+    """
+    return [shr.reconstruct_shares(list(blocks), log).rstrip('\x00') for blocks in zip(*blocks_per_provider)]
+
+
+def generate_arg_parser():
+    """Generate an argument parser for constructing the retrieval keys and combining the answers."""
+    parser = argparse.ArgumentParser(
+        description="PrivMail Private Retrieval Client (PRC)")
+
+    # Arguments
+    parser.add_argument("-l", "--log", dest="logLevel", default='INFO', type=str,
+                        choices=['DEBUG', 'INFO',
+                                 'WARNING', 'ERROR', 'CRITICAL'],
+                        help="Set the logging level")
+
+    parser.add_argument("--sequence-numbers", dest="sequence_numbers", type=str, default=None,
+                        help="Construct the retrieval keys for these sequence numbers. Example: 3,17")
+
+    parser.add_argument("--num-of-emails", dest="num_of_emails", type=int, default=None,
+                        help="Set the number of emails in the mailbox for the retrieval keys")
+
+    parser.add_argument("--providers", dest="num_of_providers", type=int, default=2,
+                        help="Set the number of providers that hold a share of each mail")
+
+    parser.add_argument("--answers", dest="answers", type=str, nargs='*', default=None,
+                        help="Combine these answer files of the servers, provider by provider.\
+                        Example: provider_0_server_0.yaml provider_0_server_1.yaml provider_1_server_0.yaml ...")
+
+    return parser.parse_args()
+
+
+def main():
+    """Construct the retrieval keys or reconstruct the mails from the answers of the servers."""
+    # 1. Generate argument parser here
+    args = generate_arg_parser()
+
+    log.setLevel(getattr(logging, args.logLevel))
+
+    # 2. Construct independent keys for the servers of each provider's share
+    if args.sequence_numbers is not None:
+        if args.num_of_emails is None:
+            log.error("Expected the number of emails for constructing the retrieval keys")
+            return
+        sequence_numbers = [int(sequence_number) for sequence_number in args.sequence_numbers.split(',')]
+        for provider in range(args.num_of_providers):
+            keys = construct_retrieval_keys(sequence_numbers, args.num_of_emails)
+            for server, server_keys in enumerate(keys):
+                filename = shr.YAML_STRINGS.RETRIEVAL_KEY_FILE_NAME.value.format(provider, server)
+                with open(filename, 'w', encoding='ascii') as outfile:
+                    yaml.dump({shr.YAML_STRINGS.RETRIEVAL_KEYS.value: server_keys}, outfile,
+                              default_flow_style=False)
+                log.info(f"Retrieval keys for server {server} of provider {provider} written to {filename}")
+
+    # 3. Combine the answers of the servers of each provider and reconstruct the mails
+    if args.answers:
+        if len(args.answers) % NUM_OF_SERVERS != 0:
+            log.error(f"Expected {NUM_OF_SERVERS} answer files per provider but got: {len(args.answers)}")
+            return
+        blocks_per_provider = []
+        for first_answer in range(0, len(args.answers), NUM_OF_SERVERS):
+            answers = []
+            for answer_file_path in args.answers[first_answer:first_answer + NUM_OF_SERVERS]:
+                with open(answer_file_path, encoding='ascii') as answer_file:
+                    answers.append(yaml.safe_load(answer_file)[shr.YAML_STRINGS.RETRIEVAL_ANSWERS.value])
+            blocks_per_provider.append(combine_retrieval_answers(answers))
+
+        for mail in reconstruct_retrieved_mails(blocks_per_provider):
+            log.info(f"Retrieved mail:\n {mail}")
+
+
+if __name__ == "__main__":
+    main()
@@ -1,7 +1,9 @@
+import base64
 import pytest
 import construct_search_index.construct_search_index as csi
 import construct_search_query.construct_search_query as csq
 import receive_mails_script.receive_mail as rcp
+import retrieve_mails_script.retrieve_mail as prc
 import privmailcommons.shared as shr
 import logging
 import os
@@ -58,6 +60,64 @@ def test_secret_share_and_store(argument_list, num_shares, expected_result):
         os.rmdir(created_shared_dir)
 
 
+@pytest.mark.parametrize("argument, regex, expected_result",
+                         [("a,b", False, ["a", "b"]),
+                          ("INV-\\d{4,6},x", True, ["INV-\\d{4,6}", "x"]),
+                          ("[,;]x,y", True, ["[,;]x", "y"]),
+                          ("x{1,2}", False, ["x{1", "2}"]),
+                         ])
+def test_split_keywords(argument, regex, expected_result):
+    assert csq.split_keywords(argument, regex) == expected_result
+
+
+def test_secret_share_and_store_regex():
+    argument_list = [["INV-\\d{6}", "Name"], ['BODY', 'FROM'], ['', ''], ['OR', '']]
+    assert csq.secret_share_and_store(argument_list, 2, ['dfa', ''], regex=True)
+    for index in range(0, 2):
+        created_shared_dir = shr.YAML_STRINGS.QUERY_FILE_NAME.value+str(index) + "/"
+        for file in os.listdir(created_shared_dir):
+            with open(created_shared_dir+file) as f:
+                keywords = yaml.safe_load(f)[shr.YAML_STRINGS.KEYWORDS.value]
+            for keyword in keywords:
+                num_of_states = keyword[shr.YAML_STRINGS.KEYWORD_DFA_NUM_OF_STATES.value]
+                num_of_classes = keyword[shr.YAML_STRINGS.KEYWORD_DFA_NUM_OF_CLASSES.value]
+                assert (num_of_states, num_of_classes) == (shr.DFA_MIN_NUM_OF_STATES, shr.DFA_MIN_NUM_OF_CLASSES)
+                transitions = base64.b64decode(keyword[shr.YAML_STRINGS.KEYWORD_DFA_TRANSITIONS.value])
+                assert len(transitions) * 8 == num_of_states * num_of_classes * (num_of_states.bit_length() - 1)
+            assert keywords[0][shr.YAML_STRINGS.KEYWORD_SEARCH_MODE.value] == 'dfa'
+            os.remove(created_shared_dir+file)
+        os.rmdir(created_shared_dir)
+
+
+@pytest.mark.parametrize("num_shares", [(2), (3)])
+def test_secret_share_and_store_bloom(num_shares):
+    argument_list = [["Alice"], ['BODY'], [''], ['']]
+    assert csq.secret_share_and_store(argument_list, num_shares, ['bloom'])
+    position_shares = []
+    for index in range(0, num_shares):
+        created_shared_dir = shr.YAML_STRINGS.QUERY_FILE_NAME.value+str(index) + "/"
+        for file in os.listdir(created_shared_dir):
+            with open(created_shared_dir+file) as f:
+                keyword = yaml.safe_load(f)[shr.YAML_STRINGS.KEYWORDS.value][0]
+            # Two servers get DPF keys, more servers shares of the one-hot bit arrays
+            if num_shares == 2:
+                assert shr.YAML_STRINGS.KEYWORD_BLOOM_POSITIONS.value not in keyword
+                position_shares.append([shr.expand_dpf_key(key)
+                                        for key in keyword[shr.YAML_STRINGS.KEYWORD_BLOOM_KEYS.value]])
+            else:
+                assert shr.YAML_STRINGS.KEYWORD_BLOOM_KEYS.value not in keyword
+                position_shares.append([list(base64.b64decode(share))
+                                        for share in keyword[shr.YAML_STRINGS.KEYWORD_BLOOM_POSITIONS.value]])
+            os.remove(created_shared_dir+file)
+        os.rmdir(created_shared_dir)
+
+    for hash_index, position in enumerate(shr.bloom_filter_positions("Alice")):
+        one_hot = [0] * (shr.BLOOM_FILTER_SIZE // 8)
+        for shares in position_shares:
+            one_hot = [lhs ^ rhs for lhs, rhs in zip(one_hot, shares[hash_index])]
+        assert one_hot == shr.create_bit_array([position], shr.BLOOM_FILTER_SIZE)
+
+
 def create_mime_text(CONTENT, SUBJECT, FROM, TO):
     msg = MIMEText(CONTENT)
     msg[shr.YAML_STRINGS.FROM.value] = FROM
@@ -90,4 +150,111 @@ def test_reconstruct_emails(mail_dict, start, end, expected_result):
     for mail in mail_list:
         assert mail.as_string() == expected_result.as_string()
 
+@pytest.mark.parametrize("reconstructed_mail_dict, expected_result",
+                         [([{shr.YAML_STRINGS.SEQUENCE_NUMBER.value: 0,
+                             shr.YAML_STRINGS.SECRET_SHARE_TRUNCATED_BLOCK.value: "ABCD"},
+                            {shr.YAML_STRINGS.SEQUENCE_NUMBER.value: 2,
+                             shr.YAML_STRINGS.SECRET_SHARE_TRUNCATED_BLOCK.value: "BCDB"}],
+                           {"ABC": {0}, "BCD": {0, 2}, "CDB": {2}}),
+                          ([{shr.YAML_STRINGS.SEQUENCE_NUMBER.value: 0,
+                             shr.YAML_STRINGS.SECRET_SHARE_TRUNCATED_BLOCK.value: "AB"}], {})
+                         ])
+def test_construct_ngram_occurrences(reconstructed_mail_dict, expected_result):
+    ngram_occurrences = csi.construct_ngram_occurrences(reconstructed_mail_dict)
+    assert ngram_occurrences == expected_result
+    for sequence_numbers in ngram_occurrences.values():
+        assert len(csi.encode_occurrence_array(sequence_numbers, 9)) == 2
+    assert csi.encode_occurrence_array({0, 2}, 3) == [160]
+
+
+@pytest.mark.parametrize("sequence_numbers, size_class, posting_bitlen, expected_result",
+                         [([0, 1], 4, 2, [96]),
+                          ([1, 0], 2, 2, [96]),
+                          ([2], 2, 2, [192]),
+                          ([], 1, 3, [0]),
+                          ([0, 5], 4, 3, [56, 0])])
+def test_encode_posting_list(sequence_numbers, size_class, posting_bitlen, expected_result):
+    assert csi.encode_posting_list(sequence_numbers, size_class, posting_bitlen) == expected_result
+    assert csi.posting_size_class(len(sequence_numbers)) <= size_class
+
+
+@pytest.mark.parametrize("sequence_numbers, size_class, posting_bitlen",
+                         [([0, 1, 2], 2, 2), ([3], 1, 2), ([-2], 1, 2)])
+def test_encode_posting_list_invalid_input(sequence_numbers, size_class, posting_bitlen):
+    with pytest.raises(Exception):
+        csi.encode_posting_list(sequence_numbers, size_class, posting_bitlen)
+
+
+def test_secret_share_posting_lists_whole_words():
+    # The index search mode compares the bucketed keyword to the words of its bucket. With the occurrence arrays,
+    # it only compares the characters under the keyword's length mask, so it also finds the words that start with
+    # the keyword. With the posting lists, it compares the whole bucketed words, so it only finds the equal word
+    bucket_words_dict = {shr.BUCKET_SCHEME[0]: {shr.bucket_keyword("hello", logger): [0],
+                                                shr.bucket_keyword("help", logger): [1]}}
+    shared_posting_lists, posting_bitlen = csi.secret_share_posting_lists(bucket_words_dict, 2, 2, logger)
+    assert posting_bitlen == 2
+    index_words = [shr.reconstruct_shares(word_shares, logger, True)
+                   for word_and_posting_list in shared_posting_lists.values()
+                   for word_shares, _ in word_and_posting_list]
+    assert len(index_words) == 2
+
+    def bucketed(keyword):
+        return shr.reconstruct_shares(shr.construct_shares(shr.bucket_keyword(keyword, logger), 2, logger, True),
+                                      logger, True)
+
+    def length_mask_matches(keyword):
+        length = sum(bin(byte).count("1") for byte in shr.create_length_mask(len(keyword)))
+        return [word for word in index_words if word[:length] == bucketed(keyword)[:length]]
+
+    def posting_list_matches(keyword):
+        return [word for word in index_words if word == bucketed(keyword)]
+
+    assert length_mask_matches("hel") == index_words
+    assert not posting_list_matches("hel")
+    assert length_mask_matches("help") == posting_list_matches("help") == [bucketed("help")]
+
+
+
+@pytest.mark.parametrize("sequence_numbers, num_of_emails",
+                         [([0], 1), ([3, 17], 20), ([7, 8], 16)])
+def test_construct_retrieval_keys(sequence_numbers, num_of_emails):
+    keys = prc.construct_retrieval_keys(sequence_numbers, num_of_emails)
+    assert len(keys) == prc.NUM_OF_SERVERS
+    for index, sequence_number in enumerate(sequence_numbers):
+        one_hot = [a ^ b for a, b in zip(*[shr.expand_dpf_key(server_keys[index]) for server_keys in keys])]
+        assert one_hot == shr.create_bit_array([sequence_number], (num_of_emails + 7) // 8 * 8)
+
+
+@pytest.mark.parametrize("sequence_numbers, num_of_emails",
+                         [([20], 20), ([-1], 20), ([0], 0)])
+def test_construct_retrieval_keys_invalid_input(sequence_numbers, num_of_emails):
+    with pytest.raises(Exception):
+        prc.construct_retrieval_keys(sequence_numbers, num_of_emails)
+
+
+def test_retrieve_mails():
+    mails = ["First mail", "Second, longer mail", "", "Fourth"]
+    wanted = [1, 3]
+    shares = [shr.construct_shares(mail, 2, logger) for mail in mails]
+
+    blocks_per_provider = []
+    for provider in range(2):
+        # Both servers of a provider answer the keys with the same share blocks
+        provider_blocks = [base64.b64decode(share[provider]) for share in shares]
+        length = max(len(block) for block in provider_blocks)
+        answers = []
+        for server_keys in prc.construct_retrieval_keys(wanted, len(mails)):
+            server_answers = []
+            for key in server_keys:
+                selection = shr.expand_dpf_key(key)
+                answer = bytes(length)
+                for sequence_number, block in enumerate(provider_blocks):
+                    if selection[sequence_number // 8] >> (7 - sequence_number % 8) & 1:
+                        answer = bytes(a ^ b for a, b in zip(answer, block + bytes(length - len(block))))
+                server_answers.append(base64.b64encode(answer).decode())
+            answers.append(server_answers)
+        blocks_per_provider.append(prc.combine_retrieval_answers(answers))
+
+    assert prc.reconstruct_retrieved_mails(blocks_per_provider) == [mails[index] for index in wanted]
+
 # TODO: Write tests for remaining functions
\ No newline at end of file
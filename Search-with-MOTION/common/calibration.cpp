@@ -0,0 +1,257 @@
+// MIT License
+//
+// Copyright (c) 2021 Raine Nieminen
+// Cryptography and Privacy Engineering Group (ENCRYPTO)
+// TU Darmstadt, Germany
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "calibration.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <limits>
+#include <random>
+
+#include <fmt/format.h>
+#include <yaml-cpp/yaml.h>
+
+#include "protocols/share_wrapper.h"
+
+// Size of the synthetic search kernel (hidden search mode), small enough to keep the calibration short
+constexpr std::size_t kCalibrationMails = 64;
+constexpr std::size_t kCalibrationMailLength = 128;
+constexpr std::uint32_t kCalibrationBucketSize = 10;
+constexpr std::size_t kCalibrationRepetitions = 2;
+
+// Sizes of the micro-benchmarks for the round latency, the bandwidth, and the cost per gate
+constexpr std::size_t kLatencyDepth = 32;
+constexpr std::size_t kBandwidthSimdValues = 1 << 20;
+constexpr std::size_t kNumOfGates = 1 << 12;
+
+using circuit_builder = std::function<void(encrypto::motion::PartyPointer&)>;
+
+static std::string randomBase64String(std::mt19937& generator, const std::size_t num_of_bytes);
+
+static double timeCircuit(const std::function<encrypto::motion::PartyPointer()>& create_party,
+                          const circuit_builder& build_circuit, std::size_t* num_of_bytes_sent = nullptr);
+
+static std::vector<search_options> getCandidates(const search_options& base_options);
+
+static std::size_t agreeOnCandidate(const std::function<encrypto::motion::PartyPointer()>& create_party,
+                                    const std::size_t candidate);
+
+calibration_profile CalibrateSearchOptions(const std::function<encrypto::motion::PartyPointer()>& create_party,
+                                           const search_options& base_options) {
+  calibration_profile profile;
+
+  // Two 1-bit inputs (of different parties) that the micro-benchmarks combine with AND gates
+  auto input_bits = [](encrypto::motion::PartyPointer& party) {
+    const encrypto::motion::BitVector<> one(1, true);
+    encrypto::motion::ShareWrapper a = party->In<encrypto::motion::MpcProtocol::kBooleanGmw>(one, 0);
+    encrypto::motion::ShareWrapper b = party->In<encrypto::motion::MpcProtocol::kBooleanGmw>(one, 1);
+    return std::make_pair(a, b);
+  };
+
+  // The time of a single AND gate is the baseline (e.g., setting up the parties) for the other measurements
+  std::size_t base_bytes_sent = 0;
+  double base_time = timeCircuit(create_party, [&](encrypto::motion::PartyPointer& party) {
+    auto [a, b] = input_bits(party);
+    a & b;
+  }, &base_bytes_sent);
+
+  // Round latency: a chain of dependent AND gates
+  double latency_time = timeCircuit(create_party, [&](encrypto::motion::PartyPointer& party) {
+    auto [a, b] = input_bits(party);
+    for (std::size_t i = 0; i < kLatencyDepth; i++) a = a & b;
+  });
+  profile.round_latency_ms = std::max(0.0, latency_time - base_time) / (kLatencyDepth - 1);
+
+  // Bandwidth: a single very wide AND gate
+  std::size_t bandwidth_bytes_sent = 0;
+  double bandwidth_time = timeCircuit(create_party, [&](encrypto::motion::PartyPointer& party) {
+    const encrypto::motion::BitVector<> ones(kBandwidthSimdValues, true);
+    encrypto::motion::ShareWrapper a = party->In<encrypto::motion::MpcProtocol::kBooleanGmw>(ones, 0);
+    encrypto::motion::ShareWrapper b = party->In<encrypto::motion::MpcProtocol::kBooleanGmw>(ones, 1);
+    a & b;
+  }, &bandwidth_bytes_sent);
+  if (bandwidth_time > base_time && bandwidth_bytes_sent > base_bytes_sent) {
+    profile.bandwidth_mbit_per_s =
+        8.0 * (bandwidth_bytes_sent - base_bytes_sent) / (bandwidth_time - base_time) / 1000.0;
+  }
+
+  // Cost per gate: many independent AND gates on the same layer
+  double gates_time = timeCircuit(create_party, [&](encrypto::motion::PartyPointer& party) {
+    auto [a, b] = input_bits(party);
+    for (std::size_t i = 0; i < kNumOfGates; i++) a & b;
+  });
+  profile.gate_cost_us = std::max(0.0, gates_time - base_time) * 1000.0 / kNumOfGates;
+
+  // Generate the synthetic inputs (the contents are irrelevant, only the sizes must match between the parties)
+  std::mt19937 generator(std::random_device{}());
+  std::vector<search_query> search_queries(1);
+  search_queries[0].bucket_size = kCalibrationBucketSize;
+  search_queries[0].keyword_bucketed = randomBase64String(generator, kCalibrationBucketSize);
+  search_queries[0].keyword_length_mask = randomBase64String(generator, 6);
+  search_queries[0].keyword_truncated = search_queries[0].keyword_bucketed;
+  std::string modifier_chain_share = randomBase64String(generator, 1);
+  std::vector<mail_structure> mails(kCalibrationMails);
+  for (auto& mail : mails) mail.secret_share_truncated_block = randomBase64String(generator, kCalibrationMailLength);
+  const std::vector<std::uint32_t> bucket_scheme{5, 10, 15, 20};
+
+  // Run the synthetic kernel with each candidate and keep the fastest (as measured by this party)
+  auto candidates = getCandidates(base_options);
+  std::size_t best_candidate = 0;
+  double best_time = std::numeric_limits<double>::max();
+  for (std::size_t candidate = 0; candidate < candidates.size(); candidate++) {
+    for (std::size_t repetition = 0; repetition < kCalibrationRepetitions; repetition++) {
+      double candidate_time = timeCircuit(create_party, [&](encrypto::motion::PartyPointer& party) {
+        BuildPrivMailSearch(party, search_queries, modifier_chain_share, mails, search_index(), bucket_scheme, eHidden,
+                            candidates[candidate]);
+      });
+      if (candidate_time < best_time) {
+        best_time = candidate_time;
+        best_candidate = candidate;
+      }
+    }
+  }
+
+  // The measurements of the parties may differ, so all parties use the candidate chosen by party 0
+  profile.options = candidates.at(agreeOnCandidate(create_party, best_candidate));
+  return profile;
+}
+
+void SaveCalibrationProfile(const calibration_profile& profile, const std::string& profile_path) {
+  YAML::Emitter profile_yaml;
+  profile_yaml << YAML::BeginMap;
+  profile_yaml << YAML::Key << "round_latency_ms" << YAML::Value << profile.round_latency_ms;
+  profile_yaml << YAML::Key << "bandwidth_mbit_per_s" << YAML::Value << profile.bandwidth_mbit_per_s;
+  profile_yaml << YAML::Key << "gate_cost_us" << YAML::Value << profile.gate_cost_us;
+  profile_yaml << YAML::Key << "reduction_strategy" << YAML::Value
+               << (profile.options.coalesce_layers ? "low_depth" : "low_size");
+  profile_yaml << YAML::Key << "chunk_size" << YAML::Value << profile.options.chunk_size;
+  profile_yaml << YAML::Key << "simd_width" << YAML::Value << profile.options.simd_width;
+  profile_yaml << YAML::EndMap;
+
+  std::ofstream profile_file;
+  profile_file.open(profile_path);
+  profile_file << profile_yaml.c_str() << std::endl;
+  profile_file.close();
+}
+
+calibration_profile LoadCalibrationProfile(const std::string& profile_path, const search_options& base_options) {
+  YAML::Node profile_yaml_file = YAML::LoadFile(profile_path);
+
+  calibration_profile profile;
+  profile.round_latency_ms = profile_yaml_file["round_latency_ms"].as<double>();
+  profile.bandwidth_mbit_per_s = profile_yaml_file["bandwidth_mbit_per_s"].as<double>();
+  profile.gate_cost_us = profile_yaml_file["gate_cost_us"].as<double>();
+
+  profile.options = base_options;
+  std::string reduction_strategy = profile_yaml_file["reduction_strategy"].as<std::string>();
+  if (reduction_strategy == "low_depth") {
+    profile.options.coalesce_layers = true;
+  } else if (reduction_strategy == "low_size") {
+    profile.options.coalesce_layers = false;
+  } else {
+    throw std::runtime_error("Invalid reduction strategy " + reduction_strategy);
+  }
+  profile.options.chunk_size = profile_yaml_file["chunk_size"].as<std::size_t>();
+  profile.options.simd_width = profile_yaml_file["simd_width"].as<std::size_t>();
+  return profile;
+}
+
+static std::string randomBase64String(std::mt19937& generator, const std::size_t num_of_bytes) {
+  const static std::string base64_chars =
+      "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+      "abcdefghijklmnopqrstuvwxyz"
+      "0123456789+/";
+  std::uniform_int_distribution<std::uint32_t> byte_distribution(0, 255);
+  std::string encoded;
+  for (std::size_t i = 0; i < num_of_bytes; i += 3) {
+    // Encode 3 bytes at a time as 4 characters, pad the last group with '='
+    const std::size_t num_of_group_bytes = std::min<std::size_t>(3, num_of_bytes - i);
+    std::uint32_t bit_stream = 0;
+    for (std::size_t j = 0; j < 3; j++) {
+      bit_stream = (bit_stream << 8) | (j < num_of_group_bytes ? byte_distribution(generator) : 0);
+    }
+    for (std::size_t j = 0; j < 4; j++) {
+      encoded.push_back(j <= num_of_group_bytes ? base64_chars[bit_stream >> (18 - 6 * j) & 0x3f] : '=');
+    }
+  }
+  return encoded;
+}
+
+static double timeCircuit(const std::function<encrypto::motion::PartyPointer()>& create_party,
+                          const circuit_builder& build_circuit, std::size_t* num_of_bytes_sent) {
+  // Returns the time in milliseconds to construct and run the circuit (excluding the connection setup)
+  encrypto::motion::PartyPointer party{create_party()};
+  auto start = std::chrono::steady_clock::now();
+  build_circuit(party);
+  party->Run();
+  party->Finish();
+  auto end = std::chrono::steady_clock::now();
+
+  if (num_of_bytes_sent != nullptr) {
+    *num_of_bytes_sent = 0;
+    for (auto& transport_statistics : party->GetCommunicationLayer().GetTransportStatistics()) {
+      *num_of_bytes_sent += transport_statistics.num_bytes_sent;
+    }
+  }
+  return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+static std::vector<search_options> getCandidates(const search_options& base_options) {
+  std::vector<search_options> candidates;
+
+  // Low size: a separate comparison and reduction circuit for each mail, no SIMD conversion gates
+  search_options low_size = base_options;
+  low_size.coalesce_layers = false;
+  low_size.chunk_size = 0;
+  low_size.simd_width = 0;
+  candidates.push_back(low_size);
+
+  // Low depth: the layers of the mails are coalesced, possibly in chunks of mails and with narrower gates
+  for (std::size_t chunk_size : {std::size_t(0), kCalibrationMails / 4}) {
+    for (std::size_t simd_width : {std::size_t(0), std::size_t(256)}) {
+      search_options low_depth = base_options;
+      low_depth.coalesce_layers = true;
+      low_depth.chunk_size = chunk_size;
+      low_depth.simd_width = simd_width;
+      candidates.push_back(low_depth);
+    }
+  }
+  return candidates;
+}
+
+static std::size_t agreeOnCandidate(const std::function<encrypto::motion::PartyPointer()>& create_party,
+                                    const std::size_t candidate) {
+  encrypto::motion::PartyPointer party{create_party()};
+
+  // Party 0 inputs its choice and all parties get it as the output
+  auto candidate_bits = encrypto::motion::ToInput(static_cast<std::uint8_t>(candidate));
+  encrypto::motion::ShareWrapper candidate_input =
+      party->In<encrypto::motion::MpcProtocol::kBooleanGmw>(candidate_bits, 0);
+  auto agreed_candidate = candidate_input.Out();
+
+  party->Run();
+  party->Finish();
+  return agreed_candidate.As<std::uint8_t>();
+}
@@ -0,0 +1,50 @@
+// MIT License
+//
+// Copyright (c) 2021 Raine Nieminen
+// Cryptography and Privacy Engineering Group (ENCRYPTO)
+// TU Darmstadt, Germany
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include <functional>
+#include <string>
+
+#include "common/privmail.h"
+
+struct calibration_profile {
+  // Measured with synthetic kernels on this host, only informative
+  double round_latency_ms = 0;
+  double bandwidth_mbit_per_s = 0;
+  double gate_cost_us = 0;
+
+  // Best settings for the search circuits, agreed on by all parties
+  search_options options;
+};
+
+// Runs short synthetic PrivMail kernels with the connected parties and picks the fastest search options. Each
+// kernel runs on a fresh party, which is created with create_party (all parties must calibrate at the same time)
+calibration_profile CalibrateSearchOptions(const std::function<encrypto::motion::PartyPointer()>& create_party,
+                                           const search_options& base_options);
+
+void SaveCalibrationProfile(const calibration_profile& profile, const std::string& profile_path);
+
+// Overwrites the tuned settings of options with the ones from the profile file
+calibration_profile LoadCalibrationProfile(const std::string& profile_path, const search_options& base_options);
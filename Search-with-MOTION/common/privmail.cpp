@@ -24,19 +24,48 @@
 
 #include "privmail.h"
 
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <map>
+#include <numeric>
+
 #include "algorithm/algorithm_description.h"
 #include "algorithm/low_depth_reduce.h"
+#include "protocols/boolean_gmw/boolean_gmw_wire.h"
 #include "protocols/share_wrapper.h"
+#include "privmail_dpf.h"
+#include "privmail_io.h"
+#include "search_circuit.h"
 #include "secure_type/secure_unsigned_integer.h"
 #include "statistics/analysis.h"
 #include "statistics/run_time_statistics.h"
 #include "utility/config.h"
 
+// Truncate the length of each character, follows from the special PrivMail encoding
+constexpr std::size_t kCharacterBitlen = 6;
+
+// Length of the character n-grams in the n-gram search index
+constexpr std::size_t kNgramLength = 3;
+
+// A text in the intermediate representation of the circuit, with a node per bit of each character
+using circuit_text = std::vector<std::vector<SearchCircuit::Node>>;
+
+// Pads the selected texts of the two-stage search, follows from the special PrivMail encoding of '*'
+constexpr std::uint8_t kPaddingCharacter = 42;
+
 static void debugMessage(const encrypto::motion::PartyPointer& party, const std::string message);
 
+static std::vector<std::uint8_t> simple_base64_decoder(const std::string& data);
+
+static void xorInto(std::vector<std::uint8_t>& destination, const std::vector<std::uint8_t>& source);
+
 static std::vector<encrypto::motion::ShareWrapper> base64StringToInput(
     const encrypto::motion::PartyPointer& party, const std::string& input_string);
 
+static std::vector<encrypto::motion::ShareWrapper> bytesToInput(const encrypto::motion::PartyPointer& party,
+                                                                const std::vector<std::uint8_t>& share_bytes);
+
 static std::vector<encrypto::motion::ShareWrapper> FromSharesToValue(
   const std::vector<std::vector<encrypto::motion::ShareWrapper>> shares);
 
@@ -47,645 +76,414 @@ static std::vector<encrypto::motion::SecureUnsignedInteger> concatenateTo8bitSec
     const std::vector<encrypto::motion::ShareWrapper>& input,
     const encrypto::motion::ShareWrapper& full_zero);
 
+static truncated_text truncateCharacters(const std::vector<encrypto::motion::ShareWrapper>& characters);
+
 static std::vector<query_input> getBucketedKeywordInput(
     encrypto::motion::PartyPointer& party, const std::vector<search_query>& search_queries);
 
+static std::vector<encrypto::motion::ShareWrapper> getIgnoreBits(const query_input& search_keyword);
+
+static std::vector<encrypto::motion::ShareWrapper> getDigitClassBits(const query_input& search_keyword);
+
 static std::uint32_t getMinKeywordLength(const std::uint32_t bucket_size,
                                          const std::vector<std::uint32_t> bucket_scheme);
 
+static std::size_t appendTextComparisons(comparison_batch& batch,
+                                         const truncated_text& keyword,
+                                         const std::vector<encrypto::motion::ShareWrapper>& ignore_bits,
+                                         const std::vector<encrypto::motion::ShareWrapper>& digit_class_bits,
+                                         const truncated_text& text,
+                                         const std::size_t min_keyword_length);
+
+static encrypto::motion::ShareWrapper isDigitCharacter(const std::vector<encrypto::motion::ShareWrapper>& character);
+
+static std::vector<encrypto::motion::ShareWrapper> CompareCharacterBatch(const comparison_batch& batch,
+                                                                         const std::size_t keyword_length);
+
+static std::vector<encrypto::motion::ShareWrapper> SearchKeyword(
+    const truncated_text& keyword,
+    const std::vector<encrypto::motion::ShareWrapper>& ignore_bits,
+    const std::vector<encrypto::motion::ShareWrapper>& digit_class_bits,
+    const std::vector<std::vector<const truncated_text*>>& targets,
+    const std::size_t min_keyword_length,
+    const encrypto::motion::ShareWrapper& full_zero,
+    const search_options& options);
+
+static std::vector<encrypto::motion::ShareWrapper> SearchKeywordWithCircuit(
+    const truncated_text& keyword,
+    const std::vector<encrypto::motion::ShareWrapper>& ignore_bits,
+    const std::vector<encrypto::motion::ShareWrapper>& digit_class_bits,
+    const std::vector<std::vector<const truncated_text*>>& targets,
+    const std::size_t min_keyword_length,
+    const encrypto::motion::ShareWrapper& full_zero,
+    const search_options& options);
+
+static std::vector<encrypto::motion::ShareWrapper> SearchKeywordByLength(
+    const truncated_text& keyword,
+    const std::vector<encrypto::motion::ShareWrapper>& ignore_bits,
+    const std::vector<encrypto::motion::ShareWrapper>& digit_class_bits,
+    const std::vector<std::vector<const truncated_text*>>& targets,
+    const std::size_t min_keyword_length,
+    const encrypto::motion::ShareWrapper& full_zero,
+    const search_options& options);
+
+static std::vector<SearchCircuit::Node> BuildKeywordComparisons(
+    SearchCircuit& circuit,
+    const circuit_text& keyword,
+    const std::vector<SearchCircuit::Node>& ignore_bits,
+    const std::vector<SearchCircuit::Node>& digit_class_bits,
+    const std::vector<std::vector<circuit_text>>& targets,
+    const std::size_t min_keyword_length,
+    const search_options& options);
+
+template <typename BinaryOperation>
+static std::vector<encrypto::motion::ShareWrapper> CoalescedLowDepthReduce(
+    std::vector<std::vector<encrypto::motion::ShareWrapper>> groups, BinaryOperation operation,
+    const std::size_t simd_width);
+
+static std::vector<encrypto::motion::ShareWrapper> SearchNgramIndex(
+    const query_input& search_keyword,
+    const std::vector<truncated_text>& ngrams,
+    const std::vector<std::vector<encrypto::motion::ShareWrapper>>& ngram_occurrences,
+    const std::size_t num_of_emails,
+    const encrypto::motion::ShareWrapper& full_zero);
+
+static std::vector<std::vector<encrypto::motion::ShareWrapper>> SearchPostingLists(
+    const encrypto::motion::PartyPointer& party,
+    const std::vector<query_input>& search_keywords,
+    const search_index& search_index,
+    const encrypto::motion::ShareWrapper& full_zero,
+    const search_options& options);
+
+static encrypto::motion::ShareWrapper ScatterPostings(const encrypto::motion::ShareWrapper& postings,
+                                                     const std::size_t num_of_postings,
+                                                     const std::size_t posting_bitlen,
+                                                     const std::size_t num_of_emails);
+
+static std::vector<std::vector<encrypto::motion::ShareWrapper>> ExclusivePrefixCount(
+    const std::vector<encrypto::motion::ShareWrapper>& bits,
+    const encrypto::motion::ShareWrapper& full_zero);
+
+static std::vector<std::vector<encrypto::motion::ShareWrapper>> VerifyCandidates(
+    const encrypto::motion::PartyPointer& party,
+    const std::vector<query_input>& search_keywords,
+    const std::vector<truncated_text>& target_texts,
+    const std::vector<std::vector<encrypto::motion::ShareWrapper>>& candidates_per_keyword,
+    const std::vector<std::uint32_t>& bucket_scheme,
+    const encrypto::motion::ShareWrapper& full_zero,
+    const search_options& options);
+
+static std::vector<std::vector<encrypto::motion::ShareWrapper>> SearchBloomFilters(
+    const std::vector<std::vector<std::vector<encrypto::motion::ShareWrapper>>>& keyword_positions,
+    const std::vector<std::vector<encrypto::motion::ShareWrapper>>& bloom_filters,
+    const encrypto::motion::ShareWrapper& full_zero);
+
+static std::vector<dfa_input> getDfaInput(encrypto::motion::PartyPointer& party,
+                                          const std::vector<search_query>& search_queries);
+
+static std::vector<encrypto::motion::ShareWrapper> decodeOneHot(const std::vector<encrypto::motion::ShareWrapper>& bits,
+                                                               const std::size_t width);
+
+static encrypto::motion::ShareWrapper xorReduceMiddle(encrypto::motion::ShareWrapper values, const std::size_t outer,
+                                                      std::size_t middle, const std::size_t inner);
+
+static std::vector<std::vector<encrypto::motion::ShareWrapper>> SearchDfa(
+    const std::vector<dfa_input>& patterns,
+    const std::vector<truncated_text>& target_texts);
+
+static truncated_text getMailText(const encrypto::motion::PartyPointer& party, const mail_structure& mail);
+
+static bool searchesMailTexts(const search_mode_enum search_mode, const search_options& options);
+
+static std::vector<std::vector<encrypto::motion::ShareWrapper>> SearchKeywordsWithMode(
+    encrypto::motion::PartyPointer& party,
+    const std::vector<search_query>& search_queries,
+    const std::vector<mail_structure>& mails,
+    const std::vector<truncated_text>& mail_texts,
+    const search_index& search_index,
+    const std::vector<std::uint32_t>& bucket_scheme,
+    const search_mode_enum search_mode,
+    const encrypto::motion::ShareWrapper& full_zero,
+    const search_options& options);
+
+static std::vector<encrypto::motion::ShareWrapper> buildPrivMailSearch(encrypto::motion::PartyPointer& party,
+                                                                       const std::vector<search_query>& search_queries,
+                                                                       const std::string& modifier_chain_share,
+                                                                       const std::vector<mail_structure>& mails,
+                                                                       const std::vector<truncated_text>& mail_texts,
+                                                                       const search_index& search_index,
+                                                                       const std::vector<std::uint32_t> bucket_scheme,
+                                                                       const search_mode_enum& search_mode,
+                                                                       const search_options& options);
+
+static std::vector<std::vector<encrypto::motion::ShareWrapper>> IndexResultsPerMail(
+    const encrypto::motion::PartyPointer& party,
+    const std::vector<std::vector<encrypto::motion::ShareWrapper>>& word_results_per_keyword,
+    const search_index& search_index,
+    const encrypto::motion::ShareWrapper& full_zero,
+    const search_options& options);
+
 static encrypto::motion::ShareWrapper CreateChainingCircuit(
     const encrypto::motion::ShareWrapper& previous_search_result,
     const encrypto::motion::ShareWrapper& new_search_result,
     const encrypto::motion::ShareWrapper& OR_BIT,
     const encrypto::motion::ShareWrapper& NOT_BIT);
 
+static void ChainKeywordResults(std::vector<encrypto::motion::ShareWrapper>& search_results,
+                                const std::vector<encrypto::motion::ShareWrapper>& keyword_results,
+                                const std::size_t keyword_index,
+                                const std::vector<encrypto::motion::ShareWrapper>& modifier_chain_share_input,
+                                const search_options& options);
+
 std::vector<encrypto::motion::ShareWrapper> PrivMailSearch(encrypto::motion::PartyPointer& party,
                                                            const std::vector<search_query>& search_queries,
                                                            const std::string& modifier_chain_share,
                                                            const std::vector<mail_structure>& mails,
                                                            const search_index& search_index,
                                                            const std::vector<std::uint32_t> bucket_scheme,
-                                                           const search_mode_enum& search_mode) {
-  // Create a ShareWrapper initialized with 0 (false)
-  const encrypto::motion::ShareWrapper full_zero = party->In<encrypto::motion::MpcProtocol::kBooleanGmw>(
-      encrypto::motion::BitVector<>(1, false), 0);
-
-  // Decode and initialize the modifier_chain_share
-  debugMessage(party, fmt::format("Modifier chain share: {}", modifier_chain_share));
-  auto modifier_chain_input = base64StringToInput(party, modifier_chain_share);
-  auto modifier_chain_share_input = splitTo1bitShareWrappers(modifier_chain_input);
-
-  // Declare a vector for the final results
-  std::vector<encrypto::motion::ShareWrapper> search_results;
-
-  switch (search_mode) {
-    case eNormal: {
-      // Decode and initialize the search keywords
-      std::vector<std::vector<encrypto::motion::ShareWrapper>> search_keywords;
-      for (auto& search_query : search_queries) {
-        debugMessage(party, fmt::format("Keyword: {} (no bucketing)", search_query.keyword_truncated));
-        search_keywords.push_back(base64StringToInput(party, search_query.keyword_truncated));
-      }
-      assert(modifier_chain_share_input.size() >= 2 * search_keywords.size() - 1);
-
-      // Decode and initialize the target text
-      std::vector<std::vector<encrypto::motion::ShareWrapper>> target_texts;
-      for (auto& mail : mails) {
-        debugMessage(party, fmt::format("Target text: {}", mail.secret_share_truncated_block));
-        target_texts.push_back(base64StringToInput(party, mail.secret_share_truncated_block));
-      }
-
-      // Resize the vector for the final results
-      search_results.resize(target_texts.size());
-
-      // Search with the keywords over the target texts
-      for (std::size_t j = 0; j < search_keywords.size(); j++) {
-        for (std::size_t i = 0; i < target_texts.size(); i++) {
-          // Search over a single text with a single keyword
-          auto search_keyword = search_keywords[j];
-          auto target_text = target_texts[i];
-
-          std::int32_t num_of_positions = target_text.size() - search_keyword.size() + 1;
-
-          if (num_of_positions < 1) {
-            // Nothing to compare, most likely the target text is very short
-
-            // Chain the zero result (false) for each keyword and take NOT if needed
-            if (j == 0) {
-              // For the first keyword we have nothing to chain
-              search_results[i] = full_zero ^ modifier_chain_share_input[0];  // NOT if XORed with 1
-            } else {
-              search_results[i] = CreateChainingCircuit(search_results[i],
-                                                        full_zero,
-                                                        modifier_chain_share_input[2 * j - 1],
-                                                        modifier_chain_share_input[2 * j]);
-            }
-            continue;
-          }
-
-          std::vector<std::vector<encrypto::motion::ShareWrapper>> xnor_splitted_per_position;
-          for (int32_t k = 0; k < num_of_positions; k++) {
-            // Compare the keyword to the text at each position
-
-            std::vector<encrypto::motion::ShareWrapper> splitted_keyword;
-            std::vector<encrypto::motion::ShareWrapper> splitted_text;
-            for (std::size_t c = 0; c < search_keyword.size(); c++) {
-              // Truncate the length of each character
-              const int character_bitlen = 6;  // Follows from the special PrivMail encoding
-
-              // Collect the truncated characters
-              auto splitted_keyword_character = search_keyword[c].Split();
-              splitted_keyword.insert(splitted_keyword.end(),
-                                      splitted_keyword_character.begin(),
-                                      splitted_keyword_character.begin() + character_bitlen);
-
-              auto splitted_text_character = target_text[c + k].Split();
-              splitted_text.insert(splitted_text.end(),
-                                  splitted_text_character.begin(),
-                                  splitted_text_character.begin() + character_bitlen);
-            }
-            // Concatenate truncated characters and compare the long strings
-            auto a = encrypto::motion::ShareWrapper::Concatenate(splitted_keyword);
-            auto b = encrypto::motion::ShareWrapper::Concatenate(splitted_text);
-            auto xnor_ab = ~(a ^ b);  // XNOR
-            xnor_splitted_per_position.push_back(xnor_ab.Split());
-          }
-
-          // Combine the bits (basically transfers {{a,b},{c,d}} to {{a,c},{b,d}})
-          std::vector<std::vector<encrypto::motion::ShareWrapper>> xnor_combined(xnor_splitted_per_position[0].size());
-          for (auto& xnor_position_splitted : xnor_splitted_per_position) {
-            for (std::size_t i = 0; i < xnor_position_splitted.size(); i++) {
-              xnor_combined[i].push_back(xnor_position_splitted[i]);
-            }
-          }
+                                                           const search_mode_enum& search_mode,
+                                                           const search_options& options) {
+  auto search_results = BuildPrivMailSearch(party, search_queries, modifier_chain_share, mails, search_index,
+                                            bucket_scheme, search_mode, options);
 
-          // Concatenate each combined string
-          std::vector<encrypto::motion::ShareWrapper> xnor_concatenated;
-          for (auto& xnor_comb : xnor_combined) {
-            xnor_concatenated.push_back(encrypto::motion::ShareWrapper::Simdify(xnor_comb));
-          }
-
-          // Do the AND operations now in parallel
-          encrypto::motion::ShareWrapper result_bits = LowDepthReduce(xnor_concatenated, std::bit_and<>());
-
-          // Finally, use OR tree to get the final answer of whether any of the comparisons was a match
-          auto search_result_per_email =  LowDepthReduce(result_bits.Split(), std::bit_or<>());
+  party->Run();
+  party->Finish();
 
-          assert(search_result_per_email->GetBitLength() == 1);
+  return search_results;
+}
 
-          // Chain the results for each keyword and take NOT if needed
-          if (j == 0) {
-            // For the first keyword we have nothing to chain
-            search_results[i] = search_result_per_email ^ modifier_chain_share_input[0];  // NOT if XORed with 1
-          } else {
-            search_results[i] = CreateChainingCircuit(search_results[i],
-                                                      search_result_per_email,
-                                                      modifier_chain_share_input[2 * j - 1],
-                                                      modifier_chain_share_input[2 * j]);
-          }
-        }
-      }
+std::vector<bool> GetResultShares(const std::vector<encrypto::motion::ShareWrapper>& search_results) {
+  // Each party outputs its own share of the results, such that only the client learns the results (by XOR)
+  std::vector<bool> result_shares;
+  for (auto& search_result : search_results) {
+    auto wire = std::dynamic_pointer_cast<encrypto::motion::proto::boolean_gmw::Wire>(search_result->GetWires().at(0));
+    if (!wire) throw std::invalid_argument("Result shares are only supported for the boolean_gmw protocol");
+    result_shares.push_back(wire->GetValues().Get(0));
+  }
+  return result_shares;
+}
 
-      break;
+std::vector<std::vector<std::uint8_t>> AnswerRetrievalKeys(const std::vector<mail_structure>& mails,
+                                                           const std::vector<std::string>& retrieval_keys) {
+  // Each key expands to the server's share of a one-hot bit array over the mails
+  std::vector<std::vector<std::uint8_t>> selections;
+  for (auto& retrieval_key : retrieval_keys) {
+    selections.push_back(ExpandDpfKey(simple_base64_decoder(retrieval_key)));
+    if (selections.back().size() * 8 < mails.size()) {
+      throw std::invalid_argument("Retrieval key has fewer bits than there are mails");
     }
-    case eHidden: {
-      // Decode and initialize the search keywords (bucketed versions)
-      std::vector<query_input> search_keywords = getBucketedKeywordInput(party, search_queries);
-      assert(modifier_chain_share_input.size() >= 2 * search_keywords.size() - 1);
-
-      // Decode and initialize the target text
-      std::vector<std::vector<encrypto::motion::ShareWrapper>> target_texts;
-      for (auto& mail : mails) {
-        debugMessage(party, fmt::format("Target text: {}", mail.secret_share_truncated_block));
-        target_texts.push_back(base64StringToInput(party, mail.secret_share_truncated_block));
-      }
-
-      // Resize the vector for the final results
-      search_results.resize(target_texts.size());
-
-      // Search with the keywords over the target texts
-      for (std::size_t j = 0; j < search_keywords.size(); j++) {
-        // Search over the target texts with a single keyword (bucketed versions)
-        auto search_keyword = search_keywords[j];
-
-        // Determine the minimum length of the keyword
-        std::uint32_t min_keyword_length = getMinKeywordLength(search_keyword.bucket_size, bucket_scheme);
-
-        for (std::size_t i = 0; i < target_texts.size(); i++) {
-          // Search over a single text with a single keyword (bucketed versions)
-          auto target_text = target_texts[i];
-
-          // In the first pass, just compute the first layer of each character comparison, i.e., ~(a^b)
-          std::vector<std::vector<encrypto::motion::ShareWrapper>> all_xnors;
-          std::vector<encrypto::motion::ShareWrapper> all_length_mask_bits;
-
-          std::int32_t num_of_positions = target_text.size() - min_keyword_length + 1;
-
-          if (num_of_positions < 1) {
-            // Nothing to compare, most likely the target text is very short
-
-            // Chain the zero result (false) for each keyword and take NOT if needed
-            if (j == 0) {
-              // For the first keyword we have nothing to chain
-              search_results[i] = full_zero ^ modifier_chain_share_input[0];  // NOT if XORed with 1
-            } else {
-              search_results[i] = CreateChainingCircuit(search_results[i],
-                                                        full_zero,
-                                                        modifier_chain_share_input[2 * j - 1],
-                                                        modifier_chain_share_input[2 * j]);
-            }
-            continue;
-          }
-
-          for (int32_t text_position = 0; text_position < num_of_positions; text_position++) {
-            std::vector<std::vector<encrypto::motion::ShareWrapper>> comparison_result;
-            for (std::size_t c = 0; c < search_keyword.search_keyword.size(); c++) {
-
-              // Truncate the length of each character
-              const int character_bitlen = 6;  // Follows from the special PrivMail encoding
-
-              if ((c + text_position) >= target_text.size()) {
-                // Instead of breaking here, append with 1s
-                std::vector<encrypto::motion::ShareWrapper> full_zero_split(character_bitlen, ~full_zero);
-                comparison_result.push_back(full_zero_split);
-                all_length_mask_bits.push_back(~search_keyword.length_mask[c]);
-                continue;
-              }
-
-              auto splitted_keyword_character = search_keyword.search_keyword[c].Split();
-              auto truncated_keyword_character = encrypto::motion::ShareWrapper::Concatenate(
-                  splitted_keyword_character.begin(), splitted_keyword_character.begin() + character_bitlen);
-
-              auto splitted_text_character = target_text[c + text_position].Split();
-              auto truncated_text_character = encrypto::motion::ShareWrapper::Concatenate(
-                  splitted_text_character.begin(), splitted_text_character.begin() + character_bitlen);
-
-              // Compare the truncated character from keyword and target text
-              auto not_xor_a_b = ~(truncated_keyword_character^truncated_text_character);
-              comparison_result.push_back(not_xor_a_b.Split());     // Split each ~(a^b)
-
-              all_length_mask_bits.push_back(~search_keyword.length_mask[c]);
-            }
-            all_xnors.insert(all_xnors.end(), comparison_result.begin(), comparison_result.end());
-          }
-
-          // Combine the bits (basically a zip operation: [[a,b],[c,d]] to [[a,c],[b,d]])
-          std::vector<std::vector<encrypto::motion::ShareWrapper>> xor_combined(all_xnors[0].size());
-          for (auto& xor_position_splitted : all_xnors) {
-            for (std::size_t i = 0; i < xor_position_splitted.size(); i++) {
-              xor_combined[i].push_back(xor_position_splitted[i]);
-            }
-          }
-
-          // Concatenate each combined string
-          std::vector<encrypto::motion::ShareWrapper> xor_simd;
-          for (auto& xor_comb : xor_combined) {
-            xor_simd.push_back(encrypto::motion::ShareWrapper::Simdify(xor_comb));
-          }
+  }
 
-          // Do the AND operations now in parallel
-          encrypto::motion::ShareWrapper result_bits = LowDepthReduce(xor_simd, std::bit_and<>());
+  // The answers are as long as the longest block, so that their length does not depend on the selected mail
+  std::vector<std::vector<std::uint8_t>> blocks;
+  std::size_t answer_length = 0;
+  for (auto& mail : mails) {
+    blocks.push_back(simple_base64_decoder(mail.secret_share_block));
+    answer_length = std::max(answer_length, blocks.back().size());
+  }
 
-          // Apply the length mask bits in parallel
-          auto result_after_length_mask = ( encrypto::motion::ShareWrapper::Simdify(result_bits.Split()) |
-                                            encrypto::motion::ShareWrapper::Simdify(all_length_mask_bits) ).Unsimdify();
+  // One pass over the mails, each block is XORed into the answers of all keys that select it
+  std::vector<std::vector<std::uint8_t>> answers(retrieval_keys.size(), std::vector<std::uint8_t>(answer_length, 0));
+  for (std::size_t m = 0; m < blocks.size(); m++) {
+    for (std::size_t k = 0; k < selections.size(); k++) {
+      if (selections[k][m / 8] >> (7 - m % 8) & 1) xorInto(answers[k], blocks[m]);
+    }
+  }
+  return answers;
+}
 
-          // Do the character tree also in parallel
-          std::vector<std::vector<encrypto::motion::ShareWrapper>> results_combined(search_keyword.search_keyword.size());
+void ExportSearchCircuit(std::ostream& output,
+                         const std::vector<search_query>& search_queries,
+                         const std::vector<mail_structure>& mails,
+                         const std::vector<std::uint32_t> bucket_scheme,
+                         const search_mode_enum& search_mode,
+                         const search_options& options) {
+  if (search_mode != eNormal && search_mode != eHidden) {
+    throw std::invalid_argument("Only the circuits of the normal and hidden search modes can be exported");
+  }
+  if (search_queries.empty()) throw std::invalid_argument("The exported circuit needs at least one keyword");
+
+  // The circuit has inputs without shares, each input value is a vector of input nodes
+  SearchCircuit circuit;
+  std::vector<std::vector<SearchCircuit::Node>> inputs;
+  auto add_input = [&](std::size_t bitlength) {
+    std::vector<SearchCircuit::Node> input;
+    for (std::size_t bit = 0; bit < bitlength; bit++) input.push_back(circuit.Input());
+    inputs.push_back(input);
+    return input;
+  };
+  auto add_text_input = [&](std::size_t length) {
+    auto input = add_input(length * kCharacterBitlen);
+    circuit_text text;
+    for (std::size_t c = 0; c < length; c++) {
+      text.emplace_back(input.begin() + c * kCharacterBitlen, input.begin() + (c + 1) * kCharacterBitlen);
+    }
+    return text;
+  };
 
-          // Combine the bits (basically a zip operation: [a,b,c,d] to [[a,c],[b,d]])
-          for (std::uint32_t res_index = 0; res_index < result_after_length_mask.size(); res_index++) {
-            int res_comb_index = res_index % search_keyword.search_keyword.size();
-            results_combined[res_comb_index].push_back(result_after_length_mask[res_index]);
-          }
+  std::vector<circuit_text> keywords;
+  std::vector<std::vector<SearchCircuit::Node>> ignore_bits;
+  std::vector<std::size_t> min_keyword_lengths;
+  for (auto& search_query : search_queries) {
+    if (search_mode == eNormal) {
+      keywords.push_back(add_text_input(GetCharacterLengthFromBase64(search_query.keyword_truncated)));
+      ignore_bits.emplace_back();
+      min_keyword_lengths.push_back(keywords.back().size());
+    } else {
+      keywords.push_back(add_text_input(search_query.bucket_size));
+      ignore_bits.push_back(add_input(search_query.bucket_size));
+      min_keyword_lengths.push_back(getMinKeywordLength(search_query.bucket_size, bucket_scheme));
+    }
+  }
+  auto modifier_chain = add_input(2 * search_queries.size() - 1);
 
-          // Concatenate each combined string
-          std::vector<encrypto::motion::ShareWrapper> res_concat;
-          for (auto& res_comb : results_combined) {
-            res_concat.push_back(encrypto::motion::ShareWrapper::Simdify(res_comb));
-          }
+  // Each mail is a single target text
+  std::vector<std::vector<circuit_text>> targets;
+  for (auto& mail : mails) {
+    targets.push_back({add_text_input(GetCharacterLengthFromBase64(mail.secret_share_truncated_block))});
+  }
 
-          // Do the AND operations now in parallel
-          encrypto::motion::ShareWrapper comparison_res_bits = LowDepthReduce(res_concat, std::bit_and<>());
-          auto comparison_results_split = comparison_res_bits.Unsimdify();
-
-          auto search_result_per_email = LowDepthReduceSIMD(comparison_results_split, std::bit_or<>());
-
-          // Chain the results for each keyword and take NOT if needed
-          if (j == 0) {
-            // For the first keyword we have nothing to chain
-            search_results[i] = search_result_per_email ^ modifier_chain_share_input[0];  // NOT if XORed with 1
-          } else {
-            search_results[i] = CreateChainingCircuit(search_results[i],
-                                                      search_result_per_email,
-                                                      modifier_chain_share_input[2 * j - 1],
-                                                      modifier_chain_share_input[2 * j]);
-          }
-        }
+  // Chain the results like CreateChainingCircuit
+  std::vector<SearchCircuit::Node> search_results;
+  for (std::size_t j = 0; j < keywords.size(); j++) {
+    auto keyword_results =
+        BuildKeywordComparisons(circuit, keywords[j], ignore_bits[j], {}, targets, min_keyword_lengths[j], options);
+    if (j == 0) {
+      for (auto keyword_result : keyword_results) {
+        search_results.push_back(circuit.Xor(keyword_result, modifier_chain[0]));
       }
-      break;
+      continue;
     }
-    case eBucket: {
-      // Decode and initialize the search keywords (bucketed versions)
-      std::vector<query_input> search_keywords = getBucketedKeywordInput(party, search_queries);
-      assert(modifier_chain_share_input.size() >= 2 * search_keywords.size() - 1);
-
-      // Decode and initialize the buckets for each mail
-      std::vector<std::vector<bucket_input>> target_texts;
-      for (auto& mail : mails) {
-        std::vector<bucket_input> buckets;
-        for (auto& bucket : mail.buckets) {
-          bucket_input target_bucket;
-          target_bucket.bucket_size = bucket.bucket_size;
-          for (auto& word : bucket.words) {
-            debugMessage(party, fmt::format("Target word: {} (bucket size: {})", word, bucket.bucket_size));
-            target_bucket.words.push_back(base64StringToInput(party, word));
-          }
-          buckets.push_back(target_bucket);
-        }
-        target_texts.push_back(buckets);
-      }
-
-      // Resize the vector for the final results
-      search_results.resize(target_texts.size());
-
-      // Search with the keywords over the target texts (bucketed versions)
-      for (std::size_t j = 0; j < search_keywords.size(); j++) {
-        // Search over the target texts with a single keyword (bucketed versions)
-        auto search_keyword = search_keywords[j];
-
-        // Determine the minimum length of the keyword
-        std::uint32_t min_keyword_length = getMinKeywordLength(search_keyword.bucket_size, bucket_scheme);
-
-        for (std::size_t i = 0; i < target_texts.size(); i++) {
-          // Search over a single text with a single keyword (bucketed versions)
-          auto target_text = target_texts[i];
-
-          // In the first pass, just compute the first layer of each character comparison, i.e., ~(a^b)
-          std::vector<std::vector<encrypto::motion::ShareWrapper>> all_xnors;
-          std::vector<encrypto::motion::ShareWrapper> all_length_mask_bits;
-
-          for (auto& target_bucket : target_text) {
-            if (target_bucket.bucket_size < search_keyword.bucket_size) continue;
-
-            for (auto& word : target_bucket.words) {
-
-              std::int32_t num_of_positions = word.size() - min_keyword_length + 1;
-
-              for (int32_t text_position = 0; text_position < num_of_positions; text_position++) {
-                std::vector<std::vector<encrypto::motion::ShareWrapper>> comparison_result;
-                for (std::size_t c = 0; c < search_keyword.search_keyword.size(); c++) {
-
-                  // Truncate the length of each character
-                  const int character_bitlen = 6;  // Follows from the special PrivMail encoding
-
-                  if ((c + text_position) >= word.size()) {
-                    // Instead of breaking here, append with 1s
-                    std::vector<encrypto::motion::ShareWrapper> full_zero_split(character_bitlen, ~full_zero);
-                    comparison_result.push_back(full_zero_split);
-                    all_length_mask_bits.push_back(~search_keyword.length_mask[c]);
-                    continue;
-                  }
-
-                  auto splitted_keyword_character = search_keyword.search_keyword[c].Split();
-                  auto truncated_keyword_character = encrypto::motion::ShareWrapper::Concatenate(
-                      splitted_keyword_character.begin(), splitted_keyword_character.begin() + character_bitlen);
-
-                  auto splitted_text_character = word[c + text_position].Split();
-                  auto truncated_text_character = encrypto::motion::ShareWrapper::Concatenate(
-                      splitted_text_character.begin(), splitted_text_character.begin() + character_bitlen);
-
-                  // Compare the truncated character from keyword and target text
-                  auto not_xor_a_b = ~(truncated_keyword_character^truncated_text_character);
-                  comparison_result.push_back(not_xor_a_b.Split());     // Split each ~(a^b)
-
-                  all_length_mask_bits.push_back(~search_keyword.length_mask[c]);
-                }
-                all_xnors.insert(all_xnors.end(), comparison_result.begin(), comparison_result.end());
-              }
-            }
-          }
-
-          if (all_xnors.size() == 0) {
-            // No available buckets at all (most likely because the keyword was very long)
-
-            // Chain the zero result (false) for each keyword and take NOT if needed
-            if (j == 0) {
-              // For the first keyword we have nothing to chain
-              search_results[i] = full_zero ^ modifier_chain_share_input[0];  // NOT if XORed with 1
-            } else {
-              search_results[i] = CreateChainingCircuit(search_results[i],
-                                                        full_zero,
-                                                        modifier_chain_share_input[2 * j - 1],
-                                                        modifier_chain_share_input[2 * j]);
-            }
-            continue;
-          }
-
-          // Combine the bits (basically a zip operation: [[a,b],[c,d]] to [[a,c],[b,d]])
-          std::vector<std::vector<encrypto::motion::ShareWrapper>> xor_combined(all_xnors[0].size());
-          for (auto& xor_position_splitted : all_xnors) {
-            for (std::size_t i = 0; i < xor_position_splitted.size(); i++) {
-              xor_combined[i].push_back(xor_position_splitted[i]);
-            }
-          }
-
-          // Concatenate each combined string
-          std::vector<encrypto::motion::ShareWrapper> xor_simd;
-          for (auto& xor_comb : xor_combined) {
-            xor_simd.push_back(encrypto::motion::ShareWrapper::Simdify(xor_comb));
-          }
-
-          // Do the AND operations now in parallel
-          encrypto::motion::ShareWrapper result_bits = LowDepthReduce(xor_simd, std::bit_and<>());
-
-          // Apply the length mask bits in parallel
-          auto result_after_length_mask = ( encrypto::motion::ShareWrapper::Simdify(result_bits.Split()) |
-                                            encrypto::motion::ShareWrapper::Simdify(all_length_mask_bits) ).Unsimdify();
-
-          // Do the character tree also in parallel
-          std::vector<std::vector<encrypto::motion::ShareWrapper>> results_combined(search_keyword.search_keyword.size());
-
-          // Combine the bits (basically a zip operation: [a,b,c,d] to [[a,c],[b,d]])
-          for (std::uint32_t res_index = 0; res_index < result_after_length_mask.size(); res_index++) {
-            int res_comb_index = res_index % search_keyword.search_keyword.size();
-            results_combined[res_comb_index].push_back(result_after_length_mask[res_index]);
-          }
-
-          // Concatenate each combined string
-          std::vector<encrypto::motion::ShareWrapper> res_concat;
-          for (auto& res_comb : results_combined) {
-            res_concat.push_back(encrypto::motion::ShareWrapper::Simdify(res_comb));
-          }
+    const auto OR_BIT = modifier_chain[2 * j - 1];
+    const auto NOT_BIT = modifier_chain[2 * j];
+    for (std::size_t i = 0; i < search_results.size(); i++) {
+      search_results[i] = circuit.Xor(
+          circuit.And(circuit.Xor(search_results[i], OR_BIT),
+                      circuit.Xor(circuit.Xor(keyword_results[i], NOT_BIT), OR_BIT)),
+          OR_BIT);
+    }
+  }
 
-          // Do the AND operations now in parallel
-          encrypto::motion::ShareWrapper comparison_res_bits = LowDepthReduce(res_concat, std::bit_and<>());
-          auto comparison_results_split = comparison_res_bits.Unsimdify();
+  circuit.WriteBristolFashion(output, inputs, search_results);
+}
 
-          int counter = 0;
-          // In the second pass, do the rest of the AND/OR trees to get the result
-          std::vector<encrypto::motion::ShareWrapper> search_results_per_bucket;
-          for (auto& target_bucket : target_text) {
-            if (target_bucket.bucket_size < search_keyword.bucket_size) continue;
+std::vector<encrypto::motion::ShareWrapper> BuildPrivMailSearch(encrypto::motion::PartyPointer& party,
+                                                                const std::vector<search_query>& search_queries,
+                                                                const std::string& modifier_chain_share,
+                                                                const std::vector<mail_structure>& mails,
+                                                                const search_index& search_index,
+                                                                const std::vector<std::uint32_t> bucket_scheme,
+                                                                const search_mode_enum& search_mode,
+                                                                const search_options& options) {
+  return buildPrivMailSearch(party, search_queries, modifier_chain_share, mails, {}, search_index, bucket_scheme,
+                             search_mode, options);
+}
 
-            std::vector<encrypto::motion::ShareWrapper> search_results_per_word;
-            for (auto& word : target_bucket.words) {
-              std::int32_t num_of_positions = word.size() - min_keyword_length + 1;
+std::vector<encrypto::motion::ShareWrapper> BuildPrivMailSearch(encrypto::motion::PartyPointer& party,
+                                                                const std::vector<search_query>& search_queries,
+                                                                const std::string& modifier_chain_share,
+                                                                MailStream& mail_stream,
+                                                                std::vector<mail_structure>& mails,
+                                                                const search_index& search_index,
+                                                                const std::vector<std::uint32_t> bucket_scheme,
+                                                                const search_mode_enum& search_mode,
+                                                                const search_options& options) {
+  // If any keyword searches the text of each mail, the inputs of the texts are created while the next mails are
+  // loaded. The other search modes start once all mails are loaded
+  bool input_texts = false;
+  for (auto& search_query : search_queries) {
+    input_texts |= searchesMailTexts(search_query.search_mode.value_or(search_mode), options);
+  }
 
-              std::vector<encrypto::motion::ShareWrapper> search_results_per_position;
-              for (int32_t text_position = 0; text_position < num_of_positions; text_position++) {
-                search_results_per_position.push_back(comparison_results_split[counter]);
-                counter++;
-              }
+  std::vector<truncated_text> mail_texts;
+  mails.clear();
+  while (auto mail = mail_stream.Next()) {
+    if (input_texts) mail_texts.push_back(getMailText(party, *mail));
+    mails.push_back(std::move(*mail));
+  }
+  return buildPrivMailSearch(party, search_queries, modifier_chain_share, mails, mail_texts, search_index,
+                             bucket_scheme, search_mode, options);
+}
 
-              // Finally, use OR tree to get the final answer of whether any of the comparisons was a match
-              auto search_result_of_word = LowDepthReduceSIMD(search_results_per_position, std::bit_or<>());
+static std::vector<encrypto::motion::ShareWrapper> buildPrivMailSearch(encrypto::motion::PartyPointer& party,
+                                                                       const std::vector<search_query>& search_queries,
+                                                                       const std::string& modifier_chain_share,
+                                                                       const std::vector<mail_structure>& mails,
+                                                                       const std::vector<truncated_text>& mail_texts,
+                                                                       const search_index& search_index,
+                                                                       const std::vector<std::uint32_t> bucket_scheme,
+                                                                       const search_mode_enum& search_mode,
+                                                                       const search_options& options) {
+  // Create a ShareWrapper initialized with 0 (false)
+  const encrypto::motion::ShareWrapper full_zero =
+      party->In<encrypto::motion::MpcProtocol::kBooleanGmw>(encrypto::motion::BitVector<>(1, false), 0);
 
-              assert(search_result_of_word->GetBitLength() == 1);
-              search_results_per_word.push_back(search_result_of_word);
-            }
-            search_results_per_bucket.push_back(
-                LowDepthReduceSIMD(search_results_per_word, std::bit_or<>()));
-          }
+  // Decode and initialize the modifier_chain_share
+  debugMessage(party, fmt::format("Modifier chain share: {}", modifier_chain_share));
+  auto modifier_chain_input = base64StringToInput(party, modifier_chain_share);
+  auto modifier_chain_share_input = splitTo1bitShareWrappers(modifier_chain_input);
 
-          auto search_result_per_email = LowDepthReduceSIMD(search_results_per_bucket, std::bit_or<>());
-
-          // Chain the results for each keyword and take NOT if needed
-          if (j == 0) {
-            // For the first keyword we have nothing to chain
-            search_results[i] = search_result_per_email ^ modifier_chain_share_input[0];  // NOT if XORed with 1
-          } else {
-            search_results[i] = CreateChainingCircuit(search_results[i],
-                                                      search_result_per_email,
-                                                      modifier_chain_share_input[2 * j - 1],
-                                                      modifier_chain_share_input[2 * j]);
-          }
-        }
-      }
+  // Each keyword is evaluated with its own search mode if it has one, otherwise with the search mode of the query
+  std::vector<search_mode_enum> keyword_modes;
+  for (auto& search_query : search_queries) keyword_modes.push_back(search_query.search_mode.value_or(search_mode));
+  assert(modifier_chain_share_input.size() + 1 >= 2 * keyword_modes.size());
 
-      break;
+  std::vector<std::vector<encrypto::motion::ShareWrapper>> results_per_keyword(search_queries.size());
+  if (std::all_of(keyword_modes.begin(), keyword_modes.end(), [&](auto mode) { return mode == search_mode; })) {
+    results_per_keyword = SearchKeywordsWithMode(party, search_queries, mails, mail_texts, search_index, bucket_scheme,
+                                                 search_mode, full_zero, options);
+  } else {
+    // Mixed search modes: evaluate the keywords of each mode together, the results are then per mail for all modes
+    std::vector<search_mode_enum> modes(keyword_modes);
+    std::sort(modes.begin(), modes.end());
+    modes.erase(std::unique(modes.begin(), modes.end()), modes.end());
+
+    // The text of each mail is input once for all search modes that search it
+    std::vector<truncated_text> mode_mail_texts(mail_texts);
+    if (mode_mail_texts.empty() &&
+        std::any_of(modes.begin(), modes.end(), [&](auto mode) { return searchesMailTexts(mode, options); })) {
+      for (auto& mail : mails) mode_mail_texts.push_back(getMailText(party, mail));
     }
-    case eIndex: {
-      // Decode and initialize the search keywords (bucketed versions)
-      std::vector<query_input> search_keywords = getBucketedKeywordInput(party, search_queries);
-      assert(modifier_chain_share_input.size() >= 2 * search_keywords.size() - 1);
-
 
-      // Decode and initialize the buckets for the search index
-      std::uint32_t total_number_words = 0;
-      std::vector<bucket_input> buckets;
-      for (auto& bucket : search_index.index_buckets) {
-        bucket_input target_bucket;
-        target_bucket.bucket_size = bucket.bucket_size;
-        for (auto& word_and_occurrence_string : bucket.word_and_occurrence_strings) {
-          auto& word = word_and_occurrence_string.first;
-          debugMessage(party, fmt::format("Target word: {} (bucket size: {})", word, bucket.bucket_size));
-          target_bucket.words.push_back(base64StringToInput(party, word));
-        }
-        buckets.push_back(target_bucket);
-        total_number_words += bucket.word_and_occurrence_strings.size();
+    for (auto mode : modes) {
+      std::vector<search_query> mode_queries;
+      std::vector<std::size_t> mode_keyword_indices;
+      for (std::size_t j = 0; j < search_queries.size(); j++) {
+        if (keyword_modes[j] != mode) continue;
+        mode_queries.push_back(search_queries[j]);
+        mode_keyword_indices.push_back(j);
       }
 
-      // Resize the vector for the final results
-      search_results.resize(total_number_words);
-
-      // Search with the keywords over the target texts (bucketed versions)
-      for (std::size_t j = 0; j < search_keywords.size(); j++) {
-        // Search over the target texts with a single keyword (bucketed versions)
-        auto search_keyword = search_keywords[j];
-
-        // Determine the minimum length of the keyword
-        std::uint32_t min_keyword_length = getMinKeywordLength(search_keyword.bucket_size, bucket_scheme);
-
-        // Search over a single bucket with a single keyword (bucketed versions)
-        std::vector<encrypto::motion::ShareWrapper> search_results_per_keyword;
-
-        // In the first pass, just compute the first layer of each character comparison, i.e., ~(a^b)
-        std::vector<std::vector<encrypto::motion::ShareWrapper>> all_xnors;
-        std::vector<encrypto::motion::ShareWrapper> all_length_mask_bits;
-
-        for (auto& target_bucket : buckets) {
-          for (auto& word : target_bucket.words) {
-            // Search over each bucket, skip if the target bucket is too small (i.e., impossible to match the keyword)
-            if (target_bucket.bucket_size < search_keyword.bucket_size) {
-              search_results_per_keyword.push_back(full_zero);
-              continue;
-            }
-
-            std::int32_t num_of_positions = word.size() - min_keyword_length + 1;
-
-            for (int32_t text_position = 0; text_position < num_of_positions; text_position++) {
-              std::vector<std::vector<encrypto::motion::ShareWrapper>> comparison_result;
-              for (std::size_t c = 0; c < search_keyword.search_keyword.size(); c++) {
-
-                // Truncate the length of each character
-                const int character_bitlen = 6;  // Follows from the special PrivMail encoding
-
-                if ((c + text_position) >= word.size()) {
-                  // Instead of breaking here, append with 1s
-                  std::vector<encrypto::motion::ShareWrapper> full_zero_split(character_bitlen, ~full_zero);
-                  comparison_result.push_back(full_zero_split);
-                  all_length_mask_bits.push_back(~search_keyword.length_mask[c]);
-                  continue;
-                }
-
-                auto splitted_keyword_character = search_keyword.search_keyword[c].Split();
-                auto truncated_keyword_character = encrypto::motion::ShareWrapper::Concatenate(
-                    splitted_keyword_character.begin(), splitted_keyword_character.begin() + character_bitlen);
-
-                auto splitted_text_character = word[c + text_position].Split();
-                auto truncated_text_character = encrypto::motion::ShareWrapper::Concatenate(
-                    splitted_text_character.begin(), splitted_text_character.begin() + character_bitlen);
-
-                // Compare the truncated character from keyword and target text
-                auto not_xor_a_b = ~(truncated_keyword_character^truncated_text_character);
-                comparison_result.push_back(not_xor_a_b.Split());     // Split each ~(a^b)
-
-                all_length_mask_bits.push_back(~search_keyword.length_mask[c]);
-              }
-              all_xnors.insert(all_xnors.end(), comparison_result.begin(), comparison_result.end());
-            }
-          }
-        }
-
-        // Combine the bits (basically a zip operation: [[a,b],[c,d]] to [[a,c],[b,d]])
-        std::vector<std::vector<encrypto::motion::ShareWrapper>> xor_combined(all_xnors[0].size());
-        for (auto& xor_position_splitted : all_xnors) {
-          for (std::size_t i = 0; i < xor_position_splitted.size(); i++) {
-            xor_combined[i].push_back(xor_position_splitted[i]);
-          }
-        }
-
-        // Concatenate each combined string
-        std::vector<encrypto::motion::ShareWrapper> xor_simd;
-        for (auto& xor_comb : xor_combined) {
-          xor_simd.push_back(encrypto::motion::ShareWrapper::Simdify(xor_comb));
-        }
-
-        // Do the AND operations now in parallel
-        encrypto::motion::ShareWrapper result_bits = LowDepthReduce(xor_simd, std::bit_and<>());
-
-        // Apply the length mask bits in parallel
-        auto result_after_length_mask = ( encrypto::motion::ShareWrapper::Simdify(result_bits.Split()) |
-                                          encrypto::motion::ShareWrapper::Simdify(all_length_mask_bits) ).Unsimdify();
-
-        // Do the character tree also in parallel
-        std::vector<std::vector<encrypto::motion::ShareWrapper>> results_combined(search_keyword.search_keyword.size());
-
-        // Combine the bits (basically a zip operation: [a,b,c,d] to [[a,c],[b,d]])
-        for (std::uint32_t res_index = 0; res_index < result_after_length_mask.size(); res_index++) {
-          int res_comb_index = res_index % search_keyword.search_keyword.size();
-          results_combined[res_comb_index].push_back(result_after_length_mask[res_index]);
-        }
-
-        // Concatenate each combined string
-        std::vector<encrypto::motion::ShareWrapper> res_concat;
-        for (auto& res_comb : results_combined) {
-          res_concat.push_back(encrypto::motion::ShareWrapper::Simdify(res_comb));
-        }
-
-        // Do the AND operations now in parallel
-        encrypto::motion::ShareWrapper comparison_res_bits = LowDepthReduce(res_concat, std::bit_and<>());
-        auto comparison_results_split = comparison_res_bits.Unsimdify();
-
-        int counter = 0;
-        // In the second pass, do the rest of the AND/OR trees to get the result
-        std::vector<encrypto::motion::ShareWrapper> search_results_per_bucket;
-        for (auto& target_bucket : buckets) {
-          if (target_bucket.bucket_size < search_keyword.bucket_size) continue;
-
-          std::vector<encrypto::motion::ShareWrapper> search_results_per_word;
-          for (auto& word : target_bucket.words) {
-            std::int32_t num_of_positions = word.size() - min_keyword_length + 1;
-
-            std::vector<encrypto::motion::ShareWrapper> search_results_per_position;
-            for (int32_t text_position = 0; text_position < num_of_positions; text_position++) {
-              search_results_per_position.push_back(comparison_results_split[counter]);
-              counter++;
-            }
-
-            // Finally, use OR tree to get the final answer of whether any of the comparisons was a match
-            auto search_result_of_word = LowDepthReduceSIMD(search_results_per_position, std::bit_or<>());
-
-            assert(search_result_of_word->GetBitLength() == 1);
-            search_results_per_word.push_back(search_result_of_word);
-          }
-          search_results_per_keyword.insert(search_results_per_keyword.end(),
-                                            search_results_per_word.begin(),
-                                            search_results_per_word.end());
-        }
-        assert(search_results_per_keyword.size() == search_results.size());
-
-        for (std::size_t i = 0; i < search_results.size(); i++) {
-          // Chain the results for each keyword and take NOT if needed
-          if (j == 0) {
-            // For the first keyword we have nothing to chain
-            search_results[i] = search_results_per_keyword[i] ^ modifier_chain_share_input[0];  // NOT if XORed with 1
-          } else {
-            search_results[i] = CreateChainingCircuit(search_results[i],
-                                                      search_results_per_keyword[i],
-                                                      modifier_chain_share_input[2 * j - 1],
-                                                      modifier_chain_share_input[2 * j]);
-          }
-        }
+      auto mode_results = SearchKeywordsWithMode(party, mode_queries, mails, mode_mail_texts, search_index,
+                                                 bucket_scheme, mode, full_zero, options);
+      if (mode == eIndex && search_index.posting_classes.empty()) {
+        mode_results = IndexResultsPerMail(party, mode_results, search_index, full_zero, options);
       }
 
-      break;
+      for (std::size_t k = 0; k < mode_keyword_indices.size(); k++) {
+        results_per_keyword[mode_keyword_indices[k]] = std::move(mode_results[k]);
+      }
     }
-    default: {
-      throw std::invalid_argument("Invalid Search Mode");
+    for (auto& keyword_results : results_per_keyword) {
+      if (keyword_results.size() != results_per_keyword.front().size()) {
+        throw std::invalid_argument("Keywords with different search modes require the mails of the search index");
+      }
     }
   }
 
+  // Chain the results of the keywords with the modifiers
+  std::vector<encrypto::motion::ShareWrapper> search_results;
+  if (!results_per_keyword.empty()) search_results.resize(results_per_keyword.front().size());
+  for (std::size_t j = 0; j < results_per_keyword.size(); j++) {
+    ChainKeywordResults(search_results, results_per_keyword[j], j, modifier_chain_share_input, options);
+  }
+
   /** The search is DONE! Each ShareWrapper in search_results is a single bit
       denoting if the search criteria was fulfilled for that email. **/
 
   // Set the output gates (NOTE: in practice the parties wouldn't get the outputs in clear!)
   //for (auto& search_result : search_results) search_result = search_result.Out();
 
-  party->Run();
-  party->Finish();
-
   return search_results;
 }
 
@@ -727,23 +525,45 @@ static std::vector<std::uint8_t> simple_base64_decoder(const std::string& data)
   return decoded;
 }
 
+static void xorInto(std::vector<std::uint8_t>& destination, const std::vector<std::uint8_t>& source) {
+  // XOR word by word, which the compiler can vectorize
+  const std::size_t length = std::min(destination.size(), source.size());
+  std::size_t i = 0;
+  for (; i + sizeof(std::uint64_t) <= length; i += sizeof(std::uint64_t)) {
+    std::uint64_t destination_word, source_word;
+    std::memcpy(&destination_word, destination.data() + i, sizeof(std::uint64_t));
+    std::memcpy(&source_word, source.data() + i, sizeof(std::uint64_t));
+    destination_word ^= source_word;
+    std::memcpy(destination.data() + i, &destination_word, sizeof(std::uint64_t));
+  }
+  for (; i < length; i++) destination[i] ^= source[i];
+}
+
 static std::vector<encrypto::motion::ShareWrapper> base64StringToInput(
     const encrypto::motion::PartyPointer& party, const std::string& input_string) {
+  return bytesToInput(party, simple_base64_decoder(input_string));
+}
 
+static std::vector<encrypto::motion::ShareWrapper> bytesToInput(const encrypto::motion::PartyPointer& party,
+                                                                const std::vector<std::uint8_t>& share_bytes) {
   auto N = party->GetConfiguration()->GetNumOfParties();
 
-  std::vector<std::vector<encrypto::motion::ShareWrapper>> input_shares;
-  for (std::size_t i = 0; i < N; i++) {
+  if (share_bytes.empty()) return {};
 
-    std::vector<encrypto::motion::ShareWrapper> input_vector;
-    for (auto& one_byte : simple_base64_decoder(input_string)) {
-      input_vector.push_back(party->In<encrypto::motion::MpcProtocol::kBooleanGmw>(
-          encrypto::motion::ToInput(one_byte), i));
+  // Input all bytes of a share at once (one SIMD value per byte) instead of a separate input gate per byte
+  std::vector<encrypto::motion::BitVector<>> input_bits(8);
+  for (auto& one_byte : share_bytes) {
+    for (std::size_t bit = 0; bit < input_bits.size(); bit++) {
+      input_bits[bit].Append(((one_byte >> bit) & 1) == 1);
     }
+  }
 
-    input_shares.push_back(input_vector);
+  std::vector<std::vector<encrypto::motion::ShareWrapper>> input_shares;
+  for (std::size_t i = 0; i < N; i++) {
+    encrypto::motion::ShareWrapper share_input = party->In<encrypto::motion::MpcProtocol::kBooleanGmw>(input_bits, i);
+    input_shares.push_back({share_input});
   }
-  return FromSharesToValue(input_shares);
+  return FromSharesToValue(input_shares).front().Unsimdify();
 }
 
 static std::vector<encrypto::motion::ShareWrapper> FromSharesToValue(
@@ -806,6 +626,16 @@ static std::vector<encrypto::motion::SecureUnsignedInteger> concatenateTo8bitSec
   return output;
 }
 
+static truncated_text truncateCharacters(const std::vector<encrypto::motion::ShareWrapper>& characters) {
+  // Split each 8-bit character and keep only the bits used by the special PrivMail encoding
+  truncated_text output;
+  for (auto& character : characters) {
+    auto splitted_character = character.Split();
+    output.emplace_back(splitted_character.begin(), splitted_character.begin() + kCharacterBitlen);
+  }
+  return output;
+}
+
 static std::vector<query_input> getBucketedKeywordInput(
     encrypto::motion::PartyPointer& party, const std::vector<search_query>& search_queries) {
   std::vector<query_input> search_keywords;
@@ -820,6 +650,16 @@ static std::vector<query_input> getBucketedKeywordInput(
     debugMessage(party, fmt::format("Length mask: {}", search_query.keyword_length_mask));
     auto length_mask_input = base64StringToInput(party, search_query.keyword_length_mask);
     bucket_search_keyword.length_mask = splitTo1bitShareWrappers(length_mask_input);
+    if (!search_query.keyword_wildcard_mask.empty()) {
+      debugMessage(party, fmt::format("Wildcard mask: {}", search_query.keyword_wildcard_mask));
+      bucket_search_keyword.wildcard_mask =
+          splitTo1bitShareWrappers(base64StringToInput(party, search_query.keyword_wildcard_mask));
+    }
+    if (!search_query.keyword_digit_mask.empty()) {
+      debugMessage(party, fmt::format("Digit mask: {}", search_query.keyword_digit_mask));
+      bucket_search_keyword.digit_mask =
+          splitTo1bitShareWrappers(base64StringToInput(party, search_query.keyword_digit_mask));
+    }
 
     assert(bucket_search_keyword.bucket_size == bucket_search_keyword.search_keyword.size());
     search_keywords.push_back(bucket_search_keyword);
@@ -827,6 +667,25 @@ static std::vector<query_input> getBucketedKeywordInput(
   return search_keywords;
 }
 
+static std::vector<encrypto::motion::ShareWrapper> getIgnoreBits(const query_input& search_keyword) {
+  // A keyword character is ignored in the comparison if it is beyond the actual length of the keyword or a wildcard
+  std::vector<encrypto::motion::ShareWrapper> ignore_bits;
+  for (std::size_t c = 0; c < search_keyword.search_keyword.size(); c++) {
+    if (search_keyword.wildcard_mask.empty()) {
+      ignore_bits.push_back(~search_keyword.length_mask[c]);
+    } else {
+      ignore_bits.push_back(~(search_keyword.length_mask[c] & ~search_keyword.wildcard_mask[c]));
+    }
+  }
+  return ignore_bits;
+}
+
+static std::vector<encrypto::motion::ShareWrapper> getDigitClassBits(const query_input& search_keyword) {
+  // A keyword character of the digit class matches any digit, empty if the keyword has no digit classes
+  if (search_keyword.digit_mask.empty()) return {};
+  return {search_keyword.digit_mask.begin(), search_keyword.digit_mask.begin() + search_keyword.search_keyword.size()};
+}
+
 static std::uint32_t getMinKeywordLength(const std::uint32_t bucket_size,
                                          const std::vector<std::uint32_t> bucket_scheme) {
   auto it = std::find(bucket_scheme.begin(), bucket_scheme.end(), bucket_size);
@@ -841,6 +700,1369 @@ static std::uint32_t getMinKeywordLength(const std::uint32_t bucket_size,
   }
 }
 
+static std::size_t appendTextComparisons(comparison_batch& batch,
+                                         const truncated_text& keyword,
+                                         const std::vector<encrypto::motion::ShareWrapper>& ignore_bits,
+                                         const std::vector<encrypto::motion::ShareWrapper>& digit_class_bits,
+                                         const truncated_text& text,
+                                         const std::size_t min_keyword_length) {
+  // Compare the keyword to the text at each position, returns the number of compared positions
+  std::int64_t num_of_positions = static_cast<std::int64_t>(text.size()) - min_keyword_length + 1;
+  if (num_of_positions < 1) {
+    // Nothing to compare, most likely the target text is very short
+    return 0;
+  }
+
+  for (std::int64_t text_position = 0; text_position < num_of_positions; text_position++) {
+    for (std::size_t c = 0; c < keyword.size(); c++) {
+      batch.keyword_characters.push_back(keyword[c]);
+      if ((c + text_position) >= text.size()) {
+        // Instead of breaking here, compare the keyword character to itself (i.e., the XNOR gives 1s)
+        batch.text_characters.push_back(keyword[c]);
+      } else {
+        batch.text_characters.push_back(text[c + text_position]);
+      }
+      if (!ignore_bits.empty()) batch.ignore_bits.push_back(ignore_bits[c]);
+      if (!digit_class_bits.empty()) batch.digit_class_bits.push_back(digit_class_bits[c]);
+    }
+  }
+  return num_of_positions;
+}
+
+static encrypto::motion::ShareWrapper isDigitCharacter(const std::vector<encrypto::motion::ShareWrapper>& character) {
+  // The digits are encoded as 48 to 57, i.e., 11xxxx with the lower four bits at most 1001 (the bits of the
+  // character are the least significant bit first)
+  return (character[5] & character[4]) & ~(character[3] & (character[2] | character[1]));
+}
+
+static std::vector<encrypto::motion::ShareWrapper> CompareCharacterBatch(const comparison_batch& batch,
+                                                                         const std::size_t keyword_length) {
+  // In the first pass, just compute the first layer of each character comparison, i.e., ~(a^b). Instead of
+  // a small gate per character, each bit plane of all slots is compared with a single wide gate, such that
+  // the local XOR/NOT work runs over long bit vectors
+  std::vector<encrypto::motion::ShareWrapper> xnor_simd, text_bits_simd;
+  for (std::size_t bit = 0; bit < kCharacterBitlen; bit++) {
+    std::vector<encrypto::motion::ShareWrapper> keyword_bit_plane, text_bit_plane;
+    keyword_bit_plane.reserve(batch.keyword_characters.size());
+    text_bit_plane.reserve(batch.text_characters.size());
+    for (std::size_t slot = 0; slot < batch.keyword_characters.size(); slot++) {
+      keyword_bit_plane.push_back(batch.keyword_characters[slot][bit]);
+      text_bit_plane.push_back(batch.text_characters[slot][bit]);
+    }
+    text_bits_simd.push_back(encrypto::motion::ShareWrapper::Simdify(text_bit_plane));
+    xnor_simd.push_back(~(encrypto::motion::ShareWrapper::Simdify(keyword_bit_plane) ^ text_bits_simd.back()));
+  }
+
+  // Do the AND operations now in parallel
+  encrypto::motion::ShareWrapper result_bits = LowDepthReduce(xnor_simd, std::bit_and<>());
+
+  // A keyword character of the digit class matches any digit of the text
+  if (!batch.digit_class_bits.empty()) {
+    result_bits = result_bits |
+                  (encrypto::motion::ShareWrapper::Simdify(batch.digit_class_bits) & isDigitCharacter(text_bits_simd));
+  }
+
+  // Apply the length mask bits in parallel
+  std::vector<encrypto::motion::ShareWrapper> result_after_length_mask;
+  if (batch.ignore_bits.empty()) {
+    result_after_length_mask = result_bits.Unsimdify();
+  } else {
+    result_after_length_mask = (result_bits | encrypto::motion::ShareWrapper::Simdify(batch.ignore_bits)).Unsimdify();
+  }
+
+  // Do the character tree also in parallel
+  std::vector<std::vector<encrypto::motion::ShareWrapper>> results_combined(keyword_length);
+
+  // Combine the bits (basically a zip operation: [a,b,c,d] to [[a,c],[b,d]])
+  for (std::size_t res_index = 0; res_index < result_after_length_mask.size(); res_index++) {
+    results_combined[res_index % keyword_length].push_back(result_after_length_mask[res_index]);
+  }
+
+  // Concatenate each combined string
+  std::vector<encrypto::motion::ShareWrapper> res_concat;
+  for (auto& res_comb : results_combined) {
+    res_concat.push_back(encrypto::motion::ShareWrapper::Simdify(res_comb));
+  }
+
+  // Do the AND operations now in parallel, the result is a single bit for each compared position
+  encrypto::motion::ShareWrapper comparison_res_bits = LowDepthReduce(res_concat, std::bit_and<>());
+  return comparison_res_bits.Unsimdify();
+}
+
+static std::vector<encrypto::motion::ShareWrapper> SearchKeyword(
+    const truncated_text& keyword,
+    const std::vector<encrypto::motion::ShareWrapper>& ignore_bits,
+    const std::vector<encrypto::motion::ShareWrapper>& digit_class_bits,
+    const std::vector<std::vector<const truncated_text*>>& targets,
+    const std::size_t min_keyword_length,
+    const encrypto::motion::ShareWrapper& full_zero,
+    const search_options& options) {
+  // Search with a single keyword over each target, where a target (e.g., a mail) consists of one or more texts
+  if (options.group_by_length &&
+      std::all_of(targets.begin(), targets.end(), [](auto& target) { return target.size() == 1; })) {
+    return SearchKeywordByLength(keyword, ignore_bits, digit_class_bits, targets, min_keyword_length, full_zero,
+                                 options);
+  }
+  if (options.optimize_circuit || options.character_comparison_circuit) {
+    return SearchKeywordWithCircuit(keyword, ignore_bits, digit_class_bits, targets, min_keyword_length, full_zero,
+                                    options);
+  }
+  std::vector<encrypto::motion::ShareWrapper> search_results_per_keyword(targets.size());
+
+  comparison_batch batch;
+  std::vector<std::size_t> batch_targets;
+  auto evaluate_batch = [&]() {
+    if (batch_targets.empty()) return;
+    auto comparison_results_split = CompareCharacterBatch(batch, keyword.size());
+
+    // In the second pass, use OR trees to get whether any of the comparisons of a target was a match
+    std::vector<std::vector<encrypto::motion::ShareWrapper>> search_results_per_position;
+    auto position = comparison_results_split.begin();
+    for (auto num_of_positions : batch.positions_per_group) {
+      search_results_per_position.emplace_back(position, position + num_of_positions);
+      position += num_of_positions;
+    }
+
+    std::vector<encrypto::motion::ShareWrapper> search_results_per_target;
+    if (options.coalesce_layers) {
+      search_results_per_target =
+          CoalescedLowDepthReduce(search_results_per_position, std::bit_or<>(), options.simd_width);
+    } else {
+      for (auto& search_results_of_target : search_results_per_position) {
+        search_results_per_target.push_back(LowDepthReduceSIMD(search_results_of_target, std::bit_or<>()));
+      }
+    }
+
+    for (std::size_t k = 0; k < batch_targets.size(); k++) {
+      assert(search_results_per_target[k]->GetBitLength() == 1);
+      search_results_per_keyword[batch_targets[k]] = search_results_per_target[k];
+    }
+    batch = comparison_batch();
+    batch_targets.clear();
+  };
+
+  for (std::size_t i = 0; i < targets.size(); i++) {
+    std::size_t num_of_positions = 0;
+    for (auto text : targets[i]) {
+      num_of_positions +=
+          appendTextComparisons(batch, keyword, ignore_bits, digit_class_bits, *text, min_keyword_length);
+    }
+
+    if (num_of_positions == 0) {
+      // Nothing to compare (e.g., the text or the available buckets are too short), the result is zero (false)
+      search_results_per_keyword[i] = full_zero;
+      continue;
+    }
+    batch.positions_per_group.push_back(num_of_positions);
+    batch_targets.push_back(i);
+
+    // Without coalescing, the circuit of each target is built separately, otherwise once per chunk of targets
+    if (!options.coalesce_layers || (options.chunk_size > 0 && batch_targets.size() >= options.chunk_size)) {
+      evaluate_batch();
+    }
+  }
+  evaluate_batch();
+
+  return search_results_per_keyword;
+}
+
+static std::vector<encrypto::motion::ShareWrapper> SearchKeywordByLength(
+    const truncated_text& keyword,
+    const std::vector<encrypto::motion::ShareWrapper>& ignore_bits,
+    const std::vector<encrypto::motion::ShareWrapper>& digit_class_bits,
+    const std::vector<std::vector<const truncated_text*>>& targets,
+    const std::size_t min_keyword_length,
+    const encrypto::motion::ShareWrapper& full_zero,
+    const search_options& options) {
+  // Targets of a single text with the same length (e.g., mails padded to the same length class) have the same
+  // comparison circuit, so it is built once for each length and evaluated over all of its targets with SIMD gates
+  std::map<std::size_t, std::vector<std::size_t>> targets_per_length;
+  for (std::size_t i = 0; i < targets.size(); i++) targets_per_length[targets[i].front()->size()].push_back(i);
+
+  std::vector<encrypto::motion::ShareWrapper> search_results_per_keyword(targets.size());
+  for (auto& [text_length, targets_of_length] : targets_per_length) {
+    std::int64_t signed_num_of_positions = static_cast<std::int64_t>(text_length) - min_keyword_length + 1;
+    if (signed_num_of_positions < 1) {
+      // Nothing to compare, the texts of this length are too short for the keyword
+      for (auto i : targets_of_length) search_results_per_keyword[i] = full_zero;
+      continue;
+    }
+    const std::size_t num_of_positions = signed_num_of_positions;
+
+    // Each SIMD value is a pair of a position and a target, the SIMD width limits the number of targets per chunk
+    std::size_t targets_per_chunk = targets_of_length.size();
+    if (options.simd_width > 0) targets_per_chunk = std::max<std::size_t>(1, options.simd_width / num_of_positions);
+
+    for (std::size_t begin = 0; begin < targets_of_length.size(); begin += targets_per_chunk) {
+      const std::size_t end = std::min(begin + targets_per_chunk, targets_of_length.size());
+      const std::size_t num_of_values = num_of_positions * (end - begin);
+
+      // Compare each keyword character to the text characters at all positions of all targets at once
+      std::vector<encrypto::motion::ShareWrapper> character_matches;
+      for (std::size_t c = 0; c < keyword.size(); c++) {
+        std::vector<encrypto::motion::ShareWrapper> xnor_simd, text_bits_simd;
+        for (std::size_t bit = 0; bit < kCharacterBitlen; bit++) {
+          std::vector<encrypto::motion::ShareWrapper> text_bit_plane;
+          text_bit_plane.reserve(num_of_values);
+          for (std::size_t text_position = 0; text_position < num_of_positions; text_position++) {
+            for (std::size_t k = begin; k < end; k++) {
+              auto& text = *targets[targets_of_length[k]].front();
+              // Beyond the end of the text, compare the keyword character to itself (i.e., the XNOR gives 1s)
+              text_bit_plane.push_back((c + text_position) >= text.size() ? keyword[c][bit]
+                                                                          : text[c + text_position][bit]);
+            }
+          }
+          std::vector<encrypto::motion::ShareWrapper> keyword_bit_plane(num_of_values, keyword[c][bit]);
+          text_bits_simd.push_back(encrypto::motion::ShareWrapper::Simdify(text_bit_plane));
+          xnor_simd.push_back(~(encrypto::motion::ShareWrapper::Simdify(keyword_bit_plane) ^ text_bits_simd.back()));
+        }
+        auto character_match = LowDepthReduce(xnor_simd, std::bit_and<>());
+        if (!digit_class_bits.empty()) {
+          std::vector<encrypto::motion::ShareWrapper> digit_class_bit_plane(num_of_values, digit_class_bits[c]);
+          character_match = character_match | (encrypto::motion::ShareWrapper::Simdify(digit_class_bit_plane) &
+                                               isDigitCharacter(text_bits_simd));
+        }
+        if (!ignore_bits.empty()) {
+          std::vector<encrypto::motion::ShareWrapper> ignore_bit_plane(num_of_values, ignore_bits[c]);
+          character_match = character_match | encrypto::motion::ShareWrapper::Simdify(ignore_bit_plane);
+        }
+        character_matches.push_back(character_match);
+      }
+      auto position_matches = LowDepthReduce(character_matches, std::bit_and<>()).Unsimdify();
+
+      // Regroup the values by position, such that the OR tree over the positions runs on all targets at once
+      std::vector<encrypto::motion::ShareWrapper> position_matches_simd;
+      for (std::size_t text_position = 0; text_position < num_of_positions; text_position++) {
+        auto first = position_matches.begin() + text_position * (end - begin);
+        position_matches_simd.push_back(encrypto::motion::ShareWrapper::Simdify(
+            std::vector<encrypto::motion::ShareWrapper>(first, first + (end - begin))));
+      }
+      auto search_results = LowDepthReduce(position_matches_simd, std::bit_or<>()).Unsimdify();
+      for (std::size_t k = begin; k < end; k++) {
+        search_results_per_keyword[targets_of_length[k]] = search_results[k - begin];
+      }
+    }
+  }
+  return search_results_per_keyword;
+}
+
+static std::vector<encrypto::motion::ShareWrapper> SearchKeywordWithCircuit(
+    const truncated_text& keyword,
+    const std::vector<encrypto::motion::ShareWrapper>& ignore_bits,
+    const std::vector<encrypto::motion::ShareWrapper>& digit_class_bits,
+    const std::vector<std::vector<const truncated_text*>>& targets,
+    const std::size_t min_keyword_length,
+    const encrypto::motion::ShareWrapper& full_zero,
+    const search_options& options) {
+  // Same comparisons as in SearchKeyword, but built in the intermediate representation of the circuit, which
+  // shares identical comparisons, folds the constant ones and balances and fuses the trees of all targets
+  SearchCircuit circuit;
+  auto get_text_nodes = [&circuit](const truncated_text& text) {
+    circuit_text text_nodes;
+    for (auto& character : text) {
+      std::vector<SearchCircuit::Node> character_bits;
+      for (auto& bit : character) character_bits.push_back(circuit.Input(bit));
+      text_nodes.push_back(std::move(character_bits));
+    }
+    return text_nodes;
+  };
+
+  std::vector<SearchCircuit::Node> ignore_nodes, digit_class_nodes;
+  for (auto& ignore_bit : ignore_bits) ignore_nodes.push_back(circuit.Input(ignore_bit));
+  for (auto& digit_class_bit : digit_class_bits) digit_class_nodes.push_back(circuit.Input(digit_class_bit));
+
+  std::vector<std::vector<circuit_text>> target_nodes;
+  for (auto& target : targets) {
+    std::vector<circuit_text> texts;
+    for (auto text : target) texts.push_back(get_text_nodes(*text));
+    target_nodes.push_back(std::move(texts));
+  }
+
+  auto search_results_per_target = BuildKeywordComparisons(circuit, get_text_nodes(keyword), ignore_nodes,
+                                                           digit_class_nodes, target_nodes, min_keyword_length,
+                                                           options);
+  circuit.Optimize(search_results_per_target);
+  return circuit.Lower(search_results_per_target, full_zero, options.simd_width);
+}
+
+static std::vector<SearchCircuit::Node> BuildKeywordComparisons(
+    SearchCircuit& circuit,
+    const circuit_text& keyword,
+    const std::vector<SearchCircuit::Node>& ignore_bits,
+    const std::vector<SearchCircuit::Node>& digit_class_bits,
+    const std::vector<std::vector<circuit_text>>& targets,
+    const std::size_t min_keyword_length,
+    const search_options& options) {
+  if (auto& comparison_circuit = options.character_comparison_circuit;
+      comparison_circuit &&
+      (comparison_circuit->input_bitlengths != std::vector<std::size_t>{kCharacterBitlen, kCharacterBitlen} ||
+       comparison_circuit->output_bitlengths != std::vector<std::size_t>{1})) {
+    throw std::invalid_argument(
+        "The character comparison circuit needs two inputs of the character bit length and one output bit");
+  }
+  auto compare_characters = [&](const std::vector<SearchCircuit::Node>& a, const std::vector<SearchCircuit::Node>& b) {
+    if (options.character_comparison_circuit) {
+      return circuit.Apply(*options.character_comparison_circuit, {a, b}).front();
+    }
+    std::vector<SearchCircuit::Node> bit_matches;
+    for (std::size_t bit = 0; bit < kCharacterBitlen; bit++) bit_matches.push_back(circuit.Xnor(a[bit], b[bit]));
+    return circuit.And(bit_matches);
+  };
+  // The digits are encoded as 48 to 57 (see isDigitCharacter)
+  auto is_digit = [&](const std::vector<SearchCircuit::Node>& c) {
+    return circuit.And({c[5], c[4], circuit.Not(circuit.And(c[3], circuit.Or(c[2], c[1])))});
+  };
+
+  std::vector<SearchCircuit::Node> search_results_per_target;
+  for (auto& target : targets) {
+    std::vector<SearchCircuit::Node> position_matches;
+    for (auto& text : target) {
+      std::int64_t num_of_positions = static_cast<std::int64_t>(text.size()) - min_keyword_length + 1;
+      for (std::int64_t text_position = 0; text_position < num_of_positions; text_position++) {
+        std::vector<SearchCircuit::Node> character_matches;
+        for (std::size_t c = 0; c < keyword.size(); c++) {
+          // Beyond the end of the text, the keyword character is compared to itself, which is folded to 1
+          auto& text_character = (c + text_position) >= text.size() ? keyword[c] : text[c + text_position];
+          auto character_match = compare_characters(keyword[c], text_character);
+          if (!digit_class_bits.empty()) {
+            character_match = circuit.Or(character_match, circuit.And(digit_class_bits[c], is_digit(text_character)));
+          }
+          if (!ignore_bits.empty()) character_match = circuit.Or(character_match, ignore_bits[c]);
+          character_matches.push_back(character_match);
+        }
+        position_matches.push_back(circuit.And(character_matches));
+      }
+    }
+    // Without any compared position, the OR is the constant 0
+    search_results_per_target.push_back(circuit.Or(position_matches));
+  }
+  return search_results_per_target;
+}
+
+template <typename BinaryOperation>
+static std::vector<encrypto::motion::ShareWrapper> CoalescedLowDepthReduce(
+    std::vector<std::vector<encrypto::motion::ShareWrapper>> groups, BinaryOperation operation,
+    const std::size_t simd_width) {
+  // Reduce all (non-empty) groups with a tree each, but evaluate the operations on the same layer of all trees
+  // with a single SIMD gate and dispatch the results back to the groups afterwards
+  while (true) {
+    std::vector<encrypto::motion::ShareWrapper> lhs, rhs;
+    for (auto& group : groups) {
+      assert(!group.empty());
+      for (std::size_t i = 0; i + 1 < group.size(); i += 2) {
+        lhs.push_back(group[i]);
+        rhs.push_back(group[i + 1]);
+      }
+    }
+    if (lhs.empty()) break;
+
+    // Split the layer into several gates if it is wider than the SIMD width
+    const std::size_t gate_width = simd_width == 0 ? lhs.size() : simd_width;
+    std::vector<encrypto::motion::ShareWrapper> layer_results;
+    for (std::size_t offset = 0; offset < lhs.size(); offset += gate_width) {
+      const std::size_t end = std::min(offset + gate_width, lhs.size());
+      std::vector<encrypto::motion::ShareWrapper> lhs_of_gate(lhs.begin() + offset, lhs.begin() + end);
+      std::vector<encrypto::motion::ShareWrapper> rhs_of_gate(rhs.begin() + offset, rhs.begin() + end);
+      auto gate_results = operation(encrypto::motion::ShareWrapper::Simdify(lhs_of_gate),
+                                    encrypto::motion::ShareWrapper::Simdify(rhs_of_gate))
+                              .Unsimdify();
+      layer_results.insert(layer_results.end(), gate_results.begin(), gate_results.end());
+    }
+
+    auto layer_result = layer_results.begin();
+    for (auto& group : groups) {
+      std::vector<encrypto::motion::ShareWrapper> next_layer(layer_result, layer_result + group.size() / 2);
+      layer_result += group.size() / 2;
+      if (group.size() % 2 == 1) next_layer.push_back(group.back());
+      group = std::move(next_layer);
+    }
+  }
+
+  std::vector<encrypto::motion::ShareWrapper> output;
+  for (auto& group : groups) output.push_back(group.front());
+  return output;
+}
+
+static std::vector<encrypto::motion::ShareWrapper> SearchNgramIndex(
+    const query_input& search_keyword,
+    const std::vector<truncated_text>& ngrams,
+    const std::vector<std::vector<encrypto::motion::ShareWrapper>>& ngram_occurrences,
+    const std::size_t num_of_emails,
+    const encrypto::motion::ShareWrapper& full_zero) {
+  // A mail is a candidate if it contains each n-gram of the keyword. Note that the n-grams may occur at different
+  // positions of the mail, i.e., the result is a superset of the mails that contain the keyword
+  auto keyword = truncateCharacters(search_keyword.search_keyword);
+  if (keyword.size() < kNgramLength) {
+    throw std::invalid_argument(
+        fmt::format("The ngram search mode needs keywords of at least {} characters", kNgramLength));
+  }
+  const std::size_t num_of_keyword_ngrams = keyword.size() - kNgramLength + 1;
+
+  // Compare each n-gram of the keyword to each n-gram of the index
+  comparison_batch batch;
+  for (std::size_t t = 0; t < num_of_keyword_ngrams; t++) {
+    truncated_text keyword_ngram(keyword.begin() + t, keyword.begin() + t + kNgramLength);
+    for (auto& ngram : ngrams) appendTextComparisons(batch, keyword_ngram, {}, {}, ngram, kNgramLength);
+  }
+
+  // Select the occurrence bits of the matching index n-gram for all keyword n-grams with a single SIMD AND gate
+  encrypto::motion::ShareWrapper selected_occurrences;
+  if (!ngrams.empty()) {
+    auto ngram_matches = CompareCharacterBatch(batch, kNgramLength);
+    std::vector<encrypto::motion::ShareWrapper> lhs, rhs;
+    for (std::size_t k = 0; k < ngram_matches.size(); k++) {
+      auto& occurrences = ngram_occurrences[k % ngrams.size()];
+      lhs.insert(lhs.end(), num_of_emails, ngram_matches[k]);
+      rhs.insert(rhs.end(), occurrences.begin(), occurrences.end());
+    }
+    selected_occurrences = encrypto::motion::ShareWrapper::Simdify(lhs) & encrypto::motion::ShareWrapper::Simdify(rhs);
+  }
+
+  const auto zero_occurrences =
+      encrypto::motion::ShareWrapper::Simdify(std::vector<encrypto::motion::ShareWrapper>(num_of_emails, full_zero));
+  std::vector<encrypto::motion::ShareWrapper> results_per_ngram;
+  for (std::size_t t = 0; t < num_of_keyword_ngrams; t++) {
+    // The n-grams of the index are distinct, so at most one of them matches and the OR is just a (local) XOR
+    encrypto::motion::ShareWrapper occurrences = zero_occurrences;
+    for (std::size_t w = 0; w < ngrams.size(); w++) {
+      std::vector<std::size_t> positions(num_of_emails);
+      std::iota(positions.begin(), positions.end(), (t * ngrams.size() + w) * num_of_emails);
+      occurrences ^= selected_occurrences.Subset(std::move(positions));
+    }
+
+    // Ignore the n-gram if it reaches beyond the actual length of the keyword
+    const auto ignore_bit = ~search_keyword.length_mask[t + kNgramLength - 1];
+    std::vector<encrypto::motion::ShareWrapper> ignore_bit_plane(num_of_emails, ignore_bit);
+    results_per_ngram.push_back(occurrences | encrypto::motion::ShareWrapper::Simdify(ignore_bit_plane));
+  }
+
+  // Combine the lookups of all n-grams of the keyword with a tree of AND gates (over all mails in parallel)
+  return LowDepthReduce(results_per_ngram, std::bit_and<>()).Unsimdify();
+}
+
+static std::vector<std::vector<encrypto::motion::ShareWrapper>> SearchPostingLists(
+    const encrypto::motion::PartyPointer& party,
+    const std::vector<query_input>& search_keywords,
+    const search_index& search_index,
+    const encrypto::motion::ShareWrapper& full_zero,
+    const search_options& options) {
+  // Each word of the index has a posting list, i.e., the sequence numbers plus one of the mails that contain the
+  // word, which is padded with zeros to the size class of the list
+  const std::size_t num_of_emails = search_index.num_of_emails;
+  const std::size_t posting_bitlen = search_index.posting_bitlen;
+  if (num_of_emails >= (std::size_t{1} << posting_bitlen)) {
+    throw std::invalid_argument("The posting bit length of the search index is too small for its number of emails");
+  }
+  const auto zero_results =
+      encrypto::motion::ShareWrapper::Simdify(std::vector<encrypto::motion::ShareWrapper>(num_of_emails, full_zero));
+
+  // Decode and initialize the words and the bits of their posting lists, grouped by the size classes
+  std::vector<truncated_text> words;
+  std::vector<std::vector<std::size_t>> words_per_class;
+  std::vector<std::vector<std::vector<encrypto::motion::ShareWrapper>>> posting_bits_per_class;
+  for (auto& postings : search_index.posting_classes) {
+    words_per_class.emplace_back();
+    posting_bits_per_class.emplace_back();
+    for (auto& [word, posting_string] : postings.word_and_posting_strings) {
+      debugMessage(party, fmt::format("Target word: {} (postings: {})", word, postings.num_of_postings));
+      words_per_class.back().push_back(words.size());
+      words.push_back(truncateCharacters(base64StringToInput(party, word)));
+
+      auto posting_bits = splitTo1bitShareWrappers(base64StringToInput(party, posting_string));
+      assert(posting_bits.size() >= postings.num_of_postings * posting_bitlen);
+      posting_bits.resize(postings.num_of_postings * posting_bitlen);
+      posting_bits_per_class.back().push_back(std::move(posting_bits));
+    }
+  }
+
+  std::vector<std::vector<encrypto::motion::ShareWrapper>> results_per_keyword;
+  for (auto& search_keyword : search_keywords) {
+    if (num_of_emails == 0 || words.empty()) {
+      results_per_keyword.push_back(zero_results.Unsimdify());
+      continue;
+    }
+
+    // The keyword is compared to the words of its bucket as a whole, such that at most one word matches and its
+    // posting list can be selected with XOR gates (the words of the index are distinct)
+    std::vector<std::vector<const truncated_text*>> targets(words.size());
+    for (std::size_t w = 0; w < words.size(); w++) {
+      if (words[w].size() == search_keyword.bucket_size) targets[w].push_back(&words[w]);
+    }
+    auto word_results = SearchKeyword(truncateCharacters(search_keyword.search_keyword), {}, {}, targets,
+                                      search_keyword.bucket_size, full_zero, options);
+
+    std::vector<encrypto::motion::ShareWrapper> results_per_class;
+    for (std::size_t c = 0; c < search_index.posting_classes.size(); c++) {
+      auto& class_words = words_per_class[c];
+      if (class_words.empty()) continue;
+      const std::size_t num_of_postings = search_index.posting_classes[c].num_of_postings;
+      const std::size_t num_of_bits = num_of_postings * posting_bitlen;
+
+      // Select the posting list of the matching word with a single SIMD AND gate and (local) XOR gates
+      std::vector<encrypto::motion::ShareWrapper> lhs, rhs;
+      for (std::size_t k = 0; k < class_words.size(); k++) {
+        lhs.insert(lhs.end(), num_of_bits, word_results[class_words[k]]);
+        rhs.insert(rhs.end(), posting_bits_per_class[c][k].begin(), posting_bits_per_class[c][k].end());
+      }
+      auto selected_bits = encrypto::motion::ShareWrapper::Simdify(lhs) & encrypto::motion::ShareWrapper::Simdify(rhs);
+
+      std::vector<std::size_t> positions(num_of_bits);
+      std::iota(positions.begin(), positions.end(), 0);
+      auto selected_postings = selected_bits.Subset(std::vector<std::size_t>(positions));
+      for (std::size_t k = 1; k < class_words.size(); k++) {
+        std::iota(positions.begin(), positions.end(), k * num_of_bits);
+        selected_postings = selected_postings ^ selected_bits.Subset(std::vector<std::size_t>(positions));
+      }
+
+      // Without a matching word, the selected posting list is all zeros, i.e., only padding
+      results_per_class.push_back(
+          ScatterPostings(selected_postings, num_of_postings, posting_bitlen, num_of_emails));
+    }
+    if (results_per_class.empty()) {
+      results_per_keyword.push_back(zero_results.Unsimdify());
+      continue;
+    }
+    results_per_keyword.push_back(LowDepthReduce(results_per_class, std::bit_or<>()).Unsimdify());
+  }
+  return results_per_keyword;
+}
+
+static encrypto::motion::ShareWrapper ScatterPostings(const encrypto::motion::ShareWrapper& postings,
+                                                     const std::size_t num_of_postings,
+                                                     const std::size_t posting_bitlen,
+                                                     const std::size_t num_of_emails) {
+  // Obliviously scatter the postings (each of posting_bitlen bits, the most significant bit first) into a bitmap with
+  // a bit per mail, where the posting i + 1 sets the bit of mail i and 0 is padding. Each posting is decoded into a
+  // one-hot vector by extending the prefixes of its value bit by bit (one AND gate per prefix), where prefixes that
+  // can only lead to values above num_of_emails are dropped
+  auto bit_plane = [&](std::size_t bit) {
+    std::vector<std::size_t> positions(num_of_postings);
+    for (std::size_t p = 0; p < num_of_postings; p++) positions[p] = p * posting_bitlen + bit;
+    return postings.Subset(std::move(positions));
+  };
+
+  // The prefixes of each level are ordered by their value, each is a SIMD share over the postings
+  std::vector<encrypto::motion::ShareWrapper> prefixes;
+  auto first_bit = bit_plane(0);
+  prefixes.push_back(~first_bit);
+  if ((std::size_t{1} << (posting_bitlen - 1)) <= num_of_emails) prefixes.push_back(first_bit);
+
+  for (std::size_t bit = 1; bit < posting_bitlen; bit++) {
+    const std::size_t remaining_bits = posting_bitlen - 1 - bit;
+    // Extend all prefixes of the level with a single SIMD AND gate, P & ~x is then computed locally as P ^ (P & x)
+    auto next_bit = bit_plane(bit);
+    auto extended = encrypto::motion::ShareWrapper::Simdify(prefixes) &
+                    encrypto::motion::ShareWrapper::Simdify(
+                        std::vector<encrypto::motion::ShareWrapper>(prefixes.size(), next_bit));
+
+    std::vector<encrypto::motion::ShareWrapper> next_prefixes;
+    for (std::size_t value = 0; value < prefixes.size(); value++) {
+      std::vector<std::size_t> positions(num_of_postings);
+      std::iota(positions.begin(), positions.end(), value * num_of_postings);
+      auto with_one = extended.Subset(std::move(positions));
+      if (((2 * value) << remaining_bits) <= num_of_emails) next_prefixes.push_back(prefixes[value] ^ with_one);
+      if (((2 * value + 1) << remaining_bits) <= num_of_emails) next_prefixes.push_back(with_one);
+    }
+    prefixes = std::move(next_prefixes);
+  }
+  assert(prefixes.size() == num_of_emails + 1);
+
+  // A mail is in the bitmap if any of the postings is its sequence number plus one (the value 0 is dropped)
+  auto one_hot = encrypto::motion::ShareWrapper::Simdify(
+      std::vector<encrypto::motion::ShareWrapper>(prefixes.begin() + 1, prefixes.end()));
+  std::vector<encrypto::motion::ShareWrapper> postings_per_mail;
+  for (std::size_t p = 0; p < num_of_postings; p++) {
+    std::vector<std::size_t> positions(num_of_emails);
+    for (std::size_t i = 0; i < num_of_emails; i++) positions[i] = i * num_of_postings + p;
+    postings_per_mail.push_back(one_hot.Subset(std::move(positions)));
+  }
+  return LowDepthReduce(postings_per_mail, std::bit_or<>());
+}
+
+static std::vector<std::vector<encrypto::motion::ShareWrapper>> ExclusivePrefixCount(
+    const std::vector<encrypto::motion::ShareWrapper>& bits,
+    const encrypto::motion::ShareWrapper& full_zero) {
+  // Count the ones before each position with a Hillis-Steele scan, where each step adds the counts of all positions
+  // with a single SIMD ripple-carry adder. The output counts[k][i] is bit k (LSB first) of the count at position i
+  const std::size_t n = bits.size();
+  std::size_t bitlen = 1;
+  while ((std::size_t(1) << bitlen) < n) bitlen++;
+
+  std::vector<std::vector<encrypto::motion::ShareWrapper>> counts(
+      bitlen, std::vector<encrypto::motion::ShareWrapper>(n, full_zero));
+  for (std::size_t i = 1; i < n; i++) counts[0][i] = bits[i - 1];
+
+  for (std::size_t distance = 1; distance < n; distance *= 2) {
+    encrypto::motion::ShareWrapper carry;
+    for (std::size_t k = 0; k < bitlen; k++) {
+      auto a = encrypto::motion::ShareWrapper::Simdify(
+          std::vector<encrypto::motion::ShareWrapper>(counts[k].begin() + distance, counts[k].end()));
+      auto b = encrypto::motion::ShareWrapper::Simdify(
+          std::vector<encrypto::motion::ShareWrapper>(counts[k].begin(), counts[k].end() - distance));
+
+      encrypto::motion::ShareWrapper sum;
+      if (k == 0) {
+        sum = a ^ b;
+        if (bitlen > 1) carry = a & b;
+      } else {
+        sum = a ^ b ^ carry;
+        // Majority of a, b and carry with a single AND gate, the carry of the highest bit is not needed
+        if (k + 1 < bitlen) carry = ((a ^ carry) & (b ^ carry)) ^ carry;
+      }
+
+      auto sum_values = sum.Unsimdify();
+      std::copy(sum_values.begin(), sum_values.end(), counts[k].begin() + distance);
+    }
+  }
+  return counts;
+}
+
+static std::vector<std::vector<encrypto::motion::ShareWrapper>> VerifyCandidates(
+    const encrypto::motion::PartyPointer& party,
+    const std::vector<query_input>& search_keywords,
+    const std::vector<truncated_text>& target_texts,
+    const std::vector<std::vector<encrypto::motion::ShareWrapper>>& candidates_per_keyword,
+    const std::vector<std::uint32_t>& bucket_scheme,
+    const encrypto::motion::ShareWrapper& full_zero,
+    const search_options& options) {
+  // Verify the candidate mails of the prefilter with the exact (hidden mode) search circuit. The candidates are
+  // compacted to a public number of slots and their texts are selected obliviously, such that the verification
+  // costs depend on the number of slots instead of the number of mails. NOTE: If there are more candidates than
+  // slots, the candidates with the highest sequence numbers are dropped (i.e., they are not found)
+  const std::size_t num_of_emails = target_texts.size();
+  const std::size_t num_of_slots = std::min(options.candidate_bound, num_of_emails);
+
+  std::size_t max_text_length = 0;
+  for (auto& text : target_texts) max_text_length = std::max(max_text_length, text.size());
+  if (num_of_slots == 0 || max_text_length == 0) {
+    return std::vector<std::vector<encrypto::motion::ShareWrapper>>(
+        search_keywords.size(), std::vector<encrypto::motion::ShareWrapper>(num_of_emails, full_zero));
+  }
+
+  // A mail is a candidate if it is a candidate for any keyword, the results of all other mails are zero anyway
+  std::vector<std::vector<encrypto::motion::ShareWrapper>> candidate_groups(num_of_emails);
+  for (auto& candidates : candidates_per_keyword) {
+    for (std::size_t i = 0; i < num_of_emails; i++) candidate_groups[i].push_back(candidates[i]);
+  }
+  auto candidates = CoalescedLowDepthReduce(candidate_groups, std::bit_or<>(), options.simd_width);
+
+  // The slot of a candidate is its rank, i.e., the number of candidates before it
+  auto ranks = ExclusivePrefixCount(candidates, full_zero);
+  std::vector<std::vector<encrypto::motion::ShareWrapper>> negated_ranks(ranks.size());
+  for (std::size_t k = 0; k < ranks.size(); k++) {
+    for (auto& rank_bit : ranks[k]) negated_ranks[k].push_back(~rank_bit);
+  }
+
+  // One-hot selection, selection[s * num_of_emails + i] is 1 iff mail i is a candidate with rank s
+  std::vector<std::vector<encrypto::motion::ShareWrapper>> selection_planes(ranks.size() + 1);
+  for (std::size_t s = 0; s < num_of_slots; s++) {
+    for (std::size_t i = 0; i < num_of_emails; i++) {
+      selection_planes[0].push_back(candidates[i]);
+      for (std::size_t k = 0; k < ranks.size(); k++) {
+        selection_planes[k + 1].push_back((s >> k) & 1 ? ranks[k][i] : negated_ranks[k][i]);
+      }
+    }
+  }
+  std::vector<encrypto::motion::ShareWrapper> selection_simd;
+  for (auto& selection_plane : selection_planes) {
+    selection_simd.push_back(encrypto::motion::ShareWrapper::Simdify(selection_plane));
+  }
+  auto selection = LowDepthReduce(selection_simd, std::bit_and<>()).Unsimdify();
+
+  // The texts are padded to the same length, party 0 inputs the (public) padding character
+  encrypto::motion::ShareWrapper padding_input =
+      party->In<encrypto::motion::MpcProtocol::kBooleanGmw>(encrypto::motion::ToInput(kPaddingCharacter), 0);
+  auto padding_character = truncateCharacters({padding_input}).front();
+
+  // Select the text of each slot as the XOR over all mails of (selection bit AND text), with a single SIMD AND gate
+  // for all slots, characters and bits of all mails
+  const std::size_t slot_values = num_of_slots * max_text_length * kCharacterBitlen;
+  std::vector<encrypto::motion::ShareWrapper> lhs, rhs;
+  lhs.reserve(num_of_emails * slot_values);
+  rhs.reserve(num_of_emails * slot_values);
+  for (std::size_t i = 0; i < num_of_emails; i++) {
+    for (std::size_t s = 0; s < num_of_slots; s++) {
+      for (std::size_t c = 0; c < max_text_length; c++) {
+        for (std::size_t bit = 0; bit < kCharacterBitlen; bit++) {
+          lhs.push_back(selection[s * num_of_emails + i]);
+          rhs.push_back(c < target_texts[i].size() ? target_texts[i][c][bit] : padding_character[bit]);
+        }
+      }
+    }
+  }
+  auto selected_bits = encrypto::motion::ShareWrapper::Simdify(lhs) & encrypto::motion::ShareWrapper::Simdify(rhs);
+
+  encrypto::motion::ShareWrapper selected;
+  for (std::size_t i = 0; i < num_of_emails; i++) {
+    std::vector<std::size_t> positions(slot_values);
+    std::iota(positions.begin(), positions.end(), i * slot_values);
+    auto selected_of_mail = selected_bits.Subset(std::move(positions));
+    selected = i == 0 ? selected_of_mail : selected ^ selected_of_mail;
+  }
+  auto selected_values = selected.Unsimdify();
+
+  std::vector<truncated_text> selected_texts(num_of_slots, truncated_text(max_text_length));
+  for (std::size_t s = 0; s < num_of_slots; s++) {
+    for (std::size_t c = 0; c < max_text_length; c++) {
+      auto first_bit = selected_values.begin() + (s * max_text_length + c) * kCharacterBitlen;
+      selected_texts[s][c].assign(first_bit, first_bit + kCharacterBitlen);
+    }
+  }
+
+  // Verify each keyword on the selected texts (empty slots select no mail and are thus never scattered back)
+  std::vector<std::vector<const truncated_text*>> targets;
+  for (auto& selected_text : selected_texts) targets.push_back({&selected_text});
+
+  lhs.clear();
+  rhs.clear();
+  for (auto& search_keyword : search_keywords) {
+    std::uint32_t min_keyword_length = getMinKeywordLength(search_keyword.bucket_size, bucket_scheme);
+    auto verified = SearchKeyword(truncateCharacters(search_keyword.search_keyword), getIgnoreBits(search_keyword),
+                                  getDigitClassBits(search_keyword), targets, min_keyword_length, full_zero, options);
+
+    // Scatter the results back to the mails as the XOR over all slots of (selection bit AND result)
+    for (std::size_t s = 0; s < num_of_slots; s++) {
+      lhs.insert(lhs.end(), selection.begin() + s * num_of_emails, selection.begin() + (s + 1) * num_of_emails);
+      rhs.insert(rhs.end(), num_of_emails, verified[s]);
+    }
+  }
+  auto scattered = encrypto::motion::ShareWrapper::Simdify(lhs) & encrypto::motion::ShareWrapper::Simdify(rhs);
+
+  std::vector<std::vector<encrypto::motion::ShareWrapper>> results_per_keyword;
+  for (std::size_t j = 0; j < search_keywords.size(); j++) {
+    encrypto::motion::ShareWrapper result;
+    for (std::size_t s = 0; s < num_of_slots; s++) {
+      std::vector<std::size_t> positions(num_of_emails);
+      std::iota(positions.begin(), positions.end(), (j * num_of_slots + s) * num_of_emails);
+      auto result_of_slot = scattered.Subset(std::move(positions));
+      result = s == 0 ? result_of_slot : result ^ result_of_slot;
+    }
+    results_per_keyword.push_back(result.Unsimdify());
+  }
+  return results_per_keyword;
+}
+
+static std::vector<std::vector<encrypto::motion::ShareWrapper>> SearchBloomFilters(
+    const std::vector<std::vector<std::vector<encrypto::motion::ShareWrapper>>>& keyword_positions,
+    const std::vector<std::vector<encrypto::motion::ShareWrapper>>& bloom_filters,
+    const encrypto::motion::ShareWrapper& full_zero) {
+  // A mail contains a keyword (up to the false positives of the filter) if the Bloom filter of the mail is set at
+  // each of the keyword's positions. The position of each hash function is given as a shared one-hot vector, so
+  // the filter bit at the position is the XOR over all filter bits AND the one-hot bits
+  const std::size_t num_of_keywords = keyword_positions.size();
+  const std::size_t num_of_emails = bloom_filters.size();
+  const std::size_t num_of_hashes = keyword_positions.front().size();
+  if (num_of_hashes == 0) throw std::invalid_argument("Search keyword has no Bloom filter positions");
+  const std::size_t filter_size = keyword_positions.front().front().size();
+
+  for (auto& positions : keyword_positions) {
+    if (positions.size() != num_of_hashes) throw std::invalid_argument("Search keywords have different hash counts");
+    for (auto& one_hot : positions) {
+      if (one_hot.size() != filter_size) throw std::invalid_argument("Bloom filter positions have different sizes");
+    }
+  }
+  // Mails without a Bloom filter (e.g., received before the filters were added) contain no keywords
+  const std::vector<encrypto::motion::ShareWrapper> empty_filter(filter_size, full_zero);
+  for (auto& bloom_filter : bloom_filters) {
+    if (!bloom_filter.empty() && bloom_filter.size() != filter_size) {
+      throw std::invalid_argument("Bloom filter of a mail does not match the size of the keyword positions");
+    }
+  }
+
+  // All filter bits of all hash functions, keywords and mails with a single SIMD AND gate
+  std::vector<encrypto::motion::ShareWrapper> lhs, rhs;
+  lhs.reserve(num_of_hashes * num_of_keywords * num_of_emails * filter_size);
+  rhs.reserve(num_of_hashes * num_of_keywords * num_of_emails * filter_size);
+  for (std::size_t h = 0; h < num_of_hashes; h++) {
+    for (std::size_t j = 0; j < num_of_keywords; j++) {
+      for (auto& bloom_filter : bloom_filters) {
+        auto& filter = bloom_filter.empty() ? empty_filter : bloom_filter;
+        lhs.insert(lhs.end(), keyword_positions[j][h].begin(), keyword_positions[j][h].end());
+        rhs.insert(rhs.end(), filter.begin(), filter.end());
+      }
+    }
+  }
+  auto selected_bits = encrypto::motion::ShareWrapper::Simdify(lhs) & encrypto::motion::ShareWrapper::Simdify(rhs);
+
+  // XOR over the filter positions (locally), for all hash functions, keywords and mails in parallel
+  const std::size_t num_of_blocks = num_of_hashes * num_of_keywords * num_of_emails;
+  encrypto::motion::ShareWrapper filter_bits;
+  for (std::size_t p = 0; p < filter_size; p++) {
+    std::vector<std::size_t> positions(num_of_blocks);
+    for (std::size_t block = 0; block < num_of_blocks; block++) positions[block] = block * filter_size + p;
+    auto bits_at_position = selected_bits.Subset(std::move(positions));
+    filter_bits = p == 0 ? bits_at_position : filter_bits ^ bits_at_position;
+  }
+
+  // AND over the hash functions with a tree, for all keywords and mails in parallel
+  std::vector<encrypto::motion::ShareWrapper> filter_bits_per_hash;
+  for (std::size_t h = 0; h < num_of_hashes; h++) {
+    std::vector<std::size_t> positions(num_of_keywords * num_of_emails);
+    std::iota(positions.begin(), positions.end(), h * num_of_keywords * num_of_emails);
+    filter_bits_per_hash.push_back(filter_bits.Subset(std::move(positions)));
+  }
+  auto membership = LowDepthReduce(filter_bits_per_hash, std::bit_and<>()).Unsimdify();
+
+  std::vector<std::vector<encrypto::motion::ShareWrapper>> results_per_keyword;
+  for (std::size_t j = 0; j < num_of_keywords; j++) {
+    results_per_keyword.emplace_back(membership.begin() + j * num_of_emails,
+                                     membership.begin() + (j + 1) * num_of_emails);
+  }
+  return results_per_keyword;
+}
+
+static std::vector<dfa_input> getDfaInput(encrypto::motion::PartyPointer& party,
+                                          const std::vector<search_query>& search_queries) {
+  std::vector<dfa_input> patterns;
+  for (auto& search_query : search_queries) {
+    const std::size_t num_of_states = search_query.dfa_num_of_states, num_of_classes = search_query.dfa_num_of_classes;
+    if (num_of_states == 0) throw std::invalid_argument("Search keyword has no DFA (construct the query with --regex)");
+    if (!std::has_single_bit(num_of_states) || num_of_states < 2 || !std::has_single_bit(num_of_classes) ||
+        num_of_classes < 2) {
+      throw std::invalid_argument("The numbers of DFA states and classes must be powers of two");
+    }
+
+    dfa_input pattern{num_of_states, num_of_classes, {}, {}, {}};
+    debugMessage(party, fmt::format("Keyword DFA classes: {}", search_query.keyword_dfa_classes));
+    pattern.classes = splitTo1bitShareWrappers(base64StringToInput(party, search_query.keyword_dfa_classes));
+    debugMessage(party, fmt::format("Keyword DFA transitions: {}", search_query.keyword_dfa_transitions));
+    pattern.transitions =
+        splitTo1bitShareWrappers(base64StringToInput(party, search_query.keyword_dfa_transitions));
+    debugMessage(party, fmt::format("Keyword DFA accepting states: {}", search_query.keyword_dfa_accepting));
+    pattern.accepting =
+        splitTo1bitShareWrappers(base64StringToInput(party, search_query.keyword_dfa_accepting));
+
+    const std::size_t state_bitlen = std::bit_width(num_of_states) - 1;
+    const std::size_t class_bitlen = std::bit_width(num_of_classes) - 1;
+    if (pattern.classes.size() < (std::size_t{1} << kCharacterBitlen) * class_bitlen ||
+        pattern.transitions.size() < num_of_states * num_of_classes * state_bitlen ||
+        pattern.accepting.size() < num_of_states) {
+      throw std::invalid_argument("The DFA tables of a search keyword do not match their sizes");
+    }
+    patterns.push_back(std::move(pattern));
+  }
+  return patterns;
+}
+
+static std::vector<encrypto::motion::ShareWrapper> decodeOneHot(const std::vector<encrypto::motion::ShareWrapper>& bits,
+                                                               const std::size_t width) {
+  // Decode the bits of a value (least significant bit first, each a SIMD share of the given width) into a one-hot
+  // vector with a share per value. Like in ScatterPostings, the prefixes are extended bit by bit with a single SIMD
+  // AND gate per bit, where P & ~x is computed locally as P ^ (P & x)
+  assert(!bits.empty());
+  std::vector<encrypto::motion::ShareWrapper> prefixes{~bits.front(), bits.front()};
+  for (std::size_t bit = 1; bit < bits.size(); bit++) {
+    auto extended = encrypto::motion::ShareWrapper::Simdify(prefixes) &
+                    encrypto::motion::ShareWrapper::Simdify(
+                        std::vector<encrypto::motion::ShareWrapper>(prefixes.size(), bits[bit]));
+
+    // The values with the bit set follow those without it, i.e., the prefix of value v is at index v
+    std::vector<encrypto::motion::ShareWrapper> next_prefixes(2 * prefixes.size());
+    for (std::size_t value = 0; value < prefixes.size(); value++) {
+      std::vector<std::size_t> positions(width);
+      std::iota(positions.begin(), positions.end(), value * width);
+      auto with_one = extended.Subset(std::move(positions));
+      next_prefixes[value] = prefixes[value] ^ with_one;
+      next_prefixes[value + prefixes.size()] = with_one;
+    }
+    prefixes = std::move(next_prefixes);
+  }
+  return prefixes;
+}
+
+static encrypto::motion::ShareWrapper xorReduceMiddle(encrypto::motion::ShareWrapper values, const std::size_t outer,
+                                                      std::size_t middle, const std::size_t inner) {
+  // XOR the SIMD values of the layout (outer, middle, inner) over the middle dimension, whose size is a power of two,
+  // by folding its upper half onto its lower half. The XOR gates are local, the layout of the result is (outer, inner)
+  assert(std::has_single_bit(middle));
+  while (middle > 1) {
+    const std::size_t half = middle / 2;
+    std::vector<std::size_t> lower, upper;
+    lower.reserve(outer * half * inner);
+    upper.reserve(outer * half * inner);
+    for (std::size_t o = 0; o < outer; o++) {
+      for (std::size_t m = 0; m < half; m++) {
+        for (std::size_t i = 0; i < inner; i++) {
+          lower.push_back((o * middle + m) * inner + i);
+          upper.push_back((o * middle + half + m) * inner + i);
+        }
+      }
+    }
+    values = values.Subset(std::move(lower)) ^ values.Subset(std::move(upper));
+    middle = half;
+  }
+  return values;
+}
+
+static std::vector<std::vector<encrypto::motion::ShareWrapper>> SearchDfa(
+    const std::vector<dfa_input>& patterns,
+    const std::vector<truncated_text>& target_texts) {
+  // Each pattern's DFA runs over the characters of all mails at once, with a SIMD value per mail. The mails are sorted
+  // by the (public) length of their texts, such that the mails whose text ended drop out of the SIMD values and no
+  // padding characters are needed. Each transition is a lookup in the secret tables with secret indices:
+  //  1. the character is decoded into a one-hot vector and selects its class (XOR over the characters' class bits),
+  //  2. the class is decoded and selects the next state of every state (XOR over the classes' next state bits),
+  //  3. the next states are decoded into a one-hot matrix, and the current one-hot state selects its row.
+  // Steps 1 and 2 only depend on the text and are thus evaluated for all positions in parallel, only step 3 is
+  // sequential, which costs a single layer of AND gates (and a communication round) per character
+  using encrypto::motion::ShareWrapper;
+  const std::size_t num_of_emails = target_texts.size();
+  const std::size_t alphabet_size = std::size_t{1} << kCharacterBitlen;
+
+  std::vector<std::size_t> order(num_of_emails);
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(),
+                   [&](std::size_t a, std::size_t b) { return target_texts[a].size() > target_texts[b].size(); });
+  std::size_t num_of_texts = 0;  // The mails with a non-empty text, which come first in the order
+  while (num_of_texts < num_of_emails && !target_texts[order[num_of_texts]].empty()) num_of_texts++;
+  const std::size_t max_length = num_of_texts == 0 ? 0 : target_texts[order.front()].size();
+
+  auto broadcast = [](const ShareWrapper& value, std::size_t width) {
+    return ShareWrapper::Simdify(std::vector<ShareWrapper>(width, value));
+  };
+  auto contiguous = [](std::size_t first, std::size_t count) {
+    std::vector<std::size_t> positions(count);
+    std::iota(positions.begin(), positions.end(), first);
+    return positions;
+  };
+
+  std::vector<std::vector<ShareWrapper>> results_per_keyword;
+  for (auto& pattern : patterns) {
+    const std::size_t num_of_states = pattern.num_of_states, num_of_classes = pattern.num_of_classes;
+    const std::size_t state_bitlen = std::bit_width(num_of_states) - 1;
+    const std::size_t class_bitlen = std::bit_width(num_of_classes) - 1;
+
+    // The one-hot state of each active mail (one share per state), and the final states of the mails whose text
+    // ended, in the reverse order of the sorted mails
+    std::vector<ShareWrapper> state;
+    std::vector<std::vector<ShareWrapper>> final_states;
+    std::size_t active = num_of_texts;
+    for (std::size_t t = 0; t < max_length; t++) {
+      std::size_t width = active;
+      while (width > 0 && target_texts[order[width - 1]].size() <= t) width--;
+      if (width < active) {
+        std::vector<ShareWrapper> ended(num_of_states);
+        for (std::size_t q = 0; q < num_of_states; q++) {
+          ended[q] = state[q].Subset(contiguous(width, active - width));
+          state[q] = state[q].Subset(contiguous(0, width));
+        }
+        final_states.push_back(std::move(ended));
+        active = width;
+      }
+
+      // 1. The class bits of the character at this position of each mail
+      std::vector<ShareWrapper> character_bits(kCharacterBitlen);
+      for (std::size_t bit = 0; bit < kCharacterBitlen; bit++) {
+        std::vector<ShareWrapper> bits_of_mails(width);
+        for (std::size_t i = 0; i < width; i++) bits_of_mails[i] = target_texts[order[i]][t][bit];
+        character_bits[bit] = ShareWrapper::Simdify(bits_of_mails);
+      }
+      auto characters = decodeOneHot(character_bits, width);
+      std::vector<ShareWrapper> lhs, rhs;
+      for (std::size_t bit = 0; bit < class_bitlen; bit++) {
+        for (std::size_t a = 0; a < alphabet_size; a++) {
+          lhs.push_back(characters[a]);
+          rhs.push_back(broadcast(pattern.classes[a * class_bitlen + bit], width));
+        }
+      }
+      auto class_bits = xorReduceMiddle(ShareWrapper::Simdify(lhs) & ShareWrapper::Simdify(rhs), class_bitlen,
+                                        alphabet_size, width);
+      std::vector<ShareWrapper> class_bit_planes;
+      for (std::size_t bit = 0; bit < class_bitlen; bit++) {
+        class_bit_planes.push_back(class_bits.Subset(contiguous(bit * width, width)));
+      }
+      auto classes = decodeOneHot(class_bit_planes, width);
+
+      // 2. The next state bits of each state, in the layout (state, bit, mail)
+      lhs.clear();
+      rhs.clear();
+      for (std::size_t q = 0; q < num_of_states; q++) {
+        for (std::size_t bit = 0; bit < state_bitlen; bit++) {
+          for (std::size_t k = 0; k < num_of_classes; k++) {
+            lhs.push_back(classes[k]);
+            rhs.push_back(broadcast(pattern.transitions[(q * num_of_classes + k) * state_bitlen + bit], width));
+          }
+        }
+      }
+      auto next_state_bits = xorReduceMiddle(ShareWrapper::Simdify(lhs) & ShareWrapper::Simdify(rhs),
+                                             num_of_states * state_bitlen, num_of_classes, width);
+
+      // 3. Decode the next states of all states at once, each share of the matrix has the layout (state, mail)
+      std::vector<ShareWrapper> next_state_planes;
+      for (std::size_t bit = 0; bit < state_bitlen; bit++) {
+        std::vector<std::size_t> positions;
+        for (std::size_t q = 0; q < num_of_states; q++) {
+          for (std::size_t i = 0; i < width; i++) positions.push_back((q * state_bitlen + bit) * width + i);
+        }
+        next_state_planes.push_back(next_state_bits.Subset(std::move(positions)));
+      }
+      auto transition = decodeOneHot(next_state_planes, num_of_states * width);
+
+      if (t == 0) {
+        // Each DFA starts in state 0, whose row is the first block of the matrix
+        state.resize(num_of_states);
+        for (std::size_t q = 0; q < num_of_states; q++) state[q] = transition[q].Subset(contiguous(0, width));
+        continue;
+      }
+      // The next state q' is the XOR over the states q of state[q] & transition[q'][q], in the layout (q', q, mail)
+      auto current = ShareWrapper::Simdify(state);
+      auto products = ShareWrapper::Simdify(std::vector<ShareWrapper>(num_of_states, current)) &
+                      ShareWrapper::Simdify(transition);
+      auto next_state = xorReduceMiddle(products, num_of_states, num_of_states, width);
+      for (std::size_t q = 0; q < num_of_states; q++) {
+        state[q] = next_state.Subset(contiguous(q * width, width));
+      }
+    }
+    if (active > 0) final_states.push_back(std::move(state));
+
+    // The accepting states are absorbing, so a mail matches if its final state is accepting. The mails without text
+    // are still in the start state
+    std::vector<ShareWrapper> results(num_of_emails, pattern.accepting.front());
+    if (num_of_texts > 0) {
+      std::vector<ShareWrapper> lhs, rhs;
+      for (std::size_t q = 0; q < num_of_states; q++) {
+        for (auto ended = final_states.rbegin(); ended != final_states.rend(); ended++) lhs.push_back((*ended)[q]);
+        rhs.push_back(broadcast(pattern.accepting[q], num_of_texts));
+      }
+      auto accepted =
+          xorReduceMiddle(ShareWrapper::Simdify(lhs) & ShareWrapper::Simdify(rhs), 1, num_of_states, num_of_texts)
+              .Unsimdify();
+      for (std::size_t k = 0; k < num_of_texts; k++) results[order[k]] = accepted[k];
+    }
+    results_per_keyword.push_back(std::move(results));
+  }
+  return results_per_keyword;
+}
+
+static truncated_text getMailText(const encrypto::motion::PartyPointer& party, const mail_structure& mail) {
+  debugMessage(party, fmt::format("Target text: {}", mail.secret_share_truncated_block));
+  return truncateCharacters(base64StringToInput(party, mail.secret_share_truncated_block));
+}
+
+static bool searchesMailTexts(const search_mode_enum search_mode, const search_options& options) {
+  // The normal, hidden and dfa search modes (and the verification of the two-stage ngram search) search the text of
+  // each mail
+  return search_mode == eNormal || search_mode == eHidden || search_mode == eDfa ||
+         (search_mode == eNgram && options.candidate_bound > 0);
+}
+
+static std::vector<std::vector<encrypto::motion::ShareWrapper>> SearchKeywordsWithMode(
+    encrypto::motion::PartyPointer& party,
+    const std::vector<search_query>& search_queries,
+    const std::vector<mail_structure>& mails,
+    const std::vector<truncated_text>& mail_texts,
+    const search_index& search_index,
+    const std::vector<std::uint32_t>& bucket_scheme,
+    const search_mode_enum search_mode,
+    const encrypto::motion::ShareWrapper& full_zero,
+    const search_options& options) {
+  // The results of each keyword are per mail, except in the index search mode, where they are per word of the index
+  std::vector<std::vector<encrypto::motion::ShareWrapper>> results_per_keyword;
+  if (search_queries.empty()) return results_per_keyword;
+
+  switch (search_mode) {
+    case eNormal: {
+      // Decode and initialize the search keywords
+      std::vector<truncated_text> search_keywords;
+      for (auto& search_query : search_queries) {
+        debugMessage(party, fmt::format("Keyword: {} (no bucketing)", search_query.keyword_truncated));
+        search_keywords.push_back(
+            truncateCharacters(base64StringToInput(party, search_query.keyword_truncated)));
+      }
+
+      // Decode and initialize the target text, unless the texts were input while the mails were loaded
+      std::vector<truncated_text> target_texts(mail_texts);
+      if (target_texts.empty()) {
+        for (auto& mail : mails) target_texts.push_back(getMailText(party, mail));
+      }
+
+      // Each mail is a single target text
+      std::vector<std::vector<const truncated_text*>> targets;
+      for (auto& target_text : target_texts) targets.push_back({&target_text});
+
+      // Search with the keywords over the target texts (the full keyword is compared at each position)
+      for (std::size_t j = 0; j < search_keywords.size(); j++) {
+        auto search_results_per_keyword =
+            SearchKeyword(search_keywords[j], {}, {}, targets, search_keywords[j].size(), full_zero, options);
+        results_per_keyword.push_back(std::move(search_results_per_keyword));
+      }
+
+      break;
+    }
+    case eHidden: {
+      // Decode and initialize the search keywords (bucketed versions)
+      std::vector<query_input> search_keywords = getBucketedKeywordInput(party, search_queries);
+
+      // Decode and initialize the target text, unless the texts were input while the mails were loaded
+      std::vector<truncated_text> target_texts(mail_texts);
+      if (target_texts.empty()) {
+        for (auto& mail : mails) target_texts.push_back(getMailText(party, mail));
+      }
+
+      // Each mail is a single target text
+      std::vector<std::vector<const truncated_text*>> targets;
+      for (auto& target_text : target_texts) targets.push_back({&target_text});
+
+      // Search with the keywords over the target texts
+      for (std::size_t j = 0; j < search_keywords.size(); j++) {
+        // Search over the target texts with a single keyword (bucketed versions)
+        auto& search_keyword = search_keywords[j];
+
+        // Determine the minimum length of the keyword
+        std::uint32_t min_keyword_length = getMinKeywordLength(search_keyword.bucket_size, bucket_scheme);
+
+        auto search_results_per_keyword = SearchKeyword(truncateCharacters(search_keyword.search_keyword),
+                                                        getIgnoreBits(search_keyword),
+                                                        getDigitClassBits(search_keyword),
+                                                        targets, min_keyword_length, full_zero, options);
+        results_per_keyword.push_back(std::move(search_results_per_keyword));
+      }
+      break;
+    }
+    case eBucket: {
+      // Decode and initialize the search keywords (bucketed versions)
+      std::vector<query_input> search_keywords = getBucketedKeywordInput(party, search_queries);
+
+      // Decode and initialize the buckets for each mail
+      std::vector<std::vector<std::pair<std::uint32_t, truncated_text>>> target_texts;
+      for (auto& mail : mails) {
+        std::vector<std::pair<std::uint32_t, truncated_text>> words;
+        for (auto& bucket : mail.buckets) {
+          for (auto& word : bucket.words) {
+            debugMessage(party, fmt::format("Target word: {} (bucket size: {})", word, bucket.bucket_size));
+            words.emplace_back(bucket.bucket_size,
+                               truncateCharacters(base64StringToInput(party, word)));
+          }
+        }
+        target_texts.push_back(std::move(words));
+      }
+
+      // Search with the keywords over the target texts (bucketed versions)
+      for (std::size_t j = 0; j < search_keywords.size(); j++) {
+        // Search over the target texts with a single keyword (bucketed versions)
+        auto& search_keyword = search_keywords[j];
+
+        // Determine the minimum length of the keyword
+        std::uint32_t min_keyword_length = getMinKeywordLength(search_keyword.bucket_size, bucket_scheme);
+
+        // Each mail is searched over all words of the buckets that are large enough for the keyword
+        std::vector<std::vector<const truncated_text*>> targets(target_texts.size());
+        for (std::size_t i = 0; i < target_texts.size(); i++) {
+          for (auto& [bucket_size, word] : target_texts[i]) {
+            if (bucket_size < search_keyword.bucket_size) continue;
+            targets[i].push_back(&word);
+          }
+        }
+
+        auto search_results_per_keyword = SearchKeyword(truncateCharacters(search_keyword.search_keyword),
+                                                        getIgnoreBits(search_keyword),
+                                                        getDigitClassBits(search_keyword),
+                                                        targets, min_keyword_length, full_zero, options);
+        results_per_keyword.push_back(std::move(search_results_per_keyword));
+      }
+
+      break;
+    }
+    case eIndex: {
+      // Decode and initialize the search keywords (bucketed versions)
+      std::vector<query_input> search_keywords = getBucketedKeywordInput(party, search_queries);
+
+      if (!search_index.posting_classes.empty()) {
+        // The posting lists give the results per mail directly
+        results_per_keyword = SearchPostingLists(party, search_keywords, search_index, full_zero, options);
+        break;
+      }
+
+      // Decode and initialize the buckets for the search index
+      std::vector<std::pair<std::uint32_t, truncated_text>> words;
+      for (auto& bucket : search_index.index_buckets) {
+        for (auto& word_and_occurrence_string : bucket.word_and_occurrence_strings) {
+          auto& word = word_and_occurrence_string.first;
+          debugMessage(party, fmt::format("Target word: {} (bucket size: {})", word, bucket.bucket_size));
+          words.emplace_back(bucket.bucket_size,
+                             truncateCharacters(base64StringToInput(party, word)));
+        }
+      }
+
+      // Search with the keywords over the target texts (bucketed versions)
+      for (std::size_t j = 0; j < search_keywords.size(); j++) {
+        // Search over the target texts with a single keyword (bucketed versions)
+        auto& search_keyword = search_keywords[j];
+
+        // Determine the minimum length of the keyword
+        std::uint32_t min_keyword_length = getMinKeywordLength(search_keyword.bucket_size, bucket_scheme);
+
+        // Each word of the index is a target, skip if the bucket is too small (i.e., impossible to match the keyword)
+        std::vector<std::vector<const truncated_text*>> targets(words.size());
+        for (std::size_t i = 0; i < words.size(); i++) {
+          if (words[i].first < search_keyword.bucket_size) continue;
+          targets[i].push_back(&words[i].second);
+        }
+
+        auto search_results_per_keyword = SearchKeyword(truncateCharacters(search_keyword.search_keyword),
+                                                        getIgnoreBits(search_keyword),
+                                                        getDigitClassBits(search_keyword),
+                                                        targets, min_keyword_length, full_zero, options);
+        assert(search_results_per_keyword.size() == words.size());
+        results_per_keyword.push_back(std::move(search_results_per_keyword));
+      }
+
+      break;
+    }
+    case eNgram: {
+      // Decode and initialize the search keywords (bucketed versions)
+      std::vector<query_input> search_keywords = getBucketedKeywordInput(party, search_queries);
+
+      // Decode and initialize the n-grams of the search index and their occurrence bits (one per mail)
+      std::vector<truncated_text> ngrams;
+      std::vector<std::vector<encrypto::motion::ShareWrapper>> ngram_occurrences;
+      for (auto& [ngram, occurrence_string] : search_index.ngram_and_occurrence_strings) {
+        debugMessage(party, fmt::format("Target n-gram: {}", ngram));
+        ngrams.push_back(truncateCharacters(base64StringToInput(party, ngram)));
+        assert(ngrams.back().size() == kNgramLength);
+
+        auto occurrence_bits =
+            splitTo1bitShareWrappers(base64StringToInput(party, occurrence_string));
+        assert(occurrence_bits.size() >= search_index.num_of_emails);
+        occurrence_bits.resize(search_index.num_of_emails);
+        ngram_occurrences.push_back(std::move(occurrence_bits));
+      }
+
+      if (search_index.num_of_emails == 0) break;
+
+      // Search with the keywords over the n-gram index (bucketed versions), the results are the candidate mails
+      std::vector<std::vector<encrypto::motion::ShareWrapper>> search_results_per_keyword;
+      for (auto& search_keyword : search_keywords) {
+        search_results_per_keyword.push_back(SearchNgramIndex(search_keyword, ngrams, ngram_occurrences,
+                                                              search_index.num_of_emails, full_zero));
+      }
+
+      if (options.candidate_bound > 0) {
+        // Two-stage search: verify the candidates exactly on the truncated blocks of the mails
+        if (mails.size() != search_index.num_of_emails) {
+          throw std::invalid_argument("The two-stage search requires the mails of the search index");
+        }
+        std::vector<truncated_text> target_texts(mail_texts);
+        if (target_texts.empty()) {
+          for (auto& mail : mails) target_texts.push_back(getMailText(party, mail));
+        }
+        search_results_per_keyword = VerifyCandidates(party, search_keywords, target_texts, search_results_per_keyword,
+                                                      bucket_scheme, full_zero, options);
+      }
+
+      results_per_keyword = std::move(search_results_per_keyword);
+
+      break;
+    }
+    case eBloom: {
+      // Decode and initialize the one-hot vectors of the keywords' positions in the Bloom filters, each party
+      // expands its DPF keys locally to its share of them
+      std::vector<std::vector<std::vector<encrypto::motion::ShareWrapper>>> keyword_positions;
+      for (auto& search_query : search_queries) {
+        std::vector<std::vector<encrypto::motion::ShareWrapper>> positions;
+        if (!search_query.keyword_bloom_keys.empty() && party->GetConfiguration()->GetNumOfParties() != 2) {
+          throw std::invalid_argument("Bloom filter position keys require exactly two parties");
+        }
+        for (auto& position_key : search_query.keyword_bloom_keys) {
+          debugMessage(party, fmt::format("Keyword Bloom filter position key: {}", position_key));
+          auto position_share = ExpandDpfKey(simple_base64_decoder(position_key));
+          positions.push_back(splitTo1bitShareWrappers(bytesToInput(party, position_share)));
+        }
+        for (auto& position_string : search_query.keyword_bloom_positions) {
+          debugMessage(party, fmt::format("Keyword Bloom filter position: {}", position_string));
+          positions.push_back(splitTo1bitShareWrappers(base64StringToInput(party, position_string)));
+        }
+        keyword_positions.push_back(std::move(positions));
+      }
+
+      // Decode and initialize the Bloom filter of each mail
+      std::vector<std::vector<encrypto::motion::ShareWrapper>> bloom_filters;
+      for (auto& mail : mails) {
+        debugMessage(party, fmt::format("Target Bloom filter: {}", mail.secret_share_bloom_filter));
+        bloom_filters.push_back(
+            splitTo1bitShareWrappers(base64StringToInput(party, mail.secret_share_bloom_filter)));
+      }
+
+      if (bloom_filters.empty() || keyword_positions.empty()) break;
+
+      // Check the membership of all keywords in the Bloom filters of all mails at once
+      results_per_keyword = SearchBloomFilters(keyword_positions, bloom_filters, full_zero);
+
+      break;
+    }
+    case eDfa: {
+      // Decode and initialize the secret shared DFA of each keyword's regular expression
+      std::vector<dfa_input> patterns = getDfaInput(party, search_queries);
+
+      // Decode and initialize the target text, unless the texts were input while the mails were loaded
+      std::vector<truncated_text> target_texts(mail_texts);
+      if (target_texts.empty()) {
+        for (auto& mail : mails) target_texts.push_back(getMailText(party, mail));
+      }
+
+      // Run the DFAs over the texts of all mails at once
+      results_per_keyword = SearchDfa(patterns, target_texts);
+
+      break;
+    }
+    default: {
+      throw std::invalid_argument("Invalid Search Mode");
+    }
+  }
+
+  return results_per_keyword;
+}
+
+static std::vector<std::vector<encrypto::motion::ShareWrapper>> IndexResultsPerMail(
+    const encrypto::motion::PartyPointer& party,
+    const std::vector<std::vector<encrypto::motion::ShareWrapper>>& word_results_per_keyword,
+    const search_index& search_index,
+    const encrypto::motion::ShareWrapper& full_zero,
+    const search_options& options) {
+  const std::size_t num_of_emails = search_index.num_of_emails;
+  const auto zero_occurrences =
+      encrypto::motion::ShareWrapper::Simdify(std::vector<encrypto::motion::ShareWrapper>(num_of_emails, full_zero));
+
+  // Decode and initialize the occurrence bits (one per mail) of the words of the index, in the order of the words
+  std::vector<std::vector<encrypto::motion::ShareWrapper>> word_occurrences;
+  for (auto& bucket : search_index.index_buckets) {
+    for (auto& [word, occurrence_string] : bucket.word_and_occurrence_strings) {
+      auto occurrence_bits = splitTo1bitShareWrappers(base64StringToInput(party, occurrence_string));
+      assert(occurrence_bits.size() >= num_of_emails);
+      occurrence_bits.resize(num_of_emails);
+      word_occurrences.push_back(std::move(occurrence_bits));
+    }
+  }
+
+  std::vector<std::vector<encrypto::motion::ShareWrapper>> results_per_keyword;
+  for (auto& word_results : word_results_per_keyword) {
+    assert(word_results.size() == word_occurrences.size());
+    if (num_of_emails == 0 || word_results.empty()) {
+      results_per_keyword.push_back(zero_occurrences.Unsimdify());
+      continue;
+    }
+
+    // Select the occurrence bits of the matching words with a single SIMD AND gate
+    std::vector<encrypto::motion::ShareWrapper> lhs, rhs;
+    for (std::size_t w = 0; w < word_results.size(); w++) {
+      lhs.insert(lhs.end(), num_of_emails, word_results[w]);
+      rhs.insert(rhs.end(), word_occurrences[w].begin(), word_occurrences[w].end());
+    }
+    auto selected_occurrences =
+        encrypto::motion::ShareWrapper::Simdify(lhs) & encrypto::motion::ShareWrapper::Simdify(rhs);
+
+    // The keyword may match several words (e.g., as a prefix), so the selected bits are combined with OR gates
+    std::vector<encrypto::motion::ShareWrapper> occurrences_per_word;
+    for (std::size_t w = 0; w < word_results.size(); w++) {
+      std::vector<std::size_t> positions(num_of_emails);
+      std::iota(positions.begin(), positions.end(), w * num_of_emails);
+      occurrences_per_word.push_back(selected_occurrences.Subset(std::move(positions)));
+    }
+    results_per_keyword.push_back(LowDepthReduce(occurrences_per_word, std::bit_or<>()).Unsimdify());
+  }
+  return results_per_keyword;
+}
+
 static encrypto::motion::ShareWrapper CreateChainingCircuit(
     const encrypto::motion::ShareWrapper& previous_search_result,
     const encrypto::motion::ShareWrapper& new_search_result,
@@ -855,3 +2077,37 @@ static encrypto::motion::ShareWrapper CreateChainingCircuit(
       ((previous_search_result ^ OR_BIT) & ((new_search_result ^ NOT_BIT) ^ OR_BIT)) ^ OR_BIT;
   return search_result;
 }
+
+static void ChainKeywordResults(std::vector<encrypto::motion::ShareWrapper>& search_results,
+                                const std::vector<encrypto::motion::ShareWrapper>& keyword_results,
+                                const std::size_t keyword_index,
+                                const std::vector<encrypto::motion::ShareWrapper>& modifier_chain_share_input,
+                                const search_options& options) {
+  assert(search_results.size() == keyword_results.size());
+
+  // Chain the results for each keyword and take NOT if needed
+  if (keyword_index == 0) {
+    // For the first keyword we have nothing to chain
+    for (std::size_t i = 0; i < search_results.size(); i++) {
+      search_results[i] = keyword_results[i] ^ modifier_chain_share_input[0];  // NOT if XORed with 1
+    }
+    return;
+  }
+
+  const auto& OR_BIT = modifier_chain_share_input[2 * keyword_index - 1];
+  const auto& NOT_BIT = modifier_chain_share_input[2 * keyword_index];
+  if (options.coalesce_layers && !search_results.empty()) {
+    // Chain the results of all mails with a single SIMD gate
+    const std::size_t num_of_results = search_results.size();
+    search_results = CreateChainingCircuit(
+        encrypto::motion::ShareWrapper::Simdify(search_results),
+        encrypto::motion::ShareWrapper::Simdify(keyword_results),
+        encrypto::motion::ShareWrapper::Simdify(std::vector<encrypto::motion::ShareWrapper>(num_of_results, OR_BIT)),
+        encrypto::motion::ShareWrapper::Simdify(std::vector<encrypto::motion::ShareWrapper>(num_of_results, NOT_BIT)))
+        .Unsimdify();
+  } else {
+    for (std::size_t i = 0; i < search_results.size(); i++) {
+      search_results[i] = CreateChainingCircuit(search_results[i], keyword_results[i], OR_BIT, NOT_BIT);
+    }
+  }
+}
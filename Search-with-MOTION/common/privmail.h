@@ -24,16 +24,26 @@
 
 #pragma once
 
+#include <memory>
+#include <optional>
+#include <ostream>
+
 #include "base/party.h"
+#include "common/search_circuit.h"
 #include "secure_type/secure_unsigned_integer.h"
 #include "statistics/run_time_statistics.h"
 #include "utility/typedefs.h"
 
+class MailStream;  // See privmail_io.h
+
 enum search_mode_enum {
   eNormal,
   eHidden,
   eBucket,
   eIndex,
+  eNgram,
+  eBloom,
+  eDfa,
   eError,
 };
 
@@ -43,6 +53,18 @@ struct search_query {
   std::string keyword_bucketed;
   std::string keyword_length_mask;
   std::string keyword_truncated;
+  std::vector<std::string> keyword_bloom_positions;  // One-hot vector for each hash function of the Bloom filters
+  std::vector<std::string> keyword_bloom_keys;       // DPF key of each one-hot vector instead (two parties only)
+  std::optional<search_mode_enum> search_mode;       // Overrides the search mode of the query for this keyword
+  std::string keyword_wildcard_mask;                 // Characters that match any character, empty if none
+  std::string keyword_digit_mask;                    // Characters that match any digit, empty if none
+
+  // DFA of a regular expression (see shared.py), the padded numbers of states and classes are public, 0 if none
+  std::uint32_t dfa_num_of_states = 0;
+  std::uint32_t dfa_num_of_classes = 0;
+  std::string keyword_dfa_classes;      // Class of each character, least significant bit first
+  std::string keyword_dfa_transitions;  // Next state of each state and class, least significant bit first
+  std::string keyword_dfa_accepting;    // Bit of each state, set if it is accepting
 };
 
 struct bucket_block {
@@ -55,6 +77,7 @@ struct mail_structure {
   std::string secret_share_block;  // Most likely not needed, but include here for completeness
   std::string secret_share_truncated_block;
   std::vector<bucket_block> buckets;
+  std::string secret_share_bloom_filter;  // Bloom filter of the distinct words, empty if not sent with the mail
 };
 
 struct index_bucket {
@@ -62,15 +85,31 @@ struct index_bucket {
   std::vector<std::pair<std::string, std::string>> word_and_occurrence_strings;
 };
 
+struct posting_class {
+  std::uint32_t num_of_postings;  // Public size class, i.e., the padded number of sequence numbers per posting list
+  std::vector<std::pair<std::string, std::string>> word_and_posting_strings;
+};
+
 struct search_index {
   std::uint32_t num_of_emails;
   std::vector<index_bucket> index_buckets;
+  std::vector<std::pair<std::string, std::string>> ngram_and_occurrence_strings;  // Empty if built without n-grams
+  std::uint32_t posting_bitlen = 0;                                              // Bits per sequence number
+  std::vector<posting_class> posting_classes;  // Empty if built with occurrence strings instead of posting lists
 };
 
 struct query_input {
   std::uint32_t bucket_size;
   std::vector<encrypto::motion::ShareWrapper> search_keyword;
-  std::vector<encrypto::motion::ShareWrapper> length_mask;  // E.g., if the length is 3, this is 1110 0000 000... in binary
+  // E.g., if the length is 3, this is 1110 0000 000... in binary
+  std::vector<encrypto::motion::ShareWrapper> length_mask;
+  std::vector<encrypto::motion::ShareWrapper> wildcard_mask;  // Empty if the keyword has no wildcards
+  std::vector<encrypto::motion::ShareWrapper> digit_mask;     // Empty if the keyword has no digit classes
+};
+
+struct dfa_input {
+  std::size_t num_of_states, num_of_classes;  // Powers of two
+  std::vector<encrypto::motion::ShareWrapper> classes, transitions, accepting;
 };
 
 struct bucket_input {
@@ -78,10 +117,96 @@ struct bucket_input {
   std::vector<std::vector<encrypto::motion::ShareWrapper>> words;
 };
 
+// A text as a list of characters, each split into the bits of the special PrivMail encoding
+using truncated_text = std::vector<std::vector<encrypto::motion::ShareWrapper>>;
+
+struct comparison_batch {
+  // Each slot compares one keyword character to one text character
+  std::vector<std::vector<encrypto::motion::ShareWrapper>> keyword_characters;
+  std::vector<std::vector<encrypto::motion::ShareWrapper>> text_characters;
+  std::vector<encrypto::motion::ShareWrapper> ignore_bits;  // Negated length mask bits, empty if not needed
+  std::vector<encrypto::motion::ShareWrapper> digit_class_bits;  // Digit class mask bits, empty if not needed
+  std::vector<std::size_t> positions_per_group;             // Number of compared text positions per result
+};
+
+struct search_options {
+  // Evaluate each AND/OR layer of all mails with a single SIMD gate, i.e., a single message per party pair
+  // and layer, instead of building the comparison and reduction trees separately for each mail
+  bool coalesce_layers = false;
+
+  // Maximum number of targets (e.g., mails) whose comparisons are coalesced into the same gates, 0 for no limit
+  std::size_t chunk_size = 0;
+
+  // Maximum number of SIMD values of a single coalesced reduction gate, 0 for no limit
+  std::size_t simd_width = 0;
+
+  // Verify the candidates of the n-gram search mode on the full text of at most this many mails, 0 to disable
+  std::size_t candidate_bound = 0;
+
+  // Build the keyword comparisons in the intermediate representation of the circuit (see search_circuit.h), which
+  // eliminates common subexpressions and constants and balances and fuses the AND/OR trees before lowering
+  bool optimize_circuit = false;
+
+  // Build the comparison circuit once for each text length and evaluate it over all mails of that length with SIMD
+  // gates, which suits mails whose truncated blocks are padded to a few length classes
+  bool group_by_length = false;
+
+  // External circuit that replaces the comparison of two characters in the intermediate representation (two inputs
+  // of the character bit length, one output bit), e.g., optimized by a logic minimization tool
+  std::shared_ptr<const bristol_circuit> character_comparison_circuit;
+};
+
+// Constructs the search circuit without running it, e.g., to overlap the construction with other searches
+std::vector<encrypto::motion::ShareWrapper> BuildPrivMailSearch(encrypto::motion::PartyPointer& party,
+                                                                const std::vector<search_query>& search_queries,
+                                                                const std::string& modifier_chain_share,
+                                                                const std::vector<mail_structure>& mails,
+                                                                const search_index& search_index,
+                                                                const std::vector<std::uint32_t> bucket_scheme,
+                                                                const search_mode_enum& search_mode,
+                                                                const search_options& options = search_options());
+
+// Like above, but takes the mails from the stream as they are loaded and appends them to mails. If a keyword searches
+// the texts of the mails, the inputs of each mail's text are created while the next mails are loaded. All parties
+// must use the same variant, since the inputs are created in a different order
+std::vector<encrypto::motion::ShareWrapper> BuildPrivMailSearch(encrypto::motion::PartyPointer& party,
+                                                                const std::vector<search_query>& search_queries,
+                                                                const std::string& modifier_chain_share,
+                                                                MailStream& mail_stream,
+                                                                std::vector<mail_structure>& mails,
+                                                                const search_index& search_index,
+                                                                const std::vector<std::uint32_t> bucket_scheme,
+                                                                const search_mode_enum& search_mode,
+                                                                const search_options& options = search_options());
+
+// Constructs and runs the search circuit
 std::vector<encrypto::motion::ShareWrapper> PrivMailSearch(encrypto::motion::PartyPointer& party,
                                                            const std::vector<search_query>& search_queries,
                                                            const std::string& modifier_chain_share,
                                                            const std::vector<mail_structure>& mails,
                                                            const search_index& search_index,
                                                            const std::vector<std::uint32_t> bucket_scheme,
-                                                           const search_mode_enum& search_mode);
+                                                           const search_mode_enum& search_mode,
+                                                           const search_options& options = search_options());
+
+// Returns this party's XOR shares of the search results after the party ran, the client reconstructs the results
+// from the shares of all parties
+std::vector<bool> GetResultShares(const std::vector<encrypto::motion::ShareWrapper>& search_results);
+
+// Answers a private retrieval request locally, i.e., without a party. Each key is a DPF key (see privmail_dpf.h) that
+// expands to this server's share of a one-hot vector with a bit per sequence number (the most significant bit of the
+// first byte for sequence number 0). The answer to a key is the XOR of the secret share blocks of the selected mails,
+// padded with zeros to the longest block. The client gets the answers of two servers that hold the same share blocks
+// and XORs them to get the wanted block
+std::vector<std::vector<std::uint8_t>> AnswerRetrievalKeys(const std::vector<mail_structure>& mails,
+                                                           const std::vector<std::string>& retrieval_keys);
+
+// Writes the circuit of a search in the normal or hidden search mode (i.e., the keyword comparisons and the chaining
+// of the results) in the Bristol Fashion format. Only the lengths of the queries and mails matter, the input values
+// are each keyword followed by its ignore bits (hidden mode only), then the modifier chain and the mails
+void ExportSearchCircuit(std::ostream& output,
+                         const std::vector<search_query>& search_queries,
+                         const std::vector<mail_structure>& mails,
+                         const std::vector<std::uint32_t> bucket_scheme,
+                         const search_mode_enum& search_mode,
+                         const search_options& options = search_options());
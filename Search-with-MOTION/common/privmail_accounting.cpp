@@ -0,0 +1,110 @@
+// MIT License
+//
+// Copyright (c) 2021 Raine Nieminen
+// Cryptography and Privacy Engineering Group (ENCRYPTO)
+// TU Darmstadt, Germany
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "privmail_accounting.h"
+
+#include <sys/resource.h>
+
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+
+#include <fmt/format.h>
+
+#include "statistics/run_time_statistics.h"
+
+static double cpuSeconds(const int who) {
+  rusage usage;
+  if (getrusage(who, &usage) != 0) return 0;
+  return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+double ThreadCpuSeconds() { return cpuSeconds(RUSAGE_THREAD); }
+
+double ProcessCpuSeconds() { return cpuSeconds(RUSAGE_SELF); }
+
+long PeakMemoryKilobytes() {
+  rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+  return usage.ru_maxrss;
+}
+
+void AddPartyStatistics(accounting_record& record, encrypto::motion::Party& party) {
+  using StatisticsId = encrypto::motion::RunTimeStatistics::StatisticsId;
+  const auto& runtime_statistics = party.GetBackend()->GetRunTimeStatistics();
+  if (!runtime_statistics.empty()) {
+    record.preprocessing_ms = runtime_statistics.front().Get(StatisticsId::kPreprocessing).count();
+    record.gates_setup_ms = runtime_statistics.front().Get(StatisticsId::kGatesSetup).count();
+    record.gates_online_ms = runtime_statistics.front().Get(StatisticsId::kGatesOnline).count();
+  }
+  record.transport_statistics = party.GetCommunicationLayer().GetTransportStatistics();
+}
+
+static std::string jsonString(const std::string& value) {
+  std::string escaped("\"");
+  for (char c : value) {
+    if (c == '"' || c == '\\') {
+      escaped.push_back('\\');
+      escaped.push_back(c);
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      escaped += fmt::format("\\u{:04x}", static_cast<unsigned>(static_cast<unsigned char>(c)));
+    } else {
+      escaped.push_back(c);
+    }
+  }
+  return escaped + "\"";
+}
+
+void AppendAccountingRecord(const std::string& accounting_log_path, const accounting_record& record) {
+  std::string peers;
+  for (auto& transport_statistics : record.transport_statistics) {
+    if (!peers.empty()) peers += ",";
+    peers += fmt::format(
+        "{{\"peer_id\":{},\"bytes_sent\":{},\"bytes_received\":{},\"messages_sent\":{},\"messages_received\":{}}}",
+        transport_statistics.peer_id, transport_statistics.num_bytes_sent, transport_statistics.num_bytes_received,
+        transport_statistics.num_messages_sent, transport_statistics.num_messages_received);
+  }
+
+  // The statistics that the searches of a batch share are grouped as its totals, such that they are not summed
+  // over the searches of the batch
+  std::string line = fmt::format(
+      "{{\"job_id\":{},\"query_uid\":{},\"tenant\":{},\"search_mode\":{},\"num_of_emails\":{},"
+      "\"wall_ms\":{{\"load\":{:.3f}}},\"cpu_s\":{{\"load\":{:.6f}}},"
+      "\"batch\":{{\"batch_id\":{},\"batch_size\":{},"
+      "\"wall_ms\":{{\"construct\":{:.3f},\"run\":{:.3f},\"preprocessing\":{:.3f},"
+      "\"gates_setup\":{:.3f},\"gates_online\":{:.3f}}},"
+      "\"cpu_s\":{{\"construct\":{:.6f},\"run\":{:.6f},\"run_process\":{:.6f}}},\"peers\":[{}]}},"
+      "\"peak_memory_kb\":{}}}",
+      record.job_id, jsonString(record.query_uid), jsonString(record.tenant), jsonString(record.search_mode),
+      record.num_of_emails, record.load_ms, record.load_cpu_s, record.batch_id, record.batch_size,
+      record.construct_ms, record.run_ms, record.preprocessing_ms, record.gates_setup_ms, record.gates_online_ms,
+      record.construct_cpu_s, record.run_cpu_s, record.run_process_cpu_s, peers, record.peak_memory_kb);
+
+  // A single write per record, such that the lines of concurrent searches do not interleave
+  static std::mutex log_mutex;
+  std::scoped_lock lock(log_mutex);
+  std::ofstream log_file(accounting_log_path, std::ios::app);
+  if (!log_file) throw std::runtime_error("Could not open the accounting log " + accounting_log_path);
+  log_file << line << std::endl;
+}
@@ -0,0 +1,73 @@
+// MIT License
+//
+// Copyright (c) 2021 Raine Nieminen
+// Cryptography and Privacy Engineering Group (ENCRYPTO)
+// TU Darmstadt, Germany
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "base/party.h"
+#include "communication/communication_layer.h"
+
+// The resources that a search used, for capacity planning and chargeback
+struct accounting_record {
+  std::size_t job_id = 0;
+  std::string query_uid;
+  std::string tenant;  // Empty if the search did not name one
+  std::string search_mode;
+  std::size_t num_of_emails = 0;
+
+  // Wall and CPU time of loading the inputs of this search
+  double load_ms = 0, load_cpu_s = 0;
+
+  // The searches of a batch are constructed and run in the same party, so the following are totals of the batch,
+  // which the log writes as such instead of attributing them to a single search
+  std::size_t batch_id = 0;
+  std::size_t batch_size = 1;
+
+  // Wall time of constructing and running, and of the phases of the protocol run as MOTION measures them
+  double construct_ms = 0, run_ms = 0;
+  double preprocessing_ms = 0, gates_setup_ms = 0, gates_online_ms = 0;
+
+  // CPU time of the thread of each stage, and of the whole process (including MOTION's threads) during the run
+  double construct_cpu_s = 0, run_cpu_s = 0, run_process_cpu_s = 0;
+
+  // Bytes and messages per peer, the messages bound the number of communication rounds
+  std::vector<encrypto::motion::communication::TransportStatistics> transport_statistics;
+
+  // Peak resident set size of the process up to the end of the search
+  long peak_memory_kb = 0;
+};
+
+double ThreadCpuSeconds();
+
+double ProcessCpuSeconds();
+
+long PeakMemoryKilobytes();
+
+// Copies the run time and communication statistics of the party after it ran
+void AddPartyStatistics(accounting_record& record, encrypto::motion::Party& party);
+
+// Appends the record as a line of JSON to the log, concurrent searches of the process can append to the same log
+void AppendAccountingRecord(const std::string& accounting_log_path, const accounting_record& record);
@@ -0,0 +1,113 @@
+// MIT License
+//
+// Copyright (c) 2021 Raine Nieminen
+// Cryptography and Privacy Engineering Group (ENCRYPTO)
+// TU Darmstadt, Germany
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "privmail_dpf.h"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <stdexcept>
+
+#include <fmt/format.h>
+#include <openssl/evp.h>
+
+// Size of the seeds in the tree and of the output block of each leaf, as in create_dpf_keys
+constexpr std::size_t kDpfSeedLength = 16;
+constexpr std::size_t kDpfLeafBitlen = 128;
+constexpr std::size_t kDpfCorrectionWordLength = kDpfSeedLength + 1;
+constexpr std::size_t kDpfHeaderLength = 5;
+
+using dpf_seed = std::array<std::uint8_t, kDpfSeedLength>;
+
+struct dpf_node {
+  dpf_seed seed;
+  bool control_bit;
+};
+
+static std::array<std::uint8_t, 32> sha256(const std::uint8_t prefix, const dpf_seed& seed) {
+  std::array<std::uint8_t, 1 + kDpfSeedLength> message;
+  message[0] = prefix;
+  std::copy(seed.begin(), seed.end(), message.begin() + 1);
+  std::array<std::uint8_t, 32> digest;
+  if (EVP_Digest(message.data(), message.size(), digest.data(), nullptr, EVP_sha256(), nullptr) != 1) {
+    throw std::runtime_error("Could not compute SHA-256");
+  }
+  return digest;
+}
+
+static void xorSeed(dpf_seed& destination, const std::uint8_t* source) {
+  for (std::size_t i = 0; i < kDpfSeedLength; i++) destination[i] ^= source[i];
+}
+
+std::vector<std::uint8_t> ExpandDpfKey(const std::vector<std::uint8_t>& key) {
+  if (key.size() < kDpfHeaderLength) throw std::invalid_argument("DPF key is too short");
+  const std::size_t size = std::size_t{key[0]} << 24 | std::size_t{key[1]} << 16 | std::size_t{key[2]} << 8 | key[3];
+  std::size_t depth = 0;
+  while ((kDpfLeafBitlen << depth) < size) depth++;
+  if (size == 0 || size % 8 != 0 ||
+      key.size() != kDpfHeaderLength + kDpfSeedLength + depth * kDpfCorrectionWordLength + kDpfLeafBitlen / 8) {
+    throw std::invalid_argument(
+        fmt::format("DPF key of {} bytes does not match its size of {} bits", key.size(), size));
+  }
+
+  // Expand the tree level by level, the children of a node with a set control bit are corrected
+  std::vector<dpf_node> nodes(1);
+  std::copy_n(key.begin() + kDpfHeaderLength, kDpfSeedLength, nodes[0].seed.begin());
+  nodes[0].control_bit = key[4] & 1;
+  auto correction_word = key.begin() + kDpfHeaderLength + kDpfSeedLength;
+  for (std::size_t level = 0; level < depth; level++, correction_word += kDpfCorrectionWordLength) {
+    const std::uint8_t* seed_correction = &*correction_word;
+    const bool control_corrections[2] = {(correction_word[kDpfSeedLength] >> 1 & 1) == 1,
+                                         (correction_word[kDpfSeedLength] & 1) == 1};
+    std::vector<dpf_node> children(2 * nodes.size());
+    for (std::size_t i = 0; i < nodes.size(); i++) {
+      // The last bit of each half of the digest is the control bit of the child, it is cleared in the seed
+      const auto digest = sha256(0, nodes[i].seed);
+      for (std::size_t child = 0; child < 2; child++) {
+        auto& child_node = children[2 * i + child];
+        std::copy_n(digest.begin() + child * kDpfSeedLength, kDpfSeedLength, child_node.seed.begin());
+        child_node.control_bit = child_node.seed.back() & 1;
+        child_node.seed.back() &= 0xFE;
+        if (nodes[i].control_bit) {
+          xorSeed(child_node.seed, seed_correction);
+          child_node.control_bit ^= control_corrections[child];
+        }
+      }
+    }
+    nodes = std::move(children);
+  }
+
+  // Each leaf yields a block of the bit array, the blocks beyond the size are cut off
+  const auto leaf_correction = key.end() - kDpfLeafBitlen / 8;
+  std::vector<std::uint8_t> bit_array;
+  bit_array.reserve(nodes.size() * kDpfLeafBitlen / 8);
+  for (auto& node : nodes) {
+    const auto digest = sha256(1, node.seed);
+    for (std::size_t i = 0; i < kDpfLeafBitlen / 8; i++) {
+      bit_array.push_back(node.control_bit ? digest[i] ^ leaf_correction[i] : digest[i]);
+    }
+  }
+  bit_array.resize(size / 8);
+  return bit_array;
+}
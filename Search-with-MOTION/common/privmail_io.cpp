@@ -0,0 +1,287 @@
+// MIT License
+//
+// Copyright (c) 2021 Raine Nieminen
+// Cryptography and Privacy Engineering Group (ENCRYPTO)
+// TU Darmstadt, Germany
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "privmail_io.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <set>
+#include <stdexcept>
+
+search_mode_enum GetSearchMode(const std::string& in_string) {
+  if (in_string == "normal") return eNormal;
+  if (in_string == "hidden") return eHidden;
+  if (in_string == "bucket") return eBucket;
+  if (in_string == "index") return eIndex;
+  if (in_string == "ngram") return eNgram;
+  if (in_string == "bloom") return eBloom;
+  if (in_string == "dfa") return eDfa;
+  return eError;
+}
+
+std::string GetSearchModeName(const search_mode_enum search_mode) {
+  switch (search_mode) {
+    case eNormal:
+      return "normal";
+    case eHidden:
+      return "hidden";
+    case eBucket:
+      return "bucket";
+    case eIndex:
+      return "index";
+    case eNgram:
+      return "ngram";
+    case eBloom:
+      return "bloom";
+    case eDfa:
+      return "dfa";
+    default:
+      return "error";
+  }
+}
+
+std::uint32_t GetCharacterLengthFromBase64(const std::string& base64_string) {
+  std::size_t num_of_padding_chars = std::count(base64_string.begin(), base64_string.end(), '=');
+  return 3 * (base64_string.length() / 4) - num_of_padding_chars;
+}
+
+std::vector<search_query> SearchQueriesFromFile(const YAML::Node& search_query_yaml_file) {
+  std::vector<search_query> search_queries;
+  // Copy data over to queries
+  for (const auto& query_from_file : search_query_yaml_file["keywords"]) {
+    search_query query;
+    // Skip if 'field' is only item in list
+    if (query_from_file.size() == 1) {
+      continue;
+    }
+    query.keyword = query_from_file["keyword"].as<std::string>();
+    query.bucket_size = query_from_file["keyword_bucket_size"].as<std::uint32_t>();
+    query.keyword_bucketed = query_from_file["keyword_bucketed"].as<std::string>();
+    query.keyword_length_mask = query_from_file["keyword_length_mask"].as<std::string>();
+    query.keyword_truncated = query_from_file["keyword_truncated"].as<std::string>();
+    if (query_from_file["keyword_bloom_positions"]) {
+      query.keyword_bloom_positions = query_from_file["keyword_bloom_positions"].as<std::vector<std::string>>();
+    }
+    if (query_from_file["keyword_bloom_keys"]) {
+      query.keyword_bloom_keys = query_from_file["keyword_bloom_keys"].as<std::vector<std::string>>();
+    }
+    if (query_from_file["keyword_search_mode"]) {
+      auto search_mode = GetSearchMode(query_from_file["keyword_search_mode"].as<std::string>());
+      if (search_mode == eError) throw std::runtime_error("Invalid search mode of keyword " + query.keyword);
+      query.search_mode = search_mode;
+    }
+    if (query_from_file["keyword_wildcard_mask"]) {
+      query.keyword_wildcard_mask = query_from_file["keyword_wildcard_mask"].as<std::string>();
+    }
+    if (query_from_file["keyword_digit_mask"]) {
+      query.keyword_digit_mask = query_from_file["keyword_digit_mask"].as<std::string>();
+    }
+    if (query_from_file["keyword_dfa_num_of_states"]) {
+      query.dfa_num_of_states = query_from_file["keyword_dfa_num_of_states"].as<std::uint32_t>();
+      query.dfa_num_of_classes = query_from_file["keyword_dfa_num_of_classes"].as<std::uint32_t>();
+      query.keyword_dfa_classes = query_from_file["keyword_dfa_classes"].as<std::string>();
+      query.keyword_dfa_transitions = query_from_file["keyword_dfa_transitions"].as<std::string>();
+      query.keyword_dfa_accepting = query_from_file["keyword_dfa_accepting"].as<std::string>();
+    }
+    search_queries.push_back(query);
+  }
+  return search_queries;
+}
+
+static mail_structure mailFromFile(YAML::Node mail_yaml_file, const std::vector<std::uint32_t>& bucket_scheme);
+
+std::vector<mail_structure> MailsFromDirectory(const std::string& mail_directory_path,
+                                               const std::vector<std::uint32_t> bucket_scheme) {
+  std::uint32_t max_seq_number = 0;
+
+  for (auto& file_path : std::filesystem::directory_iterator(mail_directory_path)) {
+    YAML::Node mail_yaml_file = YAML::LoadFile(file_path.path());
+
+    // Update the maximum sequence number
+    if (mail_yaml_file["sequence_number"].as<uint32_t>() > max_seq_number) {
+      max_seq_number = mail_yaml_file["sequence_number"].as<uint32_t>();
+    }
+  }
+
+  std::vector<mail_structure> mails(max_seq_number + 1);
+
+  for (auto& file_path : std::filesystem::directory_iterator(mail_directory_path)) {
+    YAML::Node mail_yaml_file = YAML::LoadFile(file_path.path());
+    std::uint32_t sequence_number = mail_yaml_file["sequence_number"].as<std::uint32_t>();
+    mails[sequence_number] = mailFromFile(mail_yaml_file, bucket_scheme);
+  }
+  return mails;
+}
+
+static mail_structure mailFromFile(YAML::Node mail_yaml_file, const std::vector<std::uint32_t>& bucket_scheme) {
+  // Copy data over to mail
+  mail_structure mail;
+  mail.subject = mail_yaml_file["subject"].as<std::string>();
+  mail.secret_share_block = mail_yaml_file["secret_share_block"].as<std::string>();
+  mail.secret_share_truncated_block = mail_yaml_file["secret_share_truncated_block"].as<std::string>();
+  if (mail_yaml_file["secret_share_bloom_filter"]) {
+    mail.secret_share_bloom_filter = mail_yaml_file["secret_share_bloom_filter"].as<std::string>();
+  }
+
+  for (auto& bucket_size : bucket_scheme) {
+    if (mail_yaml_file["secret_share_bucket_blocks"][bucket_size]) {
+      bucket_block bucket;
+      bucket.bucket_size = bucket_size;
+      bucket.words = mail_yaml_file["secret_share_bucket_blocks"][bucket_size].as<std::vector<std::string>>();
+      mail.buckets.push_back(bucket);
+    }
+  }
+  return mail;
+}
+
+MailStream::MailStream(const std::string& mail_directory_path, const std::vector<std::uint32_t>& bucket_scheme)
+    : loader_([this, mail_directory_path, bucket_scheme]() {
+        try {
+          std::set<std::uint32_t> sequence_numbers;
+          for (auto& file_path : std::filesystem::directory_iterator(mail_directory_path)) {
+            YAML::Node mail_yaml_file = YAML::LoadFile(file_path.path());
+            std::uint32_t sequence_number = mail_yaml_file["sequence_number"].as<std::uint32_t>();
+            // MailsFromDirectory keeps the file that the directory lists last, but the first one may already be
+            // handed out here, so duplicates are an error instead
+            if (!sequence_numbers.insert(sequence_number).second) {
+              throw std::runtime_error("Duplicate sequence number " + std::to_string(sequence_number) + " in " +
+                                       file_path.path().string());
+            }
+            auto mail = mailFromFile(mail_yaml_file, bucket_scheme);
+
+            std::scoped_lock lock(mutex_);
+            if (stopped_) return;
+            loaded_mails_[sequence_number] = std::move(mail);
+            loaded_.notify_one();
+          }
+        } catch (...) {
+          std::scoped_lock lock(mutex_);
+          error_ = std::current_exception();
+        }
+        std::scoped_lock lock(mutex_);
+        done_ = true;
+        loaded_.notify_one();
+      }) {}
+
+MailStream::~MailStream() {
+  {
+    std::scoped_lock lock(mutex_);
+    stopped_ = true;
+  }
+  loader_.join();
+}
+
+std::optional<mail_structure> MailStream::Next() {
+  std::unique_lock lock(mutex_);
+  // Until all files are loaded, a missing sequence number may still arrive
+  loaded_.wait(lock, [this] { return done_ || loaded_mails_.count(next_sequence_number_); });
+  if (error_) std::rethrow_exception(error_);
+  if (loaded_mails_.empty()) return std::nullopt;
+
+  // Like MailsFromDirectory, the gaps between the sequence numbers are empty mails
+  mail_structure mail;
+  if (auto loaded_mail = loaded_mails_.find(next_sequence_number_); loaded_mail != loaded_mails_.end()) {
+    mail = std::move(loaded_mail->second);
+    loaded_mails_.erase(loaded_mail);
+  }
+  next_sequence_number_++;
+  return mail;
+}
+
+search_index IndexFromFile(const std::string& index_file_path) {
+  search_index search_index;
+  YAML::Node index_yaml_file = YAML::LoadFile(index_file_path);
+
+  search_index.num_of_emails = index_yaml_file["num_of_emails"].as<uint32_t>();
+  for (const auto& bucket : index_yaml_file["INDEX_BUCKETS"]) {
+    index_bucket index;
+    index.bucket_size = bucket.first.as<std::uint32_t>();
+    for (const auto& bucket_item_dict : bucket.second) {
+      for (auto& bucket_item : bucket_item_dict) {
+        std::string word = bucket_item.first.as<std::string>();
+        std::string occurrence_string = bucket_item.second.as<std::string>();
+        index.word_and_occurrence_strings.push_back(std::make_pair(word, occurrence_string));
+      }
+    }
+    search_index.index_buckets.push_back(index);
+  }
+
+  // The n-gram index is optional
+  for (const auto& ngram_item_dict : index_yaml_file["NGRAM_INDEX"]) {
+    for (auto& ngram_item : ngram_item_dict) {
+      search_index.ngram_and_occurrence_strings.push_back(
+          std::make_pair(ngram_item.first.as<std::string>(), ngram_item.second.as<std::string>()));
+    }
+  }
+
+  // The posting lists are optional, they replace the occurrence strings of the words
+  if (index_yaml_file["posting_bitlen"]) {
+    search_index.posting_bitlen = index_yaml_file["posting_bitlen"].as<std::uint32_t>();
+  }
+  for (const auto& size_class : index_yaml_file["POSTING_LISTS"]) {
+    posting_class postings;
+    postings.num_of_postings = size_class.first.as<std::uint32_t>();
+    for (const auto& posting_item_dict : size_class.second) {
+      for (auto& posting_item : posting_item_dict) {
+        postings.word_and_posting_strings.push_back(
+            std::make_pair(posting_item.first.as<std::string>(), posting_item.second.as<std::string>()));
+      }
+    }
+    search_index.posting_classes.push_back(postings);
+  }
+  return search_index;
+}
+
+std::vector<std::string> RetrievalKeysFromFile(const std::string& retrieval_key_file_path) {
+  YAML::Node retrieval_key_yaml_file = YAML::LoadFile(retrieval_key_file_path);
+  return retrieval_key_yaml_file["retrieval_keys"].as<std::vector<std::string>>();
+}
+
+static std::string simple_base64_encoder(const std::vector<std::uint8_t>& data) {
+  const static std::string base64_chars =
+      "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+      "abcdefghijklmnopqrstuvwxyz"
+      "0123456789+/";
+  std::string encoded;
+  for (std::size_t i = 0; i < data.size(); i += 3) {
+    std::uint32_t bit_stream = data[i] << 16;
+    if (i + 1 < data.size()) bit_stream |= data[i + 1] << 8;
+    if (i + 2 < data.size()) bit_stream |= data[i + 2];
+    encoded.push_back(base64_chars[bit_stream >> 18 & 0x3f]);
+    encoded.push_back(base64_chars[bit_stream >> 12 & 0x3f]);
+    encoded.push_back(i + 1 < data.size() ? base64_chars[bit_stream >> 6 & 0x3f] : '=');
+    encoded.push_back(i + 2 < data.size() ? base64_chars[bit_stream & 0x3f] : '=');
+  }
+  return encoded;
+}
+
+void WriteRetrievalAnswers(std::ostream& output, const std::vector<std::vector<std::uint8_t>>& answers) {
+  YAML::Emitter answer_yaml;
+  answer_yaml << YAML::BeginMap;
+  answer_yaml << YAML::Key << "retrieval_answers" << YAML::Value << YAML::BeginSeq;
+  for (auto& answer : answers) answer_yaml << simple_base64_encoder(answer);
+  answer_yaml << YAML::EndSeq;
+  answer_yaml << YAML::EndMap;
+  output << answer_yaml.c_str() << std::endl;
+}
@@ -0,0 +1,81 @@
+// MIT License
+//
+// Copyright (c) 2021 Raine Nieminen
+// Cryptography and Privacy Engineering Group (ENCRYPTO)
+// TU Darmstadt, Germany
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include <condition_variable>
+#include <exception>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <yaml-cpp/yaml.h>
+
+#include "common/privmail.h"
+
+// Loaders for the files that the PrivMail scripts and the SMTP server produce. Services that keep the inputs in
+// memory can skip them and pass the structures to PrivMailSearch directly
+
+search_mode_enum GetSearchMode(const std::string& in_string);
+
+// The inverse of GetSearchMode, "error" for eError
+std::string GetSearchModeName(const search_mode_enum search_mode);
+
+std::uint32_t GetCharacterLengthFromBase64(const std::string& base64_string);
+
+std::vector<search_query> SearchQueriesFromFile(const YAML::Node& search_query_yaml_file);
+
+std::vector<mail_structure> MailsFromDirectory(const std::string& mail_directory_path,
+                                               const std::vector<std::uint32_t> bucket_scheme);
+
+// Loads the mails of a directory in a background thread and hands them out in the order of their sequence numbers,
+// such that the search can be constructed while the remaining mails are loaded (see BuildPrivMailSearch)
+class MailStream {
+ public:
+  MailStream(const std::string& mail_directory_path, const std::vector<std::uint32_t>& bucket_scheme);
+  ~MailStream();
+
+  // Returns the mail with the next sequence number, waiting for it to be loaded, and nothing after the last mail.
+  // Rethrows the error of the loader thread, e.g., if two files have the same sequence number
+  std::optional<mail_structure> Next();
+
+ private:
+  std::map<std::uint32_t, mail_structure> loaded_mails_;  // Loaded, but not handed out yet
+  std::uint32_t next_sequence_number_ = 0;
+  bool done_ = false, stopped_ = false;
+  std::exception_ptr error_;
+  std::mutex mutex_;
+  std::condition_variable loaded_;
+  std::thread loader_;  // Last, such that the other members exist when it starts
+};
+
+search_index IndexFromFile(const std::string& index_file_path);
+
+std::vector<std::string> RetrievalKeysFromFile(const std::string& retrieval_key_file_path);
+
+void WriteRetrievalAnswers(std::ostream& output, const std::vector<std::vector<std::uint8_t>>& answers);
@@ -0,0 +1,208 @@
+// MIT License
+//
+// Copyright (c) 2021 Raine Nieminen
+// Cryptography and Privacy Engineering Group (ENCRYPTO)
+// TU Darmstadt, Germany
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "privmail_metrics.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+#include <fmt/format.h>
+
+#include "common/privmail_io.h"
+
+template <std::size_t N, typename Histogram>
+static void observe(Histogram& histogram, const std::array<double, N>& bounds, const double value) {
+  std::size_t bucket = 0;
+  while (bucket < N && value > bounds[bucket]) bucket++;
+  histogram.counts[bucket].fetch_add(1, std::memory_order_relaxed);
+  histogram.sum.fetch_add(static_cast<std::uint64_t>(value * 1e3), std::memory_order_relaxed);
+}
+
+template <std::size_t N, typename Histogram>
+static void renderHistogram(std::string& out, const std::string& name, const std::string& help,
+                            const Histogram& histogram, const std::array<double, N>& bounds, const double scale) {
+  out += fmt::format("# HELP {} {}\n# TYPE {} histogram\n", name, help, name);
+  std::uint64_t cumulative_count = 0;
+  for (std::size_t bucket = 0; bucket <= N; bucket++) {
+    cumulative_count += histogram.counts[bucket].load(std::memory_order_relaxed);
+    const std::string bound = bucket < N ? fmt::format("{}", bounds[bucket] * scale) : "+Inf";
+    out += fmt::format("{}_bucket{{le=\"{}\"}} {}\n", name, bound, cumulative_count);
+  }
+  out += fmt::format("{}_sum {}\n", name, histogram.sum.load(std::memory_order_relaxed) * 1e-3 * scale);
+  out += fmt::format("{}_count {}\n", name, cumulative_count);
+}
+
+void SearchMetrics::SearchFinished(const search_mode_enum search_mode, const bool failed, const double latency_ms,
+                                   const std::uint64_t bytes) {
+  searches_[std::min<std::size_t>(search_mode, eError)][failed].fetch_add(1, std::memory_order_relaxed);
+  searches_in_flight_.fetch_sub(1, std::memory_order_relaxed);
+  observe(latency_ms_, kLatencyBucketsMs, latency_ms);
+  if (!failed) observe(bytes_, kByteBuckets, static_cast<double>(bytes));
+}
+
+std::string SearchMetrics::Render() const {
+  std::string out;
+  out += "# HELP privmail_searches_total Finished searches by search mode and status.\n"
+         "# TYPE privmail_searches_total counter\n";
+  for (std::size_t mode = 0; mode < kNumOfModes; mode++) {
+    const std::string mode_name = GetSearchModeName(static_cast<search_mode_enum>(mode));
+    out += fmt::format("privmail_searches_total{{mode=\"{}\",status=\"ok\"}} {}\n", mode_name,
+                       searches_[mode][0].load(std::memory_order_relaxed));
+    out += fmt::format("privmail_searches_total{{mode=\"{}\",status=\"failed\"}} {}\n", mode_name,
+                       searches_[mode][1].load(std::memory_order_relaxed));
+  }
+  renderHistogram(out, "privmail_search_latency_seconds",
+                  "Time from reading a search request until its result shares are written.", latency_ms_,
+                  kLatencyBucketsMs, 1e-3);
+  renderHistogram(out, "privmail_search_bytes",
+                  "Bytes sent and received over all peers by the party of a successful search's batch.", bytes_,
+                  kByteBuckets, 1);
+  out += fmt::format(
+      "# HELP privmail_queued_requests Search requests read but not loaded yet.\n"
+      "# TYPE privmail_queued_requests gauge\n"
+      "privmail_queued_requests {}\n"
+      "# HELP privmail_searches_in_flight Searches loaded but not finished yet.\n"
+      "# TYPE privmail_searches_in_flight gauge\n"
+      "privmail_searches_in_flight {}\n"
+      "# HELP privmail_party_connections_total Parties that connected to all other parties for a batch.\n"
+      "# TYPE privmail_party_connections_total counter\n"
+      "privmail_party_connections_total {}\n"
+      "# HELP privmail_party_connection_failures_total Parties that failed to connect for a batch.\n"
+      "# TYPE privmail_party_connection_failures_total counter\n"
+      "privmail_party_connection_failures_total {}\n",
+      queued_requests_.load(std::memory_order_relaxed), searches_in_flight_.load(std::memory_order_relaxed),
+      party_connections_.load(std::memory_order_relaxed),
+      party_connection_failures_.load(std::memory_order_relaxed));
+  return out;
+}
+
+MetricsExporter::MetricsExporter(const SearchMetrics& metrics, std::string file_path, const std::uint16_t port,
+                                 const double interval_s)
+    : metrics_(metrics), file_path_(std::move(file_path)), interval_s_(interval_s) {
+  if (interval_s_ <= 0) throw std::invalid_argument("The metrics interval must be positive");
+
+  if (port != 0) {
+    // Only the loopback interface, the metrics are not meant to leave the host
+    const int server_socket = socket(AF_INET, SOCK_STREAM, 0);
+    if (server_socket < 0) {
+      throw std::runtime_error(fmt::format("Creating the metrics socket failed: {}", strerror(errno)));
+    }
+    const int reuse = 1;
+    setsockopt(server_socket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(server_socket, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+        listen(server_socket, 8) != 0) {
+      const std::string error = strerror(errno);
+      close(server_socket);
+      throw std::runtime_error(fmt::format("Serving the metrics on port {} failed: {}", port, error));
+    }
+    http_server_ = std::thread([this, server_socket]() { serve(server_socket); });
+  }
+
+  if (!file_path_.empty()) {
+    file_writer_ = std::thread([this]() {
+      std::unique_lock lock(mutex_);
+      do {
+        lock.unlock();
+        writeFile();
+        lock.lock();
+      } while (!stop_.wait_for(lock, std::chrono::duration<double>(interval_s_), [this] { return stopped_; }));
+    });
+  }
+}
+
+MetricsExporter::~MetricsExporter() {
+  {
+    std::scoped_lock lock(mutex_);
+    stopped_ = true;
+  }
+  stop_.notify_all();
+  if (file_writer_.joinable()) file_writer_.join();
+  if (http_server_.joinable()) http_server_.join();
+
+  // The final values, e.g., of a server whose requests ended
+  if (!file_path_.empty()) writeFile();
+}
+
+void MetricsExporter::writeFile() {
+  // Scrapers must never read a partly written file
+  const std::string temporary_path = file_path_ + ".tmp";
+  {
+    std::ofstream metrics_file(temporary_path, std::ios::trunc);
+    metrics_file << metrics_.Render();
+    if (!metrics_file) {
+      std::cerr << fmt::format("Writing the metrics to {} failed", temporary_path) << std::endl;
+      return;
+    }
+  }
+  if (std::rename(temporary_path.c_str(), file_path_.c_str()) != 0) {
+    std::cerr << fmt::format("Replacing the metrics in {} failed: {}", file_path_, strerror(errno)) << std::endl;
+  }
+}
+
+void MetricsExporter::serve(const int server_socket) {
+  // Poll with a timeout to notice the stop, every request gets the metrics regardless of its path
+  constexpr int kPollTimeoutMs = 200;
+  for (;;) {
+    {
+      std::scoped_lock lock(mutex_);
+      if (stopped_) break;
+    }
+    pollfd server_poll{server_socket, POLLIN, 0};
+    if (poll(&server_poll, 1, kPollTimeoutMs) <= 0) continue;
+    const int client_socket = accept(server_socket, nullptr, nullptr);
+    if (client_socket < 0) continue;
+
+    // Read (and ignore) the request before answering, such that the client does not get a reset
+    char request[1024];
+    pollfd client_poll{client_socket, POLLIN, 0};
+    if (poll(&client_poll, 1, kPollTimeoutMs) > 0) recv(client_socket, request, sizeof(request), 0);
+
+    const std::string body = metrics_.Render();
+    const std::string response = fmt::format(
+        "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: {}\r\n"
+        "Connection: close\r\n\r\n{}",
+        body.size(), body);
+    for (std::size_t sent = 0; sent < response.size();) {
+      const ssize_t n = send(client_socket, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+      if (n <= 0) break;
+      sent += n;
+    }
+    close(client_socket);
+  }
+  close(server_socket);
+}
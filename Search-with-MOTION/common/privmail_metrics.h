@@ -0,0 +1,89 @@
+// MIT License
+//
+// Copyright (c) 2021 Raine Nieminen
+// Cryptography and Privacy Engineering Group (ENCRYPTO)
+// TU Darmstadt, Germany
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "common/privmail.h"
+
+// Counters and histograms of a long-running search server. The stages update them without locks, only the exposition
+// in the Prometheus text format reads them all
+class SearchMetrics {
+ public:
+  void RequestQueued() { queued_requests_.fetch_add(1, std::memory_order_relaxed); }
+  void RequestLoaded() { queued_requests_.fetch_sub(1, std::memory_order_relaxed); }
+  void PartyConnected() { party_connections_.fetch_add(1, std::memory_order_relaxed); }
+  void PartyConnectionFailed() { party_connection_failures_.fetch_add(1, std::memory_order_relaxed); }
+  void SearchStarted() { searches_in_flight_.fetch_add(1, std::memory_order_relaxed); }
+
+  // Counts the finished search by its mode and status and adds its latency and bytes to the histograms
+  void SearchFinished(const search_mode_enum search_mode, const bool failed, const double latency_ms,
+                      const std::uint64_t bytes);
+
+  std::string Render() const;
+
+ private:
+  static constexpr std::size_t kNumOfModes = eError + 1;  // The searches that failed to load have no mode (eError)
+  static constexpr std::array<double, 10> kLatencyBucketsMs{10, 50, 100, 250, 500, 1000, 2500, 5000, 10000, 30000};
+  static constexpr std::array<double, 8> kByteBuckets{1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11};
+
+  template <std::size_t N>
+  struct histogram {
+    std::array<std::atomic<std::uint64_t>, N + 1> counts{};  // Per bucket (not cumulative), the last one is +Inf
+    std::atomic<std::uint64_t> sum{0};                       // In thousandths of the unit of the histogram
+  };
+
+  std::array<std::array<std::atomic<std::uint64_t>, 2>, kNumOfModes> searches_{};  // Per mode, ok and failed
+  std::atomic<std::int64_t> queued_requests_{0}, searches_in_flight_{0};
+  std::atomic<std::uint64_t> party_connections_{0}, party_connection_failures_{0};
+  histogram<kLatencyBucketsMs.size()> latency_ms_;
+  histogram<kByteBuckets.size()> bytes_;
+};
+
+// Exposes the metrics in the Prometheus text format, rewritten to a file (replaced atomically) every interval and/or
+// served over HTTP on a port of the loopback interface, until it is destroyed
+class MetricsExporter {
+ public:
+  MetricsExporter(const SearchMetrics& metrics, std::string file_path, std::uint16_t port, double interval_s);
+  ~MetricsExporter();
+
+ private:
+  void writeFile();
+  void serve(int server_socket);
+
+  const SearchMetrics& metrics_;
+  std::string file_path_;  // Empty if not written to a file
+  double interval_s_;
+  bool stopped_ = false;
+  std::mutex mutex_;
+  std::condition_variable stop_;
+  std::thread file_writer_, http_server_;
+};
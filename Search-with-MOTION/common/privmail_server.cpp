@@ -0,0 +1,483 @@
+// MIT License
+//
+// Copyright (c) 2021 Raine Nieminen
+// Cryptography and Privacy Engineering Group (ENCRYPTO)
+// TU Darmstadt, Germany
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "privmail_server.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+
+#include <fmt/format.h>
+#include <yaml-cpp/yaml.h>
+
+#include "protocols/share_wrapper.h"
+#include "utility/bit_vector.h"
+
+// Batches wait between the stages in queues of this capacity, which determines how many batches have a party
+// (i.e., open connections) at the same time: one being constructed, the queued ones, and one running
+constexpr std::size_t kQueueCapacity = 1;
+constexpr std::size_t kNumOfSlots = kQueueCapacity + 2;
+
+// The parties agree on the size of each batch over the ports of this slot
+constexpr std::size_t kBatchSizeSlot = kNumOfSlots;
+
+// Each replica of the search pipeline uses its own range of slots, the router the slot after the last range
+constexpr std::size_t kSlotsPerReplica = kBatchSizeSlot + 1;
+
+// The router assigns the requests that are queued when it gets to them together, at most this many at once
+constexpr std::size_t kMaxRoutedRequests = 64;
+
+template <typename T>
+class BlockingQueue {
+ public:
+  explicit BlockingQueue(std::size_t capacity) : capacity_(capacity) {}
+
+  void Push(T item) {
+    std::unique_lock lock(mutex_);
+    not_full_.wait(lock, [this] { return queue_.size() < capacity_; });
+    queue_.push_back(std::move(item));
+    not_empty_.notify_one();
+  }
+
+  // Returns nothing if the queue is closed and empty
+  std::optional<T> Pop() { return PopUntil(std::chrono::steady_clock::time_point::max()); }
+
+  // Like Pop, but also returns nothing if no item arrived until the deadline
+  std::optional<T> PopUntil(const std::chrono::steady_clock::time_point& deadline) {
+    std::unique_lock lock(mutex_);
+    auto ready = [this] { return !queue_.empty() || closed_; };
+    if (deadline == std::chrono::steady_clock::time_point::max()) {
+      not_empty_.wait(lock, ready);
+    } else {
+      not_empty_.wait_until(lock, deadline, ready);
+    }
+    if (queue_.empty()) return std::nullopt;
+    T item = std::move(queue_.front());
+    queue_.pop_front();
+    not_full_.notify_one();
+    return item;
+  }
+
+  void Close() {
+    std::scoped_lock lock(mutex_);
+    closed_ = true;
+    not_empty_.notify_all();
+  }
+
+ private:
+  std::size_t capacity_;
+  std::deque<T> queue_;
+  bool closed_ = false;
+  std::mutex mutex_;
+  std::condition_variable not_empty_, not_full_;
+};
+
+struct search_request {
+  std::size_t job_id = 0;
+  std::chrono::steady_clock::time_point arrival_time;
+  std::string line;
+};
+
+struct search_batch {
+  std::size_t batch_id = 0;
+  std::vector<search_job> jobs;
+  encrypto::motion::PartyPointer party;
+};
+
+static double elapsedMilliseconds(const std::chrono::steady_clock::time_point& start);
+
+static std::size_t agreeOnValue(const std::function<encrypto::motion::PartyPointer(std::size_t)>& create_party,
+                                const std::size_t slot, const std::size_t value);
+
+static std::vector<std::size_t> agreeOnValues(
+    const std::function<encrypto::motion::PartyPointer(std::size_t)>& create_party, const std::size_t slot,
+    const std::vector<std::size_t>& values);
+
+static void writeResultShares(const search_job& job);
+
+static void logJob(const search_job& job, const search_batch& batch);
+
+// Runs the load, construct, run and output stages for the requests of the queue until it is closed, the parties of
+// the pipeline use the slots from first_slot on
+static void runSearchPipeline(BlockingQueue<search_request>& request_lines,
+                              const std::function<search_job(const std::string&)>& load_job,
+                              const std::function<encrypto::motion::PartyPointer(std::size_t)>& create_party,
+                              const search_options& options, const server_options& server_options,
+                              const std::size_t first_slot, const std::function<void(const search_job&)>& job_done);
+
+void RunSearchServer(std::istream& requests,
+                     const std::function<search_job(const std::string&)>& load_job,
+                     const std::function<encrypto::motion::PartyPointer(std::size_t)>& create_party,
+                     const search_options& options, const server_options& server_options) {
+  if (server_options.max_batch_size == 0) throw std::invalid_argument("The maximum batch size must be at least 1");
+  if (server_options.num_of_replicas == 0) throw std::invalid_argument("The number of replicas must be at least 1");
+
+  BlockingQueue<search_request> request_lines(std::numeric_limits<std::size_t>::max());
+
+  // Read the requests as they arrive, such that the load stage can wait for them with a timeout
+  std::thread read_stage([&]() {
+    std::size_t job_id = 0;
+    for (std::string request; std::getline(requests, request);) {
+      if (request.empty()) continue;
+      if (server_options.metrics) server_options.metrics->RequestQueued();
+      request_lines.Push({job_id++, std::chrono::steady_clock::now(), std::move(request)});
+    }
+    request_lines.Close();
+  });
+
+  if (server_options.num_of_replicas == 1) {
+    runSearchPipeline(request_lines, load_job, create_party, options, server_options, 0, [](const search_job&) {});
+    read_stage.join();
+    return;
+  }
+
+  // The searches that each replica has been assigned but not finished yet
+  const std::size_t num_of_replicas = server_options.num_of_replicas;
+  std::vector<std::atomic<std::size_t>> in_flight(num_of_replicas);
+  std::vector<std::unique_ptr<BlockingQueue<search_request>>> replica_requests;
+  std::vector<std::thread> replicas;
+  for (std::size_t replica = 0; replica < num_of_replicas; replica++) {
+    replica_requests.push_back(
+        std::make_unique<BlockingQueue<search_request>>(std::numeric_limits<std::size_t>::max()));
+  }
+  for (std::size_t replica = 0; replica < num_of_replicas; replica++) {
+    replicas.emplace_back([&, replica]() {
+      runSearchPipeline(*replica_requests[replica], load_job, create_party, options, server_options,
+                        replica * kSlotsPerReplica, [&in_flight, replica](const search_job&) { in_flight[replica]--; });
+    });
+  }
+
+  // Route the queued requests together, each to the replica that is least loaded after the previous ones were
+  // assigned. The loads and queued requests may differ between the parties, so all take the number of requests and
+  // the replicas that party 0 chose, which keeps the replicas of the parties paired. This costs one round per group
+  // of requests, and a single request only if the replicas keep up with the arrivals
+  std::deque<search_request> pending_requests;
+  for (std::size_t group_id = 0;; group_id++) {
+    if (pending_requests.empty()) {
+      auto request = request_lines.Pop();
+      if (!request) break;
+      pending_requests.push_back(std::move(*request));
+    }
+    const auto now = std::chrono::steady_clock::now();
+    while (pending_requests.size() < kMaxRoutedRequests) {
+      auto request = request_lines.PopUntil(now);
+      if (!request) break;
+      pending_requests.push_back(std::move(*request));
+    }
+
+    // The first value is the number of routed requests, followed by the replica of each of them
+    std::vector<std::size_t> routing(kMaxRoutedRequests + 1, 0);
+    routing[0] = pending_requests.size();
+    std::vector<std::size_t> loads(in_flight.begin(), in_flight.end());
+    for (std::size_t i = 0; i < pending_requests.size(); i++) {
+      const auto least_loaded = static_cast<std::size_t>(std::min_element(loads.begin(), loads.end()) - loads.begin());
+      routing[i + 1] = least_loaded;
+      loads[least_loaded]++;
+    }
+    try {
+      routing = agreeOnValues(create_party, num_of_replicas * kSlotsPerReplica, routing);
+    } catch (const std::exception& e) {
+      std::cerr << fmt::format("Agreeing on the replicas of group {} failed: {}", group_id, e.what()) << std::endl;
+      break;
+    }
+    if (routing[0] == 0 || routing[0] > kMaxRoutedRequests) {
+      std::cerr << fmt::format("Party 0 routed {} requests in group {}", routing[0], group_id) << std::endl;
+      break;
+    }
+
+    while (pending_requests.size() < routing[0]) {
+      auto request = request_lines.Pop();
+      if (!request) break;
+      pending_requests.push_back(std::move(*request));
+    }
+    const std::size_t group_size = std::min(routing[0], pending_requests.size());
+    const auto last = routing.begin() + 1 + group_size;
+    if (auto invalid = std::find_if(routing.begin() + 1, last, [&](auto r) { return r >= num_of_replicas; });
+        invalid != last) {
+      std::cerr << fmt::format("Party 0 chose replica {} of only {}", *invalid, num_of_replicas) << std::endl;
+      break;
+    }
+    for (auto replica = routing.begin() + 1; replica != last; replica++) {
+      in_flight[*replica]++;
+      replica_requests[*replica]->Push(std::move(pending_requests.front()));
+      pending_requests.pop_front();
+    }
+  }
+
+  for (auto& requests_of_replica : replica_requests) requests_of_replica->Close();
+  for (auto& replica : replicas) replica.join();
+  read_stage.join();
+}
+
+static void runSearchPipeline(BlockingQueue<search_request>& request_lines,
+                              const std::function<search_job(const std::string&)>& load_job,
+                              const std::function<encrypto::motion::PartyPointer(std::size_t)>& create_party,
+                              const search_options& options, const server_options& server_options,
+                              const std::size_t first_slot, const std::function<void(const search_job&)>& job_done) {
+  BlockingQueue<search_batch> loaded_batches(kQueueCapacity), constructed_batches(kQueueCapacity),
+      finished_batches(kQueueCapacity);
+
+  // A failed stage is recorded in the job, which still passes the following stages to keep the order of the jobs
+  std::thread load_stage([&]() {
+    std::deque<search_request> pending_requests;
+    const auto window = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<double, std::milli>(server_options.coalescing_window_ms));
+    for (std::size_t batch_id = 0;; batch_id++) {
+      if (pending_requests.empty()) {
+        auto request = request_lines.Pop();
+        if (!request) break;
+        pending_requests.push_back(std::move(*request));
+      }
+
+      // Hold the batch open for the window after its first request
+      std::size_t batch_size = std::min(pending_requests.size(), server_options.max_batch_size);
+      if (server_options.max_batch_size > 1) {
+        const auto deadline = std::chrono::steady_clock::now() + window;
+        while (pending_requests.size() < server_options.max_batch_size) {
+          auto request = request_lines.PopUntil(deadline);
+          if (!request) break;
+          pending_requests.push_back(std::move(*request));
+        }
+
+        // The requests may arrive at different times at each party, so all take the batch size of party 0
+        batch_size = std::min(pending_requests.size(), server_options.max_batch_size);
+        try {
+          batch_size = agreeOnValue(create_party, first_slot + kBatchSizeSlot, batch_size);
+        } catch (const std::exception& e) {
+          std::cerr << fmt::format("Agreeing on the size of batch {} failed: {}", batch_id, e.what()) << std::endl;
+          break;
+        }
+        while (pending_requests.size() < batch_size) {
+          auto request = request_lines.Pop();
+          if (!request) break;
+          pending_requests.push_back(std::move(*request));
+        }
+        batch_size = std::min(batch_size, pending_requests.size());
+      }
+
+      search_batch batch;
+      batch.batch_id = batch_id;
+      for (std::size_t i = 0; i < batch_size; i++) {
+        auto start = std::chrono::steady_clock::now();
+        const double start_cpu_s = ThreadCpuSeconds();
+        search_job job;
+        try {
+          job = load_job(pending_requests.front().line);
+        } catch (const std::exception& e) {
+          job.search_mode = eError;
+          job.error = e.what();
+        }
+        job.job_id = pending_requests.front().job_id;
+        job.arrival_time = pending_requests.front().arrival_time;
+        pending_requests.pop_front();
+        if (server_options.metrics) {
+          server_options.metrics->RequestLoaded();
+          server_options.metrics->SearchStarted();
+        }
+        job.accounting.job_id = job.job_id;
+        job.accounting.batch_id = batch_id;
+        job.accounting.batch_size = batch_size;
+        job.accounting.num_of_emails = job.mails->empty() ? job.index->num_of_emails : job.mails->size();
+        job.accounting.load_ms = elapsedMilliseconds(start);
+        job.accounting.load_cpu_s = ThreadCpuSeconds() - start_cpu_s;
+        batch.jobs.push_back(std::move(job));
+      }
+      loaded_batches.Push(std::move(batch));
+    }
+    loaded_batches.Close();
+  });
+
+  std::thread construct_stage([&]() {
+    while (auto batch = loaded_batches.Pop()) {
+      auto start = std::chrono::steady_clock::now();
+      const double start_cpu_s = ThreadCpuSeconds();
+      try {
+        batch->party = create_party(first_slot + batch->batch_id % kNumOfSlots);
+        if (server_options.metrics) server_options.metrics->PartyConnected();
+      } catch (const std::exception& e) {
+        if (server_options.metrics) server_options.metrics->PartyConnectionFailed();
+        for (auto& job : batch->jobs) {
+          if (job.error.empty()) job.error = e.what();
+        }
+      }
+      // The circuits of all jobs are added to the same party, their gates are evaluated in the same rounds
+      for (auto& job : batch->jobs) {
+        if (!job.error.empty()) continue;
+        try {
+          job.search_results = BuildPrivMailSearch(batch->party, job.search_queries, job.modifier_chain_share,
+                                                   *job.mails, *job.index, job.bucket_scheme, job.search_mode,
+                                                   options);
+        } catch (const std::exception& e) {
+          job.search_results.clear();
+          job.error = e.what();
+        }
+      }
+      for (auto& job : batch->jobs) {
+        job.accounting.construct_ms = elapsedMilliseconds(start);
+        job.accounting.construct_cpu_s = ThreadCpuSeconds() - start_cpu_s;
+      }
+      constructed_batches.Push(std::move(*batch));
+    }
+    constructed_batches.Close();
+  });
+
+  std::thread run_stage([&]() {
+    while (auto batch = constructed_batches.Pop()) {
+      auto start = std::chrono::steady_clock::now();
+      const double start_cpu_s = ThreadCpuSeconds(), start_process_cpu_s = ProcessCpuSeconds();
+      if (batch->party) {
+        try {
+          batch->party->Run();
+          batch->party->Finish();
+          for (auto& job : batch->jobs) AddPartyStatistics(job.accounting, *batch->party);
+          // Demultiplex the results of the batch to its jobs
+          for (auto& job : batch->jobs) {
+            if (job.error.empty()) job.result_shares = GetResultShares(job.search_results);
+          }
+        } catch (const std::exception& e) {
+          for (auto& job : batch->jobs) {
+            if (job.error.empty()) job.error = e.what();
+          }
+        }
+      }
+      // Free the slot of the batch before the next one is taken
+      for (auto& job : batch->jobs) {
+        job.search_results.clear();
+        job.accounting.run_ms = elapsedMilliseconds(start);
+        job.accounting.run_cpu_s = ThreadCpuSeconds() - start_cpu_s;
+        job.accounting.run_process_cpu_s = ProcessCpuSeconds() - start_process_cpu_s;
+      }
+      batch->party.reset();
+      finished_batches.Push(std::move(*batch));
+    }
+    finished_batches.Close();
+  });
+
+  while (auto batch = finished_batches.Pop()) {
+    for (auto& job : batch->jobs) {
+      if (job.error.empty()) {
+        try {
+          writeResultShares(job);
+        } catch (const std::exception& e) {
+          job.error = e.what();
+        }
+      }
+      if (!server_options.accounting_log_path.empty()) {
+        try {
+          job.accounting.peak_memory_kb = PeakMemoryKilobytes();
+          AppendAccountingRecord(server_options.accounting_log_path, job.accounting);
+        } catch (const std::exception& e) {
+          std::cerr << fmt::format("Accounting of search {} failed: {}", job.job_id, e.what()) << std::endl;
+        }
+      }
+      if (server_options.metrics) {
+        std::uint64_t bytes = 0;
+        for (const auto& peer : job.accounting.transport_statistics) {
+          bytes += peer.num_bytes_sent + peer.num_bytes_received;
+        }
+        server_options.metrics->SearchFinished(job.search_mode, !job.error.empty(),
+                                               elapsedMilliseconds(job.arrival_time), bytes);
+      }
+      logJob(job, *batch);
+      job_done(job);
+    }
+  }
+
+  load_stage.join();
+  construct_stage.join();
+  run_stage.join();
+}
+
+static double elapsedMilliseconds(const std::chrono::steady_clock::time_point& start) {
+  return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+static std::size_t agreeOnValue(const std::function<encrypto::motion::PartyPointer(std::size_t)>& create_party,
+                                const std::size_t slot, const std::size_t value) {
+  encrypto::motion::PartyPointer party{create_party(slot)};
+
+  // Party 0 inputs its value (e.g., the batch size) and all parties get it as the output
+  auto value_bits = encrypto::motion::ToInput(static_cast<std::uint32_t>(value));
+  encrypto::motion::ShareWrapper value_input = party->In<encrypto::motion::MpcProtocol::kBooleanGmw>(value_bits, 0);
+  auto agreed_value = value_input.Out();
+
+  party->Run();
+  party->Finish();
+  return agreed_value.As<std::uint32_t>();
+}
+
+static std::vector<std::size_t> agreeOnValues(
+    const std::function<encrypto::motion::PartyPointer(std::size_t)>& create_party, const std::size_t slot,
+    const std::vector<std::size_t>& values) {
+  encrypto::motion::PartyPointer party{create_party(slot)};
+
+  // Like agreeOnValue, with one SIMD value per value, all parties must thus pass the same number of values
+  std::vector<std::uint32_t> input_values(values.begin(), values.end());
+  encrypto::motion::ShareWrapper values_input =
+      party->In<encrypto::motion::MpcProtocol::kBooleanGmw>(encrypto::motion::ToInput(input_values), 0);
+  auto agreed_values = values_input.Out();
+
+  party->Run();
+  party->Finish();
+  auto output_values = agreed_values.As<std::vector<std::uint32_t>>();
+  return {output_values.begin(), output_values.end()};
+}
+
+static void writeResultShares(const search_job& job) {
+  YAML::Emitter result_yaml;
+  result_yaml << YAML::BeginMap;
+  result_yaml << YAML::Key << "job_id" << YAML::Value << job.job_id;
+  result_yaml << YAML::Key << "search_result_shares" << YAML::Value << YAML::Flow << YAML::BeginSeq;
+  for (bool result_share : job.result_shares) result_yaml << static_cast<int>(result_share);
+  result_yaml << YAML::EndSeq;
+  result_yaml << YAML::EndMap;
+
+  std::ofstream result_file;
+  result_file.open(job.output_path);
+  result_file << result_yaml.c_str() << std::endl;
+  result_file.close();
+}
+
+static void logJob(const search_job& job, const search_batch& batch) {
+  // The replicas finish their searches concurrently
+  static std::mutex log_mutex;
+  std::scoped_lock lock(log_mutex);
+  if (job.error.empty()) {
+    std::cout << fmt::format("Search {} done in batch {} of {} (load: {:.1f} ms, construct: {:.1f} ms, run: {:.1f} ms)",
+                             job.job_id, batch.batch_id, batch.jobs.size(), job.accounting.load_ms,
+                             job.accounting.construct_ms, job.accounting.run_ms)
+              << std::endl;
+  } else {
+    std::cerr << fmt::format("Search {} failed: {}", job.job_id, job.error) << std::endl;
+  }
+}
@@ -0,0 +1,83 @@
+// MIT License
+//
+// Copyright (c) 2021 Raine Nieminen
+// Cryptography and Privacy Engineering Group (ENCRYPTO)
+// TU Darmstadt, Germany
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <istream>
+#include <memory>
+#include <string>
+
+#include "common/privmail.h"
+#include "common/privmail_accounting.h"
+#include "common/privmail_metrics.h"
+
+struct search_job {
+  // Set by the load stage
+  std::size_t job_id = 0;
+  std::chrono::steady_clock::time_point arrival_time;  // When the request was read, the start of its latency
+  std::string output_path;
+  search_mode_enum search_mode = eNormal;
+  std::vector<search_query> search_queries;
+  std::string modifier_chain_share;
+  // Shared with the mailbox store (see privmail_store.h), such that resident mailboxes are not copied for each search
+  std::shared_ptr<const std::vector<mail_structure>> mails = std::make_shared<const std::vector<mail_structure>>();
+  std::shared_ptr<const search_index> index = std::make_shared<const search_index>();
+  std::vector<std::uint32_t> bucket_scheme;
+
+  // Set by the following stages
+  std::vector<encrypto::motion::ShareWrapper> search_results;
+  std::vector<bool> result_shares;
+  accounting_record accounting;  // The load stage sets the tags of the search, the stages their resources
+  std::string error;  // Empty if all stages succeeded
+};
+
+struct server_options {
+  // Requests that arrive within this time after the first one (or until the batch is full) are searched together
+  double coalescing_window_ms = 0;
+  std::size_t max_batch_size = 1;
+
+  // Number of pipelines over replicated inputs, each request is routed to the one with the fewest unfinished searches
+  std::size_t num_of_replicas = 1;
+
+  // Path of the log to which each search appends its accounting record (see privmail_accounting.h), empty to disable
+  std::string accounting_log_path;
+
+  // Updated by the stages if set (see privmail_metrics.h), not owned
+  SearchMetrics* metrics = nullptr;
+};
+
+// Reads one search request per line and runs the searches in a pipeline with a thread per stage (load, construct,
+// run, output), i.e., the circuits of the next batch are constructed while the current one runs and the results of
+// the previous one are written. The searches of a batch are constructed in the same party and thus evaluated with
+// shared communication rounds. Batches that are constructed or run at the same time use different slots,
+// create_party(slot) must thus connect each slot over different ports. All parties must get the same requests in
+// the same order, the batches are split as party 0 sees them. With several replicas, each replica runs its own
+// pipeline over its own range of slots, and party 0 chooses the replicas of the queued requests at once, which all
+// parties then use
+void RunSearchServer(std::istream& requests,
+                     const std::function<search_job(const std::string&)>& load_job,
+                     const std::function<encrypto::motion::PartyPointer(std::size_t)>& create_party,
+                     const search_options& options, const server_options& server_options = server_options());
@@ -0,0 +1,80 @@
+// MIT License
+//
+// Copyright (c) 2021 Raine Nieminen
+// Cryptography and Privacy Engineering Group (ENCRYPTO)
+// TU Darmstadt, Germany
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "privmail_store.h"
+
+#include <algorithm>
+#include <cctype>
+#include <filesystem>
+#include <stdexcept>
+
+#include "privmail_io.h"
+
+MailboxStore::MailboxStore(std::string root_path, std::size_t max_resident_mailboxes)
+    : root_path_(std::move(root_path)), max_resident_mailboxes_(max_resident_mailboxes) {
+  if (max_resident_mailboxes_ == 0) throw std::invalid_argument("At least one mailbox must be resident");
+}
+
+mailbox MailboxStore::Get(const std::string& tenant_id, const std::vector<std::uint32_t>& bucket_scheme) {
+  // The tenant id names a directory below the root, so it must not reach outside of it
+  auto valid_character = [](char c) { return std::isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '-'; };
+  if (tenant_id.empty() || !std::all_of(tenant_id.begin(), tenant_id.end(), valid_character)) {
+    throw std::invalid_argument("Invalid tenant id " + tenant_id);
+  }
+
+  mailbox_key key{tenant_id, bucket_scheme};
+  {
+    std::scoped_lock lock(mutex_);
+    if (auto entry = resident_mailboxes_.find(key); entry != resident_mailboxes_.end()) {
+      recently_used_.splice(recently_used_.begin(), recently_used_, entry->second.second);
+      return entry->second.first;
+    }
+  }
+
+  // Load without holding the lock, such that the searches of other tenants continue meanwhile
+  const std::filesystem::path tenant_path = std::filesystem::path(root_path_) / tenant_id;
+  if (!std::filesystem::is_directory(tenant_path)) throw std::runtime_error("Unknown tenant " + tenant_id);
+  mailbox loaded;
+  if (std::filesystem::is_directory(tenant_path / "mail_data")) {
+    loaded.mails = std::make_shared<const std::vector<mail_structure>>(
+        MailsFromDirectory(tenant_path / "mail_data", bucket_scheme));
+  }
+  if (std::filesystem::exists(tenant_path / "index.yaml")) {
+    loaded.index = std::make_shared<const search_index>(IndexFromFile(tenant_path / "index.yaml"));
+  }
+
+  std::scoped_lock lock(mutex_);
+  if (auto entry = resident_mailboxes_.find(key); entry != resident_mailboxes_.end()) {
+    // Another search loaded it meanwhile
+    recently_used_.splice(recently_used_.begin(), recently_used_, entry->second.second);
+    return entry->second.first;
+  }
+  while (resident_mailboxes_.size() >= max_resident_mailboxes_) {
+    resident_mailboxes_.erase(recently_used_.back());
+    recently_used_.pop_back();
+  }
+  recently_used_.push_front(key);
+  resident_mailboxes_.emplace(key, std::make_pair(loaded, recently_used_.begin()));
+  return loaded;
+}
@@ -0,0 +1,63 @@
+// MIT License
+//
+// Copyright (c) 2021 Raine Nieminen
+// Cryptography and Privacy Engineering Group (ENCRYPTO)
+// TU Darmstadt, Germany
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include <cstddef>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "common/privmail.h"
+
+// The inputs of a tenant's mailbox, shared with the searches that use them
+struct mailbox {
+  std::shared_ptr<const std::vector<mail_structure>> mails;  // Empty if the tenant has no mail directory
+  std::shared_ptr<const search_index> index;                 // Empty if the tenant has no index file
+};
+
+// Keeps the mailboxes of many tenants in one process, such that their searches share the connections and the setup
+// of the server. The store has a directory per tenant, <root>/<tenant>/mail_data with the mails and
+// <root>/<tenant>/index.yaml with the index (both optional). The most recently used mailboxes stay loaded, and a
+// searched mailbox that is evicted stays alive until its searches are done
+class MailboxStore {
+ public:
+  MailboxStore(std::string root_path, std::size_t max_resident_mailboxes);
+
+  // Loads the mailbox if it is not resident, thread-safe
+  mailbox Get(const std::string& tenant_id, const std::vector<std::uint32_t>& bucket_scheme);
+
+ private:
+  // The mails depend on the bucket scheme of the query, so each scheme is loaded as its own entry
+  using mailbox_key = std::pair<std::string, std::vector<std::uint32_t>>;
+
+  std::string root_path_;
+  std::size_t max_resident_mailboxes_;
+  std::list<mailbox_key> recently_used_;  // The most recently used first
+  std::map<mailbox_key, std::pair<mailbox, std::list<mailbox_key>::iterator>> resident_mailboxes_;
+  std::mutex mutex_;
+};
@@ -0,0 +1,437 @@
+// MIT License
+//
+// Copyright (c) 2021 Raine Nieminen
+// Cryptography and Privacy Engineering Group (ENCRYPTO)
+// TU Darmstadt, Germany
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "search_circuit.h"
+
+#include <cassert>
+#include <functional>
+#include <optional>
+#include <queue>
+#include <stdexcept>
+
+#include <fmt/format.h>
+
+SearchCircuit::Node SearchCircuit::Input(const encrypto::motion::ShareWrapper& share) {
+  assert(share->GetBitLength() == 1);
+  // The same share is the same input, e.g., a text character that is compared to several keywords
+  auto [it, inserted] = input_nodes_.try_emplace(share.Get().get(), nodes_.size());
+  if (!inserted) return it->second;
+
+  node input{Operation::kInput};
+  input.input_index = inputs_.size();
+  inputs_.push_back(share);
+  nodes_.push_back(std::move(input));
+  return it->second;
+}
+
+SearchCircuit::Node SearchCircuit::Input() {
+  node input{Operation::kInput};
+  input.input_index = inputs_.size();
+  inputs_.emplace_back();
+  nodes_.push_back(std::move(input));
+  return nodes_.size() - 1;
+}
+
+SearchCircuit::Node SearchCircuit::Constant(bool value) { return Add(Operation::kConstant, {}, value); }
+
+SearchCircuit::Node SearchCircuit::Not(Node a) {
+  if (nodes_[a].operation == Operation::kConstant) return Constant(!nodes_[a].value);
+  if (nodes_[a].operation == Operation::kNot) return nodes_[a].operands.front();
+  return Add(Operation::kNot, {a});
+}
+
+SearchCircuit::Node SearchCircuit::Xor(Node a, Node b) {
+  if (a == b) return Constant(false);
+  if (IsConstant(a, false)) return b;
+  if (IsConstant(b, false)) return a;
+  if (IsConstant(a, true)) return Not(b);
+  if (IsConstant(b, true)) return Not(a);
+  // Move the NOTs out of the XOR, such that e.g. ~a ^ b and a ^ ~b are the same node
+  if (nodes_[a].operation == Operation::kNot) return Not(Xor(nodes_[a].operands.front(), b));
+  if (nodes_[b].operation == Operation::kNot) return Not(Xor(a, nodes_[b].operands.front()));
+  return Add(Operation::kXor, {std::min(a, b), std::max(a, b)});
+}
+
+SearchCircuit::Node SearchCircuit::Nary(Operation operation, std::vector<Node> operands) {
+  assert(operation == Operation::kAnd || operation == Operation::kOr);
+  // A 0 decides an AND and a 1 decides an OR, the other constant does not change the result
+  const bool deciding_value = operation == Operation::kOr;
+
+  std::vector<Node> remaining_operands;
+  for (auto operand : operands) {
+    if (IsConstant(operand, deciding_value)) return Constant(deciding_value);
+    if (IsConstant(operand, !deciding_value)) continue;
+    remaining_operands.push_back(operand);
+  }
+  std::sort(remaining_operands.begin(), remaining_operands.end());
+  remaining_operands.erase(std::unique(remaining_operands.begin(), remaining_operands.end()), remaining_operands.end());
+
+  // a & ~a is 0 and a | ~a is 1
+  for (auto operand : remaining_operands) {
+    if (nodes_[operand].operation == Operation::kNot &&
+        std::binary_search(remaining_operands.begin(), remaining_operands.end(), nodes_[operand].operands.front())) {
+      return Constant(deciding_value);
+    }
+  }
+
+  if (remaining_operands.empty()) return Constant(!deciding_value);
+  if (remaining_operands.size() == 1) return remaining_operands.front();
+  return Add(operation, std::move(remaining_operands));
+}
+
+SearchCircuit::Node SearchCircuit::Add(Operation operation, std::vector<Node> operands, bool value) {
+  auto [it, inserted] = unique_nodes_.try_emplace(std::make_tuple(operation, operands, value), nodes_.size());
+  if (inserted) nodes_.push_back(node{operation, std::move(operands), value});
+  return it->second;
+}
+
+void SearchCircuit::Optimize(std::vector<Node>& outputs) {
+  // Count the users of each node that the outputs depend on
+  std::vector<std::size_t> num_of_users(nodes_.size(), 0);
+  std::vector<bool> reachable(nodes_.size(), false);
+  std::vector<Node> stack(outputs);
+  for (auto output : outputs) num_of_users[output]++;
+  while (!stack.empty()) {
+    Node current = stack.back();
+    stack.pop_back();
+    if (reachable[current]) continue;
+    reachable[current] = true;
+    for (auto operand : nodes_[current].operands) {
+      num_of_users[operand]++;
+      stack.push_back(operand);
+    }
+  }
+
+  // Rebuild the circuit, the operands always precede their users
+  SearchCircuit optimized;
+  std::vector<Node> mapping(nodes_.size());
+  std::vector<std::vector<Node>> merged_operands(nodes_.size());
+  for (Node current = 0; current < nodes_.size(); current++) {
+    if (!reachable[current]) continue;
+    auto& [operation, operands, value, input_index] = nodes_[current];
+    switch (operation) {
+      case Operation::kInput:
+        mapping[current] = inputs_[input_index].Get() ? optimized.Input(inputs_[input_index]) : optimized.Input();
+        break;
+      case Operation::kConstant:
+        mapping[current] = optimized.Constant(value);
+        break;
+      case Operation::kNot:
+        mapping[current] = optimized.Not(mapping[operands[0]]);
+        break;
+      case Operation::kXor:
+        mapping[current] = optimized.Xor(mapping[operands[0]], mapping[operands[1]]);
+        break;
+      case Operation::kAnd:
+      case Operation::kOr: {
+        // Take over the operands of the same operation if this node is their only user
+        auto& merged = merged_operands[current];
+        for (auto operand : operands) {
+          if (nodes_[operand].operation == operation && num_of_users[operand] == 1) {
+            merged.insert(merged.end(), merged_operands[operand].begin(), merged_operands[operand].end());
+          } else {
+            merged.push_back(mapping[operand]);
+          }
+        }
+        mapping[current] = optimized.Nary(operation, merged);
+        break;
+      }
+    }
+  }
+
+  for (auto& output : outputs) output = mapping[output];
+  *this = std::move(optimized);
+}
+
+std::vector<encrypto::motion::ShareWrapper> SearchCircuit::Lower(const std::vector<Node>& outputs,
+                                                                 const encrypto::motion::ShareWrapper& full_zero,
+                                                                 const std::size_t simd_width) const {
+  const std::size_t num_of_nodes = nodes_.size();
+
+  std::vector<bool> reachable(num_of_nodes, false);
+  std::vector<Node> stack(outputs);
+  while (!stack.empty()) {
+    Node current = stack.back();
+    stack.pop_back();
+    if (reachable[current]) continue;
+    reachable[current] = true;
+    stack.insert(stack.end(), nodes_[current].operands.begin(), nodes_[current].operands.end());
+  }
+
+  // Split the AND/OR nodes into two-input gates, where the wires of the gates follow the wires of the nodes. Each
+  // tree pairs the two inputs of the lowest depth first, which gives the lowest depth for the given inputs
+  struct gate {
+    Operation operation;
+    std::size_t lhs, rhs;
+  };
+  std::vector<gate> gates;
+  std::vector<std::size_t> node_wires(num_of_nodes);
+  std::vector<std::size_t> wire_depths(num_of_nodes, 0);
+  std::vector<std::vector<std::size_t>> gates_per_depth;
+  for (Node current = 0; current < num_of_nodes; current++) {
+    if (!reachable[current]) continue;
+    auto& [operation, operands, value, input_index] = nodes_[current];
+    node_wires[current] = current;
+    if (operation == Operation::kNot || operation == Operation::kXor) {
+      // Local operations do not add to the depth
+      for (auto operand : operands) {
+        wire_depths[current] = std::max(wire_depths[current], wire_depths[node_wires[operand]]);
+      }
+    } else if (operation == Operation::kAnd || operation == Operation::kOr) {
+      using depth_and_wire = std::pair<std::size_t, std::size_t>;
+      std::priority_queue<depth_and_wire, std::vector<depth_and_wire>, std::greater<>> tree_inputs;
+      for (auto operand : operands) tree_inputs.emplace(wire_depths[node_wires[operand]], node_wires[operand]);
+      while (tree_inputs.size() > 1) {
+        auto [lhs_depth, lhs] = tree_inputs.top();
+        tree_inputs.pop();
+        auto [rhs_depth, rhs] = tree_inputs.top();
+        tree_inputs.pop();
+
+        const std::size_t depth = std::max(lhs_depth, rhs_depth) + 1;
+        if (gates_per_depth.size() <= depth) gates_per_depth.resize(depth + 1);
+        gates_per_depth[depth].push_back(gates.size());
+        gates.push_back({operation, lhs, rhs});
+        wire_depths.push_back(depth);
+        tree_inputs.emplace(depth, num_of_nodes + gates.size() - 1);
+      }
+      node_wires[current] = tree_inputs.top().second;
+    }
+  }
+
+  // The local operations are built when a gate or an output needs them
+  std::vector<encrypto::motion::ShareWrapper> wire_values(num_of_nodes + gates.size());
+  std::function<encrypto::motion::ShareWrapper(std::size_t)> get_wire_value = [&](std::size_t wire) {
+    auto& wire_value = wire_values[wire];
+    if (wire_value.Get() || wire >= num_of_nodes) {
+      assert(wire_value.Get());
+      return wire_value;
+    }
+    auto& [operation, operands, value, input_index] = nodes_[wire];
+    switch (operation) {
+      case Operation::kInput:
+        assert(inputs_[input_index].Get());
+        wire_value = inputs_[input_index];
+        break;
+      case Operation::kConstant:
+        wire_value = value ? ~full_zero : full_zero;
+        break;
+      case Operation::kNot:
+        wire_value = ~get_wire_value(node_wires[operands[0]]);
+        break;
+      case Operation::kXor:
+        wire_value = get_wire_value(node_wires[operands[0]]) ^ get_wire_value(node_wires[operands[1]]);
+        break;
+      case Operation::kAnd:
+      case Operation::kOr:
+        wire_value = get_wire_value(node_wires[wire]);
+        break;
+    }
+    return wire_value;
+  };
+
+  // Evaluate all AND (OR) gates of the same depth with a single SIMD gate (or several if wider than simd_width)
+  for (auto& gates_of_depth : gates_per_depth) {
+    for (auto operation : {Operation::kAnd, Operation::kOr}) {
+      std::vector<std::size_t> layer;
+      std::vector<encrypto::motion::ShareWrapper> lhs, rhs;
+      for (auto g : gates_of_depth) {
+        if (gates[g].operation != operation) continue;
+        layer.push_back(g);
+        lhs.push_back(get_wire_value(gates[g].lhs));
+        rhs.push_back(get_wire_value(gates[g].rhs));
+      }
+
+      const std::size_t gate_width = simd_width == 0 ? layer.size() : simd_width;
+      for (std::size_t offset = 0; offset < layer.size(); offset += gate_width) {
+        const std::size_t end = std::min(offset + gate_width, layer.size());
+        auto lhs_simd = encrypto::motion::ShareWrapper::Simdify(
+            std::vector<encrypto::motion::ShareWrapper>(lhs.begin() + offset, lhs.begin() + end));
+        auto rhs_simd = encrypto::motion::ShareWrapper::Simdify(
+            std::vector<encrypto::motion::ShareWrapper>(rhs.begin() + offset, rhs.begin() + end));
+        auto results = (operation == Operation::kAnd ? lhs_simd & rhs_simd : lhs_simd | rhs_simd).Unsimdify();
+        for (std::size_t k = offset; k < end; k++) wire_values[num_of_nodes + layer[k]] = results[k - offset];
+      }
+    }
+  }
+
+  std::vector<encrypto::motion::ShareWrapper> output_values;
+  for (auto output : outputs) output_values.push_back(get_wire_value(node_wires[output]));
+  return output_values;
+}
+
+std::vector<SearchCircuit::Node> SearchCircuit::Apply(const bristol_circuit& circuit,
+                                                      const std::vector<std::vector<Node>>& inputs) {
+  if (inputs.size() != circuit.input_bitlengths.size()) {
+    throw std::invalid_argument("The number of inputs does not match the Bristol Fashion circuit");
+  }
+  std::vector<std::optional<Node>> wires(circuit.num_of_wires);
+  std::size_t wire = 0;
+  for (std::size_t i = 0; i < inputs.size(); i++) {
+    if (inputs[i].size() != circuit.input_bitlengths[i]) {
+      throw std::invalid_argument("The input lengths do not match the Bristol Fashion circuit");
+    }
+    for (auto input : inputs[i]) wires.at(wire++) = input;
+  }
+
+  auto get_wire = [&](std::size_t wire) {
+    if (!wires.at(wire)) throw std::invalid_argument(fmt::format("Wire {} is used before it is set", wire));
+    return wires[wire].value();
+  };
+  for (auto& gate : circuit.gates) {
+    auto& [input_wires, output_wires, operation] = gate;
+    if (operation == "XOR") {
+      wires.at(output_wires.at(0)) = Xor(get_wire(input_wires.at(0)), get_wire(input_wires.at(1)));
+    } else if (operation == "AND") {
+      wires.at(output_wires.at(0)) = And(get_wire(input_wires.at(0)), get_wire(input_wires.at(1)));
+    } else if (operation == "INV") {
+      wires.at(output_wires.at(0)) = Not(get_wire(input_wires.at(0)));
+    } else if (operation == "EQ") {
+      wires.at(output_wires.at(0)) = Constant(input_wires.at(0) != 0);
+    } else if (operation == "EQW") {
+      wires.at(output_wires.at(0)) = get_wire(input_wires.at(0));
+    } else if (operation == "MAND") {
+      // The first half of the inputs are the left and the second half the right inputs of the ANDs
+      const std::size_t num_of_ands = output_wires.size();
+      for (std::size_t k = 0; k < num_of_ands; k++) {
+        wires.at(output_wires[k]) = And(get_wire(input_wires.at(k)), get_wire(input_wires.at(num_of_ands + k)));
+      }
+    } else {
+      throw std::invalid_argument("Unknown gate in the Bristol Fashion circuit: " + operation);
+    }
+  }
+
+  std::size_t num_of_output_wires = 0;
+  for (auto bitlength : circuit.output_bitlengths) num_of_output_wires += bitlength;
+  std::vector<Node> outputs;
+  for (std::size_t wire = circuit.num_of_wires - num_of_output_wires; wire < circuit.num_of_wires; wire++) {
+    outputs.push_back(get_wire(wire));
+  }
+  return outputs;
+}
+
+void SearchCircuit::WriteBristolFashion(std::ostream& output, const std::vector<std::vector<Node>>& inputs,
+                                        const std::vector<Node>& outputs) const {
+  // The inputs take the first wires
+  std::map<Node, std::size_t> node_wires;
+  std::size_t num_of_wires = 0;
+  for (auto& input : inputs) {
+    for (auto node : input) {
+      assert(nodes_.at(node).operation == Operation::kInput);
+      node_wires[node] = num_of_wires++;
+    }
+  }
+
+  std::vector<std::string> gates;
+  auto add_gate = [&](const std::vector<std::size_t>& input_wires, const std::string& operation) {
+    std::string gate = fmt::format("{} 1", input_wires.size());
+    for (auto wire : input_wires) gate += fmt::format(" {}", wire);
+    gates.push_back(fmt::format("{} {} {}", gate, num_of_wires, operation));
+    return num_of_wires++;
+  };
+  // Reduces the wires with a balanced tree of AND gates
+  auto add_and_tree = [&](std::vector<std::size_t> wires) {
+    while (wires.size() > 1) {
+      std::vector<std::size_t> next_layer;
+      for (std::size_t i = 0; i + 1 < wires.size(); i += 2) {
+        next_layer.push_back(add_gate({wires[i], wires[i + 1]}, "AND"));
+      }
+      if (wires.size() % 2 == 1) next_layer.push_back(wires.back());
+      wires = std::move(next_layer);
+    }
+    return wires.front();
+  };
+
+  std::function<std::size_t(Node)> get_wire = [&](Node current) {
+    if (auto it = node_wires.find(current); it != node_wires.end()) return it->second;
+    auto& [operation, operands, value, input_index] = nodes_.at(current);
+    std::size_t wire = 0;
+    switch (operation) {
+      case Operation::kInput:
+        throw std::invalid_argument("The exported circuit depends on an input that is not exported");
+      case Operation::kConstant:
+        gates.push_back(fmt::format("1 1 {} {} EQ", static_cast<int>(value), num_of_wires));
+        wire = num_of_wires++;
+        break;
+      case Operation::kNot:
+        wire = add_gate({get_wire(operands[0])}, "INV");
+        break;
+      case Operation::kXor:
+        wire = add_gate({get_wire(operands[0]), get_wire(operands[1])}, "XOR");
+        break;
+      case Operation::kAnd: {
+        std::vector<std::size_t> operand_wires;
+        for (auto operand : operands) operand_wires.push_back(get_wire(operand));
+        wire = add_and_tree(operand_wires);
+        break;
+      }
+      case Operation::kOr: {
+        // a | b = ~(~a & ~b)
+        std::vector<std::size_t> operand_wires;
+        for (auto operand : operands) operand_wires.push_back(add_gate({get_wire(operand)}, "INV"));
+        wire = add_gate({add_and_tree(operand_wires)}, "INV");
+        break;
+      }
+    }
+    node_wires[current] = wire;
+    return wire;
+  };
+
+  // The outputs take the last wires, so they are copied at the end
+  std::vector<std::size_t> output_wires;
+  for (auto node : outputs) output_wires.push_back(get_wire(node));
+  for (auto wire : output_wires) add_gate({wire}, "EQW");
+
+  output << gates.size() << " " << num_of_wires << "\n";
+  output << inputs.size();
+  for (auto& input : inputs) output << " " << input.size();
+  output << "\n1 " << outputs.size() << "\n\n";
+  for (auto& gate : gates) output << gate << "\n";
+}
+
+bristol_circuit ReadBristolFashion(std::istream& input) {
+  bristol_circuit circuit;
+  std::size_t num_of_gates = 0, num_of_input_values = 0, num_of_output_values = 0;
+  if (!(input >> num_of_gates >> circuit.num_of_wires >> num_of_input_values)) {
+    throw std::invalid_argument("Invalid header of the Bristol Fashion circuit");
+  }
+  circuit.input_bitlengths.resize(num_of_input_values);
+  for (auto& bitlength : circuit.input_bitlengths) input >> bitlength;
+  input >> num_of_output_values;
+  circuit.output_bitlengths.resize(num_of_output_values);
+  for (auto& bitlength : circuit.output_bitlengths) input >> bitlength;
+
+  for (std::size_t g = 0; g < num_of_gates; g++) {
+    bristol_circuit::gate gate;
+    std::size_t num_of_inputs = 0, num_of_outputs = 0;
+    input >> num_of_inputs >> num_of_outputs;
+    gate.input_wires.resize(num_of_inputs);
+    gate.output_wires.resize(num_of_outputs);
+    for (auto& wire : gate.input_wires) input >> wire;
+    for (auto& wire : gate.output_wires) input >> wire;
+    input >> gate.operation;
+    if (!input) throw std::invalid_argument(fmt::format("Invalid gate {} of the Bristol Fashion circuit", g));
+    circuit.gates.push_back(std::move(gate));
+  }
+  return circuit;
+}
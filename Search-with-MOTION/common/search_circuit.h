@@ -0,0 +1,135 @@
+// MIT License
+//
+// Copyright (c) 2021 Raine Nieminen
+// Cryptography and Privacy Engineering Group (ENCRYPTO)
+// TU Darmstadt, Germany
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include <istream>
+#include <map>
+#include <ostream>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "protocols/share_wrapper.h"
+
+// Boolean circuit in the Bristol Fashion format, e.g., optimized by external tools. The input (output) wires are
+// the first (last) wires, in the order of the input (output) values
+struct bristol_circuit {
+  struct gate {
+    std::vector<std::size_t> input_wires;  // Constant value for EQ gates
+    std::vector<std::size_t> output_wires;
+    std::string operation;  // XOR, AND, INV, EQ, EQW or MAND
+  };
+
+  std::size_t num_of_wires = 0;
+  std::vector<std::size_t> input_bitlengths;
+  std::vector<std::size_t> output_bitlengths;
+  std::vector<gate> gates;
+};
+
+bristol_circuit ReadBristolFashion(std::istream& input);
+
+// Intermediate representation of the Boolean search circuits, where each node is a single bit. Building the circuit
+// already eliminates common subexpressions (identical nodes are only created once) and folds constants. Optimize()
+// merges nested AND/OR nodes and Lower() builds the gates in MOTION, where the AND/OR trees are balanced by the
+// depth of their inputs and all AND/OR gates of the same depth are evaluated with a single SIMD gate
+class SearchCircuit {
+ public:
+  using Node = std::size_t;
+
+  enum class Operation { kInput, kConstant, kNot, kXor, kAnd, kOr };
+
+  // The share must be a single bit with a single SIMD value
+  Node Input(const encrypto::motion::ShareWrapper& share);
+
+  // Input without a share, such a circuit can only be exported (e.g., to analyze the circuit of a query shape)
+  Node Input();
+
+  Node Constant(bool value);
+
+  Node Not(Node a);
+
+  Node Xor(Node a, Node b);
+
+  Node Xnor(Node a, Node b) { return Not(Xor(a, b)); }
+
+  Node And(Node a, Node b) { return And(std::vector<Node>{a, b}); }
+
+  Node Or(Node a, Node b) { return Or(std::vector<Node>{a, b}); }
+
+  // AND/OR over any number of nodes (the empty AND is 1 and the empty OR is 0)
+  Node And(std::vector<Node> operands) { return Nary(Operation::kAnd, std::move(operands)); }
+
+  Node Or(std::vector<Node> operands) { return Nary(Operation::kOr, std::move(operands)); }
+
+  // Merges AND (OR) nodes into the AND (OR) nodes that are their only users, such that Lower() can balance the
+  // whole tree instead of each part separately, and updates the given outputs to the new nodes (other nodes of the
+  // circuit are renumbered)
+  void Optimize(std::vector<Node>& outputs);
+
+  // Builds the gates of the outputs (and the nodes they depend on) with at most simd_width values per SIMD gate
+  // (0 for no limit), full_zero is a shared 0 for the constant outputs
+  std::vector<encrypto::motion::ShareWrapper> Lower(const std::vector<Node>& outputs,
+                                                    const encrypto::motion::ShareWrapper& full_zero,
+                                                    const std::size_t simd_width = 0) const;
+
+  // Builds the gates of the external circuit on the given nodes (one vector per input value), returns the output
+  // nodes of all output values in order
+  std::vector<Node> Apply(const bristol_circuit& circuit, const std::vector<std::vector<Node>>& inputs);
+
+  // Writes the outputs (as a single output value) in the Bristol Fashion format, where each vector of input nodes is
+  // an input value. The OR gates are written as AND and INV gates, and the trees are split into two-input gates
+  void WriteBristolFashion(std::ostream& output, const std::vector<std::vector<Node>>& inputs,
+                           const std::vector<Node>& outputs) const;
+
+  std::size_t GetNumOfNodes() const { return nodes_.size(); }
+
+  Operation GetOperation(Node node) const { return nodes_.at(node).operation; }
+
+  const std::vector<Node>& GetOperands(Node node) const { return nodes_.at(node).operands; }
+
+  bool GetConstantValue(Node node) const { return nodes_.at(node).value; }
+
+ private:
+  struct node {
+    Operation operation;
+    std::vector<Node> operands;  // Sorted for XOR/AND/OR, such that identical nodes have identical operands
+    bool value = false;          // Only for constants
+    std::size_t input_index = 0;  // Only for inputs
+  };
+
+  Node Nary(Operation operation, std::vector<Node> operands);
+
+  Node Add(Operation operation, std::vector<Node> operands, bool value = false);
+
+  bool IsConstant(Node node, bool value) const {
+    return nodes_[node].operation == Operation::kConstant && nodes_[node].value == value;
+  }
+
+  std::vector<node> nodes_;
+  std::vector<encrypto::motion::ShareWrapper> inputs_;
+  std::map<const encrypto::motion::Share*, Node> input_nodes_;
+  std::map<std::tuple<Operation, std::vector<Node>, bool>, Node> unique_nodes_;
+};
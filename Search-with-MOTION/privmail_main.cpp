@@ -22,10 +22,11 @@
 // OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 // SOFTWARE.
 
+#include <chrono>
 #include <cmath>
-#include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <optional>
 #include <random>
 #include <regex>
 
@@ -35,7 +36,13 @@
 #include <boost/program_options.hpp>
 
 #include "base/party.h"
+#include "common/calibration.h"
 #include "common/privmail.h"
+#include "common/privmail_accounting.h"
+#include "common/privmail_io.h"
+#include "common/privmail_metrics.h"
+#include "common/privmail_server.h"
+#include "common/privmail_store.h"
 #include "communication/communication_layer.h"
 #include "communication/tcp_transport.h"
 #include "statistics/analysis.h"
@@ -46,31 +53,116 @@ bool CheckPartyArgumentSyntax(const std::string& party_argument);
 
 std::pair<program_options::variables_map, bool> ParseProgramOptions(int ac, char* av[]);
 
-encrypto::motion::PartyPointer CreateParty(const program_options::variables_map& user_options);
+encrypto::motion::PartyPointer CreateParty(const program_options::variables_map& user_options,
+                                           std::uint16_t port_offset = 0);
 
-search_mode_enum GetSearchMode(const std::string& in_string);
-
-std::vector<search_query> SearchQueriesFromFile(const YAML::Node& search_query_yaml_file);
-
-std::vector<mail_structure> MailsFromDirectory(const std::string& mail_directory_path, const std::vector<std::uint32_t> bucket_scheme);
-
-search_index IndexFromFile(const std::string& index_file_path);
-
-std::uint32_t GetCharacterLengthFromBase64(const std::string& base64_string);
+search_job SearchJobFromRequest(const std::string& request, const program_options::variables_map& user_options,
+                                MailboxStore* mailbox_store);
 
 int main(int ac, char* av[]) {
   auto [user_options, help_flag] = ParseProgramOptions(ac, av);
   // if help flag is set - print allowed command line arguments and exit
   if (help_flag) return EXIT_SUCCESS;
 
+  search_options options;
+  options.coalesce_layers = user_options["coalesce-layers"].as<bool>();
+  options.candidate_bound = user_options["candidate-bound"].as<std::size_t>();
+  options.optimize_circuit = user_options["optimize-circuit"].as<bool>();
+  options.group_by_length = user_options["group-by-length"].as<bool>();
+
+  if (user_options["calibrate"].as<bool>()) {
+    // Find the best settings for this host with synthetic kernels and save them for later searches
+    std::string profile_path = user_options["profile-path"].as<std::string>();
+    auto profile = CalibrateSearchOptions([&user_options]() { return CreateParty(user_options); }, options);
+    SaveCalibrationProfile(profile, profile_path);
+    std::cout << fmt::format(
+        "Calibration profile saved to {} (round latency: {:.3f} ms, bandwidth: {:.1f} Mbit/s, gate cost: {:.3f} us)",
+        profile_path, profile.round_latency_ms, profile.bandwidth_mbit_per_s, profile.gate_cost_us)
+              << std::endl;
+    return EXIT_SUCCESS;
+  }
+
+  if (user_options.count("profile-path")) {
+    // Use the calibrated settings, but still coalesce the layers if requested explicitly
+    options = LoadCalibrationProfile(user_options["profile-path"].as<std::string>(), options).options;
+    options.coalesce_layers |= user_options["coalesce-layers"].as<bool>();
+    options.optimize_circuit = user_options["optimize-circuit"].as<bool>();
+    options.group_by_length = user_options["group-by-length"].as<bool>();
+  }
+
+  if (user_options.count("comparison-circuit")) {
+    std::ifstream comparison_circuit_file(user_options["comparison-circuit"].as<std::string>());
+    if (!comparison_circuit_file) throw std::runtime_error("Could not open the comparison circuit file");
+    options.character_comparison_circuit =
+        std::make_shared<const bristol_circuit>(ReadBristolFashion(comparison_circuit_file));
+    options.optimize_circuit = true;
+  }
+
+  if (user_options["server"].as<bool>()) {
+    // Run the searches requested on the standard input one after another, with overlapping stages
+    const auto number_of_parties = user_options["parties"].as<std::vector<std::string>>().size();
+    server_options server_options;
+    server_options.coalescing_window_ms = user_options["coalescing-window-ms"].as<double>();
+    server_options.max_batch_size = user_options["max-batch-size"].as<std::size_t>();
+    server_options.num_of_replicas = user_options["replicas"].as<std::size_t>();
+    if (user_options.count("accounting-log-path")) {
+      server_options.accounting_log_path = user_options["accounting-log-path"].as<std::string>();
+    }
+
+    // The mailboxes of the tenants stay loaded across the requests
+    std::unique_ptr<MailboxStore> mailbox_store;
+    if (user_options.count("tenant-root-path")) {
+      mailbox_store = std::make_unique<MailboxStore>(user_options["tenant-root-path"].as<std::string>(),
+                                                     user_options["max-resident-tenants"].as<std::size_t>());
+    }
+
+    // The exporter writes the final metrics when it is destroyed after the last request
+    SearchMetrics metrics;
+    std::unique_ptr<MetricsExporter> metrics_exporter;
+    const std::string metrics_path =
+        user_options.count("metrics-path") ? user_options["metrics-path"].as<std::string>() : "";
+    const auto metrics_port = user_options["metrics-port"].as<std::uint16_t>();
+    if (!metrics_path.empty() || metrics_port != 0) {
+      server_options.metrics = &metrics;
+      metrics_exporter = std::make_unique<MetricsExporter>(metrics, metrics_path, metrics_port,
+                                                           user_options["metrics-interval-s"].as<double>());
+    }
+    RunSearchServer(
+        std::cin,
+        [&user_options, &mailbox_store](const std::string& request) {
+          return SearchJobFromRequest(request, user_options, mailbox_store.get());
+        },
+        [&user_options, number_of_parties](std::size_t slot) {
+          return CreateParty(user_options, static_cast<std::uint16_t>(slot * number_of_parties));
+        },
+        options, server_options);
+    return EXIT_SUCCESS;
+  }
+
+  if (user_options.count("retrieval-key-path")) {
+    // The retrieval is answered locally from the secret share blocks, the client combines the answers of the servers
+    auto mails = MailsFromDirectory(user_options["mail-dir-path"].as<std::string>(), {});
+    auto retrieval_keys = RetrievalKeysFromFile(user_options["retrieval-key-path"].as<std::string>());
+    std::ofstream answer_file(user_options["retrieval-output-path"].as<std::string>());
+    WriteRetrievalAnswers(answer_file, AnswerRetrievalKeys(mails, retrieval_keys));
+    return EXIT_SUCCESS;
+  }
+
   encrypto::motion::AccumulatedRunTimeStatistics accumulated_runtime_statistics;
   encrypto::motion::AccumulatedCommunicationStatistics accumulated_communication_statistics;
 
   std::string search_mode_string = user_options["search-mode"].as<std::string>();
   search_mode_enum search_mode = GetSearchMode(search_mode_string);
 
+  // The resources of the search, appended to the accounting log if requested
+  accounting_record accounting;
+  accounting.search_mode = search_mode_string;
+  auto load_start = std::chrono::steady_clock::now();
+  const double load_start_cpu_s = ThreadCpuSeconds();
+
   std::string search_query_file_path = user_options["query-file-path"].as<std::string>();
   YAML::Node search_query_yaml_file = YAML::LoadFile(search_query_file_path);
+  if (search_query_yaml_file["uid"]) accounting.query_uid = search_query_yaml_file["uid"].as<std::string>();
 
   // Read the modifier_chain_share
   std::string modifier_chain_share = search_query_yaml_file["modifier_chain_share"].as<std::string>();
@@ -81,11 +173,17 @@ int main(int ac, char* av[]) {
   // Read the queries
   std::vector<search_query> search_queries = SearchQueriesFromFile(search_query_yaml_file);
 
-  // Read the mails
+  // Read the mails, or load them in the background while the parties connect and the search is constructed
   std::vector<mail_structure> mails;
+  std::unique_ptr<MailStream> mail_stream;
+  const bool stream_mails = user_options["stream-mails"].as<bool>() && !user_options.count("export-circuit");
   if (user_options.count("mail-dir-path")) {
     std::string mail_directory_path = user_options["mail-dir-path"].as<std::string>();
-    mails = MailsFromDirectory(mail_directory_path, bucket_scheme);
+    if (stream_mails) {
+      mail_stream = std::make_unique<MailStream>(mail_directory_path, bucket_scheme);
+    } else {
+      mails = MailsFromDirectory(mail_directory_path, bucket_scheme);
+    }
   }
 
   // Read the index
@@ -95,6 +193,15 @@ int main(int ac, char* av[]) {
     search_index = IndexFromFile(index_file_path);
   }
 
+  accounting.load_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - load_start).count();
+  accounting.load_cpu_s = ThreadCpuSeconds() - load_start_cpu_s;
+
+  if (user_options.count("export-circuit")) {
+    std::ofstream circuit_file(user_options["export-circuit"].as<std::string>());
+    ExportSearchCircuit(circuit_file, search_queries, mails, bucket_scheme, search_mode, options);
+    return EXIT_SUCCESS;
+  }
+
   std::uint32_t num_of_parties = 0;
 
   // Do several iterations for more consistent benchmarks
@@ -103,8 +210,31 @@ int main(int ac, char* av[]) {
     // Initialize a party pointer
     encrypto::motion::PartyPointer party{CreateParty(user_options)};
 
-    // Construct and run the actual search circuit for the inputs
-    auto search_results = PrivMailSearch(party, search_queries, modifier_chain_share, mails, search_index, bucket_scheme, search_mode);
+    // Construct the actual search circuit for the inputs, the mail stream is only taken in the first iteration
+    auto construct_start = std::chrono::steady_clock::now();
+    const double construct_start_cpu_s = ThreadCpuSeconds();
+    std::vector<encrypto::motion::ShareWrapper> search_results;
+    if (mail_stream) {
+      search_results = BuildPrivMailSearch(party, search_queries, modifier_chain_share, *mail_stream, mails,
+                                           search_index, bucket_scheme, search_mode, options);
+      mail_stream.reset();
+    } else {
+      search_results = BuildPrivMailSearch(party, search_queries, modifier_chain_share, mails, search_index,
+                                           bucket_scheme, search_mode, options);
+    }
+    accounting.construct_ms =
+        std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - construct_start).count();
+    accounting.construct_cpu_s = ThreadCpuSeconds() - construct_start_cpu_s;
+
+    // Run the search
+    auto run_start = std::chrono::steady_clock::now();
+    const double run_start_cpu_s = ThreadCpuSeconds(), run_start_process_cpu_s = ProcessCpuSeconds();
+    party->Run();
+    party->Finish();
+    accounting.run_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - run_start).count();
+    accounting.run_cpu_s = ThreadCpuSeconds() - run_start_cpu_s;
+    accounting.run_process_cpu_s = ProcessCpuSeconds() - run_start_process_cpu_s;
+    AddPartyStatistics(accounting, *party);
 
     // Save the runtime statistics
     const auto& runtime_statistics = party->GetBackend()->GetRunTimeStatistics();
@@ -123,6 +253,12 @@ int main(int ac, char* av[]) {
     num_of_parties = party->GetConfiguration()->GetNumOfParties();
   }
 
+  if (user_options.count("accounting-log-path")) {
+    accounting.num_of_emails = mails.empty() ? search_index.num_of_emails : mails.size();
+    accounting.peak_memory_kb = PeakMemoryKilobytes();
+    AppendAccountingRecord(user_options["accounting-log-path"].as<std::string>(), accounting);
+  }
+
   if (user_options.count("json-path")) {
     // Save the statistics in a JSON file
     auto stats_json = accumulated_runtime_statistics.ToJson();
@@ -135,6 +271,13 @@ int main(int ac, char* av[]) {
     stats_json["protocol"] = "BooleanGMW";  // This is fixed at least for now
 
     stats_json["search_mode"] = search_mode_string;
+    stats_json["coalesce_layers"] = options.coalesce_layers;
+    stats_json["chunk_size"] = options.chunk_size;
+    stats_json["simd_width"] = options.simd_width;
+    stats_json["candidate_bound"] = options.candidate_bound;
+    stats_json["optimize_circuit"] = options.optimize_circuit;
+    stats_json["group_by_length"] = options.group_by_length;
+    stats_json["stream_mails"] = stream_mails;
     stats_json["num_of_parties"] = num_of_parties;
 
     stats_json["num_of_emails"] = mails.size();
@@ -169,80 +312,57 @@ int main(int ac, char* av[]) {
   return EXIT_SUCCESS;
 }
 
-std::vector<search_query> SearchQueriesFromFile(const YAML::Node& search_query_yaml_file) {
-  std::vector<search_query> search_queries;
-  // Copy data over to queries
-  for (const auto& query_from_file : search_query_yaml_file["keywords"]) {
-    search_query query;
-    // Skip if 'field' is only item in list
-    if (query_from_file.size() == 1) {
-      continue;
-    }
-    query.keyword = query_from_file["keyword"].as<std::string>();
-    query.bucket_size = query_from_file["keyword_bucket_size"].as<std::uint32_t>();
-    query.keyword_bucketed = query_from_file["keyword_bucketed"].as<std::string>();
-    query.keyword_length_mask = query_from_file["keyword_length_mask"].as<std::string>();
-    query.keyword_truncated = query_from_file["keyword_truncated"].as<std::string>();
-    search_queries.push_back(query);
+search_job SearchJobFromRequest(const std::string& request, const program_options::variables_map& user_options,
+                                MailboxStore* mailbox_store) {
+  // A request is a YAML map in a single line, e.g., {query-file-path: query.yaml, output-path: result.yaml}, and
+  // the paths and the search mode that it does not set are taken from the program options. A request that names its
+  // tenant searches the tenant's mailbox of the store instead of the given paths
+  YAML::Node request_yaml = YAML::Load(request);
+  auto get_option = [&](const std::string& key) -> std::optional<std::string> {
+    if (request_yaml[key]) return request_yaml[key].as<std::string>();
+    if (user_options.count(key)) return user_options[key].as<std::string>();
+    return std::nullopt;
+  };
+
+  search_job job;
+  job.search_mode = GetSearchMode(get_option("search-mode").value());
+  job.accounting.search_mode = get_option("search-mode").value();
+  if (job.search_mode == eError) throw std::runtime_error("Unknown search mode in request: " + request);
+
+  auto query_file_path = get_option("query-file-path");
+  auto output_path = get_option("output-path");
+  if (!query_file_path || !output_path) {
+    throw std::runtime_error("Query file path and output path are required in request: " + request);
   }
-  return search_queries;
-}
-
-std::vector<mail_structure> MailsFromDirectory(const std::string& mail_directory_path, const std::vector<std::uint32_t> bucket_scheme) {
-  std::uint32_t max_seq_number = 0;
-
-  for (auto& file_path : std::filesystem::directory_iterator(mail_directory_path)) {
-    YAML::Node mail_yaml_file = YAML::LoadFile(file_path.path());
-
-    // Update the maximum sequence number
-    if (mail_yaml_file["sequence_number"].as<uint32_t>() > max_seq_number) {
-      max_seq_number = mail_yaml_file["sequence_number"].as<uint32_t>();
-    }
+  job.output_path = output_path.value();
+
+  YAML::Node search_query_yaml_file = YAML::LoadFile(query_file_path.value());
+  job.modifier_chain_share = search_query_yaml_file["modifier_chain_share"].as<std::string>();
+  job.bucket_scheme = search_query_yaml_file["bucket_scheme"].as<std::vector<std::uint32_t>>();
+  job.search_queries = SearchQueriesFromFile(search_query_yaml_file);
+  if (search_query_yaml_file["uid"]) job.accounting.query_uid = search_query_yaml_file["uid"].as<std::string>();
+
+  if (request_yaml["tenant"]) {
+    job.accounting.tenant = request_yaml["tenant"].as<std::string>();
+    if (!mailbox_store) throw std::runtime_error("Tenant root path is required for the tenant in request: " + request);
+    auto mailbox = mailbox_store->Get(request_yaml["tenant"].as<std::string>(), job.bucket_scheme);
+    if (mailbox.mails) job.mails = mailbox.mails;
+    if (mailbox.index) job.index = mailbox.index;
+    return job;
   }
 
-  std::vector<mail_structure> mails(max_seq_number + 1);
-
-  for (auto& file_path : std::filesystem::directory_iterator(mail_directory_path)) {
-    YAML::Node mail_yaml_file = YAML::LoadFile(file_path.path());
-    std::uint32_t sequence_number = mail_yaml_file["sequence_number"].as<std::uint32_t>();
-
-    // Copy data over to mail
-    mail_structure mail;
-    mail.subject = mail_yaml_file["subject"].as<std::string>();
-    mail.secret_share_block = mail_yaml_file["secret_share_block"].as<std::string>();
-    mail.secret_share_truncated_block = mail_yaml_file["secret_share_truncated_block"].as<std::string>();
-
-    for (auto& bucket_size : bucket_scheme) {
-      if (mail_yaml_file["secret_share_bucket_blocks"][bucket_size]) {
-        bucket_block bucket;
-        bucket.bucket_size = bucket_size;
-        bucket.words = mail_yaml_file["secret_share_bucket_blocks"][bucket_size].as<std::vector<std::string>>();
-        mail.buckets.push_back(bucket);
-      }
-    }
-    mails[sequence_number] = mail;
+  auto mail_directory_path = get_option("mail-dir-path");
+  auto index_file_path = get_option("index-file-path");
+  if (!mail_directory_path && !index_file_path) {
+    throw std::runtime_error("Expected to get either index file path or path to the mail directory in request: " +
+                             request);
   }
-  return mails;
-}
-
-search_index IndexFromFile(const std::string& index_file_path) {
-  search_index search_index;
-  YAML::Node index_yaml_file = YAML::LoadFile(index_file_path);
-
-  search_index.num_of_emails = index_yaml_file["num_of_emails"].as<uint32_t>();
-  for (const auto& bucket : index_yaml_file["INDEX_BUCKETS"]) {
-    index_bucket index;
-    index.bucket_size = bucket.first.as<std::uint32_t>();
-    for (const auto& bucket_item_dict : bucket.second) {
-      for (auto& bucket_item : bucket_item_dict) {
-        std::string word = bucket_item.first.as<std::string>();
-        std::string occurrence_string = bucket_item.second.as<std::string>();
-        index.word_and_occurrence_strings.push_back(std::make_pair(word, occurrence_string));
-      }
-    }
-    search_index.index_buckets.push_back(index);
+  if (mail_directory_path) {
+    job.mails = std::make_shared<const std::vector<mail_structure>>(
+        MailsFromDirectory(mail_directory_path.value(), job.bucket_scheme));
   }
-  return search_index;
+  if (index_file_path) job.index = std::make_shared<const search_index>(IndexFromFile(index_file_path.value()));
+  return job;
 }
 
 const std::regex kPartyArgumentRegex(
@@ -268,7 +388,7 @@ std::pair<program_options::variables_map, bool> ParseProgramOptions(int ac, char
   using namespace std::string_view_literals;
   constexpr std::string_view kConfigFileMessage =
       "configuration file, other arguments will overwrite the parameters read from the configuration file"sv;
-  bool print, help;
+  bool print, help, coalesce_layers, optimize_circuit, group_by_length, stream_mails, calibrate, server;
   boost::program_options::options_description description("Allowed options");
   // clang-format off
   description.add_options()
@@ -278,15 +398,65 @@ std::pair<program_options::variables_map, bool> ParseProgramOptions(int ac, char
       ("configuration-file,f", program_options::value<std::string>(), kConfigFileMessage.data())
       ("my-id", program_options::value<std::size_t>(), "my party id")
       ("parties", program_options::value<std::vector<std::string>>()->multitoken(), "info (id,IP,port) for each party e.g., --parties 0,127.0.0.1,23000 1,127.0.0.1,23001")
-      ("search-mode", program_options::value<std::string>()->default_value("normal"), "choose from search mode options: [normal|hidden|bucket|index]")
+      ("search-mode", program_options::value<std::string>()->default_value("normal"),
+            "choose from search mode options: [normal|hidden|bucket|index|ngram|bloom|dfa]")
       ("query-file-path", program_options::value<std::string>(),
             "get party's path for query file, include path e.g. ../../../privmail-incoming-proxy/secret_shared_query_share1/query_test_file_1.yaml")
       ("mail-dir-path", program_options::value<std::string>(),
             "get party's mail directory path, include path e.g. ../../../privmail-smtp-server/mail_data")
       ("index-file-path", program_options::value<std::string>(),
             "get party's path for index file, include path e.g. ../../../privmail-incoming-proxy/index-files/index_file_1.yaml")
+      ("accounting-log-path", program_options::value<std::string>(),
+            "append the resources of each search as a line of JSON to this file")
       ("json-path", program_options::value<std::string>(),
-            "define path to the benchmarks json file");
+            "define path to the benchmarks json file")
+      ("coalesce-layers", program_options::bool_switch(&coalesce_layers)->default_value(false),
+            "evaluate each AND/OR layer of all mails with a single SIMD gate (one message per layer)")
+      ("optimize-circuit", program_options::bool_switch(&optimize_circuit)->default_value(false),
+            "build the keyword comparisons in an intermediate representation that shares common subexpressions, "
+            "folds constants and balances and fuses the AND/OR trees")
+      ("group-by-length", program_options::bool_switch(&group_by_length)->default_value(false),
+            "build the keyword comparisons once for each length of the truncated blocks and evaluate them over all "
+            "mails of that length with SIMD gates (normal and hidden search modes)")
+      ("stream-mails", program_options::bool_switch(&stream_mails)->default_value(false),
+            "load the mails in the background while the parties connect and the search is constructed (all parties "
+            "must set it)")
+      ("comparison-circuit", program_options::value<std::string>(),
+            "define path to a Bristol Fashion circuit that compares two characters in the optimized circuit "
+            "(implies --optimize-circuit)")
+      ("export-circuit", program_options::value<std::string>(),
+            "write the search circuit of the normal or hidden search mode for the query and mails to this path in "
+            "the Bristol Fashion format and exit")
+      ("retrieval-key-path", program_options::value<std::string>(),
+            "answer the private retrieval keys of this file with the secret share blocks of the mail directory and "
+            "exit")
+      ("retrieval-output-path", program_options::value<std::string>(),
+            "define path to the answers of the private retrieval keys")
+      ("candidate-bound", program_options::value<std::size_t>()->default_value(0),
+            "verify the candidates of the ngram search mode on the full text of at most this many mails (0 disables)")
+      ("calibrate", program_options::bool_switch(&calibrate)->default_value(false),
+            "run short synthetic searches with the other parties and save the fastest settings to the profile file")
+      ("profile-path", program_options::value<std::string>(),
+            "define path to the calibration profile (written with --calibrate, otherwise read for the search settings)")
+      ("server", program_options::bool_switch(&server)->default_value(false),
+            "read search requests line by line from the standard input and pipeline their stages (the ports of the "
+            "parties are shifted for concurrent searches)")
+      ("coalescing-window-ms", program_options::value<double>()->default_value(0),
+            "in server mode, wait this long after a request for more requests to search together in one batch")
+      ("max-batch-size", program_options::value<std::size_t>()->default_value(1),
+            "in server mode, search at most this many requests together in one batch")
+      ("replicas", program_options::value<std::size_t>()->default_value(1),
+            "in server mode, run this many search pipelines and route each request to the least loaded one")
+      ("tenant-root-path", program_options::value<std::string>(),
+            "in server mode, define path to the mailbox store with a directory per tenant that requests can name")
+      ("max-resident-tenants", program_options::value<std::size_t>()->default_value(64),
+            "in server mode, keep at most this many mailboxes of the store loaded")
+      ("metrics-path", program_options::value<std::string>(),
+            "in server mode, write the metrics of the searches in the Prometheus text format to this file")
+      ("metrics-port", program_options::value<std::uint16_t>()->default_value(0),
+            "in server mode, serve the metrics over HTTP on this port of the loopback interface (0 disables)")
+      ("metrics-interval-s", program_options::value<double>()->default_value(10),
+            "in server mode, rewrite the metrics file this often");
   // clang-format on
 
   program_options::variables_map user_options;
@@ -308,6 +478,22 @@ std::pair<program_options::variables_map, bool> ParseProgramOptions(int ac, char
     program_options::notify(user_options);
   }
 
+  if (user_options.count("export-circuit")) {
+    // The export only needs the lengths of the query and the mails, no other parties
+    if (!user_options.count("query-file-path") || !user_options.count("mail-dir-path")) {
+      throw std::runtime_error("Query file path and mail directory path are required to export the search circuit");
+    }
+    return std::make_pair(user_options, help);
+  }
+
+  if (user_options.count("retrieval-key-path")) {
+    // The retrieval only needs the mails, no other parties
+    if (!user_options.count("mail-dir-path") || !user_options.count("retrieval-output-path")) {
+      throw std::runtime_error("Mail directory path and retrieval output path are required to answer retrieval keys");
+    }
+    return std::make_pair(user_options, help);
+  }
+
   // print parsed parameters
   if (user_options.count("my-id")) {
     if (print) std::cout << "My id " << user_options["my-id"].as<std::size_t>() << std::endl;
@@ -329,6 +515,19 @@ std::pair<program_options::variables_map, bool> ParseProgramOptions(int ac, char
   } else
     throw std::runtime_error("Other parties' information is not set but required");
 
+  if (calibrate) {
+    // The calibration only uses synthetic inputs
+    if (!user_options.count("profile-path")) {
+      throw std::runtime_error("Profile path is not set but required for the calibration");
+    }
+    return std::make_pair(user_options, help);
+  }
+
+  if (server) {
+    // The requests give the paths, the program options only the defaults
+    return std::make_pair(user_options, help);
+  }
+
   if (!user_options.count("query-file-path")) {
     throw std::runtime_error("Query file path is not set but required");
   }
@@ -340,7 +539,8 @@ std::pair<program_options::variables_map, bool> ParseProgramOptions(int ac, char
   return std::make_pair(user_options, help);
 }
 
-encrypto::motion::PartyPointer CreateParty(const program_options::variables_map& user_options) {
+encrypto::motion::PartyPointer CreateParty(const program_options::variables_map& user_options,
+                                           std::uint16_t port_offset) {
   const auto parties_string{user_options["parties"].as<const std::vector<std::string>>()};
   const auto number_of_parties{parties_string.size()};
   const auto my_id{user_options["my-id"].as<std::size_t>()};
@@ -360,7 +560,7 @@ encrypto::motion::PartyPointer CreateParty(const program_options::variables_map&
                       "is {} and #parties is {}",
                       party_id, number_of_parties));
     }
-    parties_configuration.at(party_id) = std::make_pair(host, port);
+    parties_configuration.at(party_id) = std::make_pair(host, static_cast<std::uint16_t>(port + port_offset));
   }
   encrypto::motion::communication::TcpSetupHelper helper(my_id, parties_configuration);
   auto communication_layer = std::make_unique<encrypto::motion::communication::CommunicationLayer>(
@@ -373,16 +573,3 @@ encrypto::motion::PartyPointer CreateParty(const program_options::variables_map&
   configuration->SetOnlineAfterSetup(true);
   return party;
 }
-
-search_mode_enum GetSearchMode(std::string const& in_string) {
-  if (in_string == "normal") return eNormal;
-  if (in_string == "hidden") return eHidden;
-  if (in_string == "bucket") return eBucket;
-  if (in_string == "index") return eIndex;
-  return eError;
-}
-
-std::uint32_t GetCharacterLengthFromBase64(const std::string& base64_string) {
-  std::size_t num_of_padding_chars = std::count(base64_string.begin(), base64_string.end(), '=');
-  return 3 * (base64_string.length() / 4) - num_of_padding_chars;
-}
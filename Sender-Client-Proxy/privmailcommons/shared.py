@@ -9,6 +9,9 @@ import os
 import datetime
 import itertools
 import enum
+import hashlib
+import html
+import re
 import yaml
 
 
@@ -21,14 +24,49 @@ END_TRUNCATED = "-----END SECRET SHARE TRUNCATED BLOCK Ver1.0-----"
 START_BUCKET = "-----BEGIN SECRET SHARE BUCKET SIZE {} BLOCK Ver1.0-----"
 END_BUCKET = "-----END SECRET SHARE BUCKET SIZE {} BLOCK Ver1.0-----"
 
+START_BLOOM = "-----BEGIN SECRET SHARE BLOOM FILTER BLOCK Ver1.0-----"
+END_BLOOM = "-----END SECRET SHARE BLOOM FILTER BLOCK Ver1.0-----"
+
 PADDING_CHARACTER = '*'
 
+# Pattern characters of a keyword: any character and any digit
+WILDCARD_CHARACTER = '?'
+DIGIT_CLASS_CHARACTER = '#'
+PATTERN_MASK_SIZE = 48
+
+# Used for the normalization of the searchable text of an email
+SIGNATURE_DELIMITER = "--"
+QUOTE_PREFIX = ">"
+REPLY_ATTRIBUTION_PATTERN = re.compile(r"^On .* wrote:$")
+HTML_TAG_PATTERN = re.compile(r"<[^>]*>")
+
 UID_BYTE_LEN = 6
 
 CHAR_PER_LINE = 60
 
 BUCKET_SCHEME = [5, 10, 15, 20]
 
+# Length of the character n-grams in the n-gram search index
+NGRAM_LENGTH = 3
+
+# Size (in bits) and number of hash functions of the Bloom filter of the words of each mail
+BLOOM_FILTER_SIZE = 1024
+BLOOM_FILTER_NUM_HASHES = 4
+
+# The keys of the two-party distributed point function (DPF) hold a tree of seeds of this many bytes,
+# whose leaves each expand to a block of DPF_LEAF_BITLEN bits of the one-hot bit array
+DPF_SEED_LEN = 16
+DPF_LEAF_BITLEN = 128
+
+# Regular expressions of the dfa search mode are compiled to a DFA over the characters of the special
+# encoding. The numbers of states and character classes are public, so they are padded to powers of two
+# of at least these minimums
+DFA_ALPHABET_SIZE = 64
+DFA_MIN_NUM_OF_STATES = 16
+DFA_MIN_NUM_OF_CLASSES = 8
+DFA_MAX_NUM_OF_STATES = 64
+DFA_MAX_REPETITIONS = 32
+
 # Based on SixBit ASCII (used by AIS)
 SPECIAL_ENCODING = [
     42, 42, 42, 42, 42, 42, 42, 42, 42, 42, 42, 42, 42, 42, 42, 42,
@@ -74,6 +112,7 @@ class YAML_STRINGS(str, enum.Enum):  # pylint: disable=C0103
     SECRET_SHARE_BLOCK = "SECRET_SHARE_BLOCK"
     SECRET_SHARE_TRUNCATED_BLOCK = "SECRET_SHARE_TRUNCATED_BLOCK"
     SECRET_SHARE_BUCKET_BLOCKS = "SECRET_SHARE_BUCKET_BLOCKS"
+    SECRET_SHARE_BLOOM_FILTER = "SECRET_SHARE_BLOOM_FILTER"
 
     # These are part of the secret shared search query
     BUCKET_SCHEME = "bucket_scheme"
@@ -88,14 +127,32 @@ class YAML_STRINGS(str, enum.Enum):  # pylint: disable=C0103
     KEYWORD_BUCKETED = "KEYWORD_BUCKETED"
     KEYWORD_LENGTH_MASK = "KEYWORD_LENGTH_MASK"
     KEYWORD_TRUNCATED = "KEYWORD_TRUNCATED"
+    KEYWORD_BLOOM_POSITIONS = "KEYWORD_BLOOM_POSITIONS"
+    KEYWORD_BLOOM_KEYS = "KEYWORD_BLOOM_KEYS"
+    KEYWORD_SEARCH_MODE = "keyword_search_mode"
+    KEYWORD_WILDCARD_MASK = "keyword_wildcard_mask"
+    KEYWORD_DIGIT_MASK = "keyword_digit_mask"
+    KEYWORD_DFA_NUM_OF_STATES = "keyword_dfa_num_of_states"
+    KEYWORD_DFA_NUM_OF_CLASSES = "keyword_dfa_num_of_classes"
+    KEYWORD_DFA_CLASSES = "keyword_dfa_classes"
+    KEYWORD_DFA_TRANSITIONS = "keyword_dfa_transitions"
+    KEYWORD_DFA_ACCEPTING = "keyword_dfa_accepting"
 
     # These are part of the secret shared search index
     INDEX_BUCKETS = "index_buckets"
+    NGRAM_INDEX = "NGRAM_INDEX"
+    POSTING_LISTS = "POSTING_LISTS"
+    POSTING_BITLEN = "posting_bitlen"
     NUM_OF_EMAILS = "num_of_emails"
 
+    # These are part of the private retrieval of mail share blocks
+    RETRIEVAL_KEYS = "retrieval_keys"
+    RETRIEVAL_ANSWERS = "retrieval_answers"
+
     # These are names of generated directories or files
     INDEX_FILE_NAME = "secret_shared_index_share_"
     QUERY_FILE_NAME = "secret_shared_query_share_"
+    RETRIEVAL_KEY_FILE_NAME = "retrieval_keys_provider_{}_server_{}.yaml"
 
 
 def construct_shares(msg_string, N, logger, truncate=False):  # pylint: disable=C0103
@@ -250,11 +307,73 @@ def bucket_keyword(word, logger):
     return ""
 
 
-def separate_words_from_text(text):
-    """Separate distinct words from text and save their position index along with them."""
+def normalize_mail_text(text):
+    """Normalize the text of an email for the search.
+
+    Removes HTML tags, the signature (after the line "-- "), the quoted history (lines starting
+    with ">" and the "On ... wrote:" line before them) and repeated paragraphs (e.g., of forwarded
+    emails), and collapses all whitespace characters into single spaces.
+    """
+    if not isinstance(text, str):
+        raise Exception(f"Expected text to be of type str but got: {type(text)}")
+
+    text = html.unescape(HTML_TAG_PATTERN.sub(" ", text))
+
+    paragraphs = [[]]
+    for line in text.splitlines():
+        if line.rstrip() == SIGNATURE_DELIMITER:
+            break
+        if line.lstrip().startswith(QUOTE_PREFIX) or REPLY_ATTRIBUTION_PATTERN.match(line.strip()):
+            continue
+        if not line.strip():
+            paragraphs.append([])
+            continue
+        paragraphs[-1].append(line)
+
+    distinct_paragraphs = []
+    for paragraph in paragraphs:
+        normalized_paragraph = ' '.join(' '.join(paragraph).split())
+        if normalized_paragraph and normalized_paragraph not in distinct_paragraphs:
+            distinct_paragraphs.append(normalized_paragraph)
+    return ' '.join(distinct_paragraphs)
+
+
+def get_length_class(length, length_classes):
+    """Return the smallest length class that is at least the length.
+
+    Lengths above the largest length class are rounded up to a multiple of it,
+    and without any length classes the length is returned as is.
+    """
+    if not isinstance(length, int) or length < 0:
+        raise Exception(f"Expected length to be a non-negative integer but got: {length}")
+    if not length_classes:
+        return length
+    if any(not isinstance(length_class, int) or length_class < 1 for length_class in length_classes):
+        raise Exception(f"Expected the length classes to be positive integers but got: {length_classes}")
+
+    for length_class in sorted(length_classes):
+        if length <= length_class:
+            return length_class
+    return length + (-length % max(length_classes))
+
+
+def pad_to_length_class(text, length_classes):
+    """Pad the text with the padding character to the smallest length class that fits it (see `get_length_class`)."""
+    if not isinstance(text, str):
+        raise Exception(f"Expected text to be of type str but got: {type(text)}")
+    return text + PADDING_CHARACTER * (get_length_class(len(text), length_classes) - len(text))
+
+
+def separate_words_from_text(text, stopwords=()):
+    """Separate distinct words from text and save their position index along with them.
+
+    The stopwords are left out, i.e., they are never part of the buckets or the search index.
+    """
     distinct_words = {}
     truncated_msg_words = text.split()
     for position_index, word in enumerate(truncated_msg_words):
+        if word in stopwords:
+            continue
         if word not in distinct_words:
             distinct_words[word] = [position_index]
         else:
@@ -291,6 +410,469 @@ def create_length_mask(keyword_length):
     return int_array
 
 
+def create_pattern_masks(keyword):
+    """Construct the wildcard and digit class masks of a keyword pattern.
+
+    Each WILDCARD_CHARACTER of the keyword matches any character and each DIGIT_CLASS_CHARACTER
+    matches any digit. Returns the keyword, where each DIGIT_CLASS_CHARACTER is replaced by '0',
+    and the two masks as bit arrays of PATTERN_MASK_SIZE bits (see `create_bit_array`) with a one
+    at each position of the respective pattern character. E.g., the keyword "a?#" gives the masks
+    [64, 0, 0, 0, 0, 0] and [32, 0, 0, 0, 0, 0].
+    """
+    if not isinstance(keyword, str):
+        raise Exception(f"Expected keyword to be of type str but got: {type(keyword)}")
+
+    wildcard_positions = [position for position, character in enumerate(keyword) if character == WILDCARD_CHARACTER]
+    digit_positions = [position for position, character in enumerate(keyword) if character == DIGIT_CLASS_CHARACTER]
+    return (keyword.replace(DIGIT_CLASS_CHARACTER, '0'),
+            create_bit_array(wildcard_positions, PATTERN_MASK_SIZE),
+            create_bit_array(digit_positions, PATTERN_MASK_SIZE))
+
+
+def bloom_filter_positions(word):
+    """Compute the BLOOM_FILTER_NUM_HASHES positions of a word in the Bloom filter.
+
+    The word is lowercased, such that the words of a mail and the keywords of a search
+    query get the same positions.
+    """
+    if not isinstance(word, str):
+        raise Exception(f"Expected word to be of type str but got: {type(word)}")
+
+    positions = []
+    for hash_index in range(BLOOM_FILTER_NUM_HASHES):
+        digest = hashlib.sha256(f"{hash_index}:{word.lower()}".encode("utf-8")).digest()
+        positions.append(int.from_bytes(digest[:4], "big") % BLOOM_FILTER_SIZE)
+    return positions
+
+
+def create_bit_array(positions, size):
+    """Construct a bit array with ones at the given positions.
+
+    The bit array is an integer array where every integer represents a byte.
+    E.g., if the positions are [0, 2] and the size is 8, this function returns [160],
+    which is 1010 0000 in binary representation.
+    """
+    if not isinstance(size, int) or size % 8 != 0:
+        raise Exception(f"Expected size to be a multiple of 8 but got: {size}")
+
+    int_array = [0] * (size // 8)
+    for position in positions:
+        if not 0 <= position < size:
+            raise Exception(f"Expected position to be in the range [0, {size - 1}] but got: {position}")
+        int_array[position // 8] |= 128 >> (position % 8)
+    return int_array
+
+
+def create_bloom_filter(words):
+    """Construct the Bloom filter of the words as a bit array of size BLOOM_FILTER_SIZE."""
+    positions = [position for word in words for position in bloom_filter_positions(word)]
+    return create_bit_array(positions, BLOOM_FILTER_SIZE)
+
+
+def _dpf_expand_seed(seed):
+    """Expand a DPF seed to the seeds and control bits of its two children (SHA-256 as the PRG)."""
+    digest = hashlib.sha256(b"\x00" + seed).digest()
+    children = []
+    for child in (digest[:DPF_SEED_LEN], digest[DPF_SEED_LEN:]):
+        # The last bit of each half is the control bit, it is cleared in the seed
+        children.append((child[:-1] + bytes([child[-1] & 0xFE]), child[-1] & 1))
+    return children
+
+
+def _dpf_leaf_block(seed):
+    """Expand the seed of a DPF leaf to its block of DPF_LEAF_BITLEN bits."""
+    return hashlib.sha256(b"\x01" + seed).digest()[:DPF_LEAF_BITLEN // 8]
+
+
+def _dpf_depth(size):
+    """Compute the depth of the DPF tree whose leaves cover a bit array of the size."""
+    depth = 0
+    while (DPF_LEAF_BITLEN << depth) < size:
+        depth += 1
+    return depth
+
+
+def _xor_bytes(lhs, rhs):
+    return bytes(a ^ b for a, b in zip(lhs, rhs))
+
+
+def create_dpf_keys(position, size):
+    """Construct the two keys of a distributed point function for a one-hot bit array.
+
+    Each key expands (see `expand_dpf_key`) to a share of `create_bit_array([position], size)`, i.e., the XOR
+    of both expansions is the one-hot bit array, while a single key reveals nothing about the position. The
+    keys follow the tree construction of Boyle, Gilboa and Ishai (CCS'16) with a block of DPF_LEAF_BITLEN bits
+    per leaf, so they take O(log(size)) bytes instead of size bits. Each key is the size (4 bytes), the party
+    (1 byte), the root seed, a correction word per level (a seed and a byte with the control bits of the left
+    and right child) and the correction block of the leaves. Return both keys as base64 strings.
+    """
+    if not isinstance(size, int) or size <= 0 or size % 8 != 0:
+        raise Exception(f"Expected size to be a positive multiple of 8 but got: {size}")
+    if not isinstance(position, int) or not 0 <= position < size:
+        raise Exception(f"Expected position to be in the range [0, {size - 1}] but got: {position}")
+
+    depth = _dpf_depth(size)
+    leaf, leaf_position = divmod(position, DPF_LEAF_BITLEN)
+    seeds = [secrets.token_bytes(DPF_SEED_LEN), secrets.token_bytes(DPF_SEED_LEN)]
+    control_bits = [0, 1]
+    keys = [size.to_bytes(4, "big") + bytes([party]) + seeds[party] for party in range(2)]
+
+    # Along the path to the leaf of the position, the seeds differ and exactly one control bit is set. Off the
+    # path, the correction words make the seeds and control bits of both parties equal
+    for level in range(depth):
+        path_bit = (leaf >> (depth - 1 - level)) & 1
+        children = [_dpf_expand_seed(seed) for seed in seeds]
+        lose = 1 - path_bit
+        seed_correction = _xor_bytes(children[0][lose][0], children[1][lose][0])
+        control_corrections = [children[0][0][1] ^ children[1][0][1] ^ path_bit ^ 1,
+                               children[0][1][1] ^ children[1][1][1] ^ path_bit]
+        correction_word = seed_correction + bytes([control_corrections[0] << 1 | control_corrections[1]])
+        keys = [key + correction_word for key in keys]
+
+        for party in range(2):
+            seed, control_bit = children[party][path_bit]
+            if control_bits[party]:
+                seed = _xor_bytes(seed, seed_correction)
+                control_bit ^= control_corrections[path_bit]
+            seeds[party] = seed
+            control_bits[party] = control_bit
+
+    one_hot_block = bytes(create_bit_array([leaf_position], DPF_LEAF_BITLEN))
+    leaf_correction = _xor_bytes(_xor_bytes(_dpf_leaf_block(seeds[0]), _dpf_leaf_block(seeds[1])), one_hot_block)
+    return [base64.b64encode(key + leaf_correction).decode(encoding="ascii") for key in keys]
+
+
+def expand_dpf_key(key):
+    """Expand a key of `create_dpf_keys` to its share of the one-hot bit array, as an integer array of bytes."""
+    key_bytes = base64.b64decode(key, validate=True)
+    if len(key_bytes) < 5:
+        raise Exception(f"Expected a DPF key of at least 5 bytes but got: {len(key_bytes)}")
+    size = int.from_bytes(key_bytes[:4], "big")
+    depth = _dpf_depth(size)
+    correction_word_len = DPF_SEED_LEN + 1
+    if size == 0 or size % 8 != 0 or \
+            len(key_bytes) != 5 + DPF_SEED_LEN + depth * correction_word_len + DPF_LEAF_BITLEN // 8:
+        raise Exception(f"Expected a DPF key for a positive multiple of 8 bits but got {len(key_bytes)} "
+                        f"bytes for {size} bits")
+
+    nodes = [(key_bytes[5:5 + DPF_SEED_LEN], key_bytes[4] & 1)]
+    offset = 5 + DPF_SEED_LEN
+    for _ in range(depth):
+        seed_correction = key_bytes[offset:offset + DPF_SEED_LEN]
+        control_corrections = (key_bytes[offset + DPF_SEED_LEN] >> 1 & 1, key_bytes[offset + DPF_SEED_LEN] & 1)
+        offset += correction_word_len
+
+        children = []
+        for seed, control_bit in nodes:
+            for child, (child_seed, child_control_bit) in enumerate(_dpf_expand_seed(seed)):
+                if control_bit:
+                    child_seed = _xor_bytes(child_seed, seed_correction)
+                    child_control_bit ^= control_corrections[child]
+                children.append((child_seed, child_control_bit))
+        nodes = children
+
+    leaf_correction = key_bytes[offset:]
+    bit_array = bytearray()
+    for seed, control_bit in nodes:
+        block = _dpf_leaf_block(seed)
+        bit_array += _xor_bytes(block, leaf_correction) if control_bit else block
+    return list(bit_array[:size // 8])
+
+
+def _encode_pattern_character(character):
+    """Return the symbol of a pattern character in the special encoding."""
+    if not 32 <= ord(character) < 127:
+        raise Exception(f"Expected a printable ASCII character in the pattern but got: {character!r}")
+    return SPECIAL_ENCODING[ord(character)]
+
+
+def _pattern_escape_symbols(character):
+    """Return the symbols of an escaped pattern character, e.g., all digits for 'd'."""
+    if character == 'd':
+        return frozenset(_encode_pattern_character(digit) for digit in "0123456789")
+    if character == 'w':
+        return frozenset(_encode_pattern_character(word_character)
+                         for word_character in "abcdefghijklmnopqrstuvwxyz0123456789_")
+    if character == 's':
+        return frozenset([_encode_pattern_character(' ')])
+    return frozenset([_encode_pattern_character(character)])
+
+
+def _parse_pattern(pattern):
+    """Parse a regular expression into a tree of tuples.
+
+    The nodes are ('symbols', set), ('concat', [nodes]), ('alternate', [nodes]) and
+    ('repeat', node, min, max), where max is None for no bound.
+    """
+    position = 0
+
+    def peek():
+        return pattern[position] if position < len(pattern) else None
+
+    def take():
+        nonlocal position
+        if position >= len(pattern):
+            raise Exception(f"Unexpected end of pattern: {pattern}")
+        position += 1
+        return pattern[position - 1]
+
+    def parse_number():
+        start = position
+        while peek() is not None and peek().isdigit():
+            take()
+        return int(pattern[start:position]) if position > start else None
+
+    def parse_class():
+        negated = peek() == '^'
+        if negated:
+            take()
+        symbols = set()
+        first = True
+        while first or peek() != ']':
+            first = False
+            character = take()
+            if character == '\\':
+                symbols |= _pattern_escape_symbols(take())
+                continue
+            if peek() == '-' and position + 1 < len(pattern) and pattern[position + 1] != ']':
+                take()
+                last = take()
+                if ord(last) < ord(character):
+                    raise Exception(f"Invalid range {character}-{last} in pattern: {pattern}")
+                symbols |= {_encode_pattern_character(chr(code)) for code in range(ord(character), ord(last) + 1)}
+            else:
+                symbols.add(_encode_pattern_character(character))
+        take()
+        if negated:
+            symbols = set(range(DFA_ALPHABET_SIZE)) - symbols
+        return frozenset(symbols)
+
+    def parse_atom():
+        character = take()
+        if character == '(':
+            node = parse_alternation()
+            if take() != ')':
+                raise Exception(f"Expected ')' in pattern: {pattern}")
+            return node
+        if character == '[':
+            return ('symbols', parse_class())
+        if character == '.':
+            return ('symbols', frozenset(range(DFA_ALPHABET_SIZE)))
+        if character == '\\':
+            return ('symbols', _pattern_escape_symbols(take()))
+        if character in ')|*+?{':
+            raise Exception(f"Unexpected '{character}' in pattern: {pattern}")
+        return ('symbols', frozenset([_encode_pattern_character(character)]))
+
+    def parse_repetition():
+        node = parse_atom()
+        while peek() is not None and peek() in '*+?{':
+            quantifier = take()
+            if quantifier == '*':
+                node = ('repeat', node, 0, None)
+            elif quantifier == '+':
+                node = ('repeat', node, 1, None)
+            elif quantifier == '?':
+                node = ('repeat', node, 0, 1)
+            else:
+                minimum = parse_number()
+                maximum = minimum
+                if peek() == ',':
+                    take()
+                    maximum = parse_number()
+                if minimum is None or take() != '}':
+                    raise Exception(f"Invalid repetition in pattern: {pattern}")
+                if (maximum is not None and maximum < minimum) or max(minimum, maximum or 0) > DFA_MAX_REPETITIONS:
+                    raise Exception(f"Expected repetitions of at most {DFA_MAX_REPETITIONS} in pattern: {pattern}")
+                node = ('repeat', node, minimum, maximum)
+        return node
+
+    def parse_concatenation():
+        nodes = []
+        while peek() is not None and peek() not in '|)':
+            nodes.append(parse_repetition())
+        return ('concat', nodes)
+
+    def parse_alternation():
+        nodes = [parse_concatenation()]
+        while peek() == '|':
+            take()
+            nodes.append(parse_concatenation())
+        return nodes[0] if len(nodes) == 1 else ('alternate', nodes)
+
+    tree = parse_alternation()
+    if position != len(pattern):
+        raise Exception(f"Unexpected '{pattern[position]}' in pattern: {pattern}")
+    return tree
+
+
+def compile_pattern_dfa(pattern):
+    """Compile a regular expression to a DFA that finds it anywhere in a text.
+
+    The pattern is written over the characters of the special encoding, so it is case insensitive.
+    It supports literals, '.', classes such as [a-z0-9] or [^0-9], the escapes \\d, \\w and \\s,
+    groups, '|', and the quantifiers '?', '*', '+', {n}, {n,} and {n,m}.
+
+    The characters are grouped into classes that the pattern does not distinguish. Returns the class
+    of each character of the encoding, the next state of each state and class, and whether each state
+    is accepting. State 0 is the start state. Once the pattern is found, the DFA stays in an accepting
+    state, so a text matches if the DFA accepts after its last character.
+    """
+    if not isinstance(pattern, str) or not pattern:
+        raise Exception(f"Expected a non-empty pattern but got: {pattern!r}")
+
+    # 1. Thompson construction of an NFA with epsilon edges (symbols None)
+    edges = []
+
+    def new_state():
+        edges.append([])
+        return len(edges) - 1
+
+    def build(node):
+        start, end = new_state(), new_state()
+        if node[0] == 'symbols':
+            edges[start].append((node[1], end))
+        elif node[0] == 'concat':
+            current = start
+            for child in node[1]:
+                child_start, child_end = build(child)
+                edges[current].append((None, child_start))
+                current = child_end
+            edges[current].append((None, end))
+        elif node[0] == 'alternate':
+            for child in node[1]:
+                child_start, child_end = build(child)
+                edges[start].append((None, child_start))
+                edges[child_end].append((None, end))
+        else:
+            _, child, minimum, maximum = node
+            current = start
+            for _ in range(minimum):
+                child_start, child_end = build(child)
+                edges[current].append((None, child_start))
+                current = child_end
+            if maximum is None:
+                child_start, child_end = build(child)
+                edges[current].append((None, child_start))
+                edges[child_end].append((None, child_start))
+                edges[child_end].append((None, end))
+            else:
+                for _ in range(maximum - minimum):
+                    child_start, child_end = build(child)
+                    edges[current].append((None, child_start))
+                    edges[current].append((None, end))
+                    current = child_end
+            edges[current].append((None, end))
+        return start, end
+
+    nfa_start, nfa_accept = build(_parse_pattern(pattern))
+
+    def closure(states):
+        stack, reached = list(states), set(states)
+        while stack:
+            for symbols, target in edges[stack.pop()]:
+                if symbols is None and target not in reached:
+                    reached.add(target)
+                    stack.append(target)
+        return reached
+
+    # 2. Characters that the same symbol sets contain are a class, the first class is the one of '@'
+    symbol_sets = sorted({symbols for state_edges in edges for symbols, _ in state_edges if symbols is not None},
+                         key=sorted)
+    signatures = {}
+    symbol_classes = []
+    for symbol in range(DFA_ALPHABET_SIZE):
+        signature = tuple(symbol in symbols for symbols in symbol_sets)
+        symbol_classes.append(signatures.setdefault(signature, len(signatures)))
+    representatives = [symbol_classes.index(symbol_class) for symbol_class in range(len(signatures))]
+
+    # 3. Subset construction, where the start state is added after each character to find the pattern
+    # anywhere. All sets with the accepting state are merged into a single absorbing state
+    start_closure = closure({nfa_start})
+    accept_key = frozenset(['accept'])
+
+    def key_of(states):
+        return accept_key if nfa_accept in states else frozenset(states)
+
+    start_key = key_of(start_closure)
+    state_ids = {start_key: 0}
+    queue = [start_key]
+    transitions = []
+    for key in queue:
+        row = []
+        for representative in representatives:
+            if key is accept_key:
+                next_key = accept_key
+            else:
+                moved = {target for state in key for symbols, target in edges[state]
+                         if symbols is not None and representative in symbols}
+                next_key = key_of(closure(moved) | start_closure)
+            if next_key not in state_ids:
+                state_ids[next_key] = len(state_ids)
+                queue.append(next_key)
+                if len(state_ids) > 4 * DFA_MAX_NUM_OF_STATES:
+                    raise Exception(f"Expected at most {DFA_MAX_NUM_OF_STATES} DFA states for pattern: {pattern}")
+            row.append(state_ids[next_key])
+        transitions.append(row)
+    accepting = [key is accept_key for key in queue]
+
+    # 4. Minimize by refining the partition of accepting and other states until it is stable
+    blocks = [int(is_accepting) for is_accepting in accepting]
+    while True:
+        signatures = {}
+        refined = [signatures.setdefault((blocks[state], tuple(blocks[target] for target in row)), len(signatures))
+                   for state, row in enumerate(transitions)]
+        if len(signatures) == len(set(blocks)):
+            break
+        blocks = refined
+
+    # Number the blocks in the order they are reached from the start state
+    block_ids = {}
+    for state in range(len(transitions)):
+        block_ids.setdefault(blocks[state], len(block_ids))
+    minimized_transitions = [None] * len(block_ids)
+    minimized_accepting = [False] * len(block_ids)
+    for state, row in enumerate(transitions):
+        minimized_transitions[block_ids[blocks[state]]] = [block_ids[blocks[target]] for target in row]
+        minimized_accepting[block_ids[blocks[state]]] = accepting[state]
+
+    if len(minimized_transitions) > DFA_MAX_NUM_OF_STATES:
+        raise Exception(f"Expected at most {DFA_MAX_NUM_OF_STATES} DFA states for pattern: {pattern}")
+    return symbol_classes, minimized_transitions, minimized_accepting
+
+
+def _padded_dfa_size(size, minimum):
+    """Pad a DFA size to a power of two of at least the minimum."""
+    return max(minimum, 1 << (size - 1).bit_length())
+
+
+def create_dfa_tables(pattern):
+    """Construct the tables of the DFA of a pattern (see `compile_pattern_dfa`) as bit arrays.
+
+    The states and classes are padded to public sizes (see `_padded_dfa_size`), and each class or state
+    is encoded with the bits of its number, least significant bit first. Returns the number of states,
+    the number of classes, the class of each character (DFA_ALPHABET_SIZE numbers), the next state
+    of each state and class (in the order of the states), and a bit per state that is set if it is accepting.
+    """
+    symbol_classes, transitions, accepting = compile_pattern_dfa(pattern)
+    num_of_states = _padded_dfa_size(len(transitions), DFA_MIN_NUM_OF_STATES)
+    num_of_classes = _padded_dfa_size(max(symbol_classes) + 1, DFA_MIN_NUM_OF_CLASSES)
+    state_bitlen = num_of_states.bit_length() - 1
+    class_bitlen = num_of_classes.bit_length() - 1
+
+    class_positions = [symbol * class_bitlen + bit for symbol, symbol_class in enumerate(symbol_classes)
+                       for bit in range(class_bitlen) if symbol_class >> bit & 1]
+    transition_positions = [(state * num_of_classes + symbol_class) * state_bitlen + bit
+                            for state, row in enumerate(transitions)
+                            for symbol_class, next_state in enumerate(row)
+                            for bit in range(state_bitlen) if next_state >> bit & 1]
+    accepting_positions = [state for state, is_accepting in enumerate(accepting) if is_accepting]
+    return (num_of_states, num_of_classes,
+            create_bit_array(class_positions, DFA_ALPHABET_SIZE * class_bitlen),
+            create_bit_array(transition_positions, num_of_states * num_of_classes * state_bitlen),
+            create_bit_array(accepting_positions, num_of_states))
+
+
 def generate_unique_filename(base_path):
     """Generate a unique filename."""
     if base_path[-1] != "/":
@@ -33,11 +33,20 @@ default_password = config.get('PASSWORD', "")
 class ProxySMTPHandler:
     """Process incoming SMTP email data and send the subject and body as secret shares to the receiver."""
 
-    def __init__(self, proxy_mode=True):
+    def __init__(self, proxy_mode=True, length_classes=None,  # pylint: disable=R0913
+                 stopwords=None, word_count_classes=None, normalize=False):
         """Create the handler."""
         self.proxy_mode = proxy_mode
         # True: For standard SMTP servers (default)
         # False: For local usage (e.g., custom SMTP server like RSS)
+        self.length_classes = length_classes or []
+        # Public lengths to which the truncated body is padded, empty for no padding
+        self.stopwords = stopwords or set()
+        # Words that are never put in the buckets (or the Bloom filter)
+        self.word_count_classes = word_count_classes or []
+        # Public numbers of words to which each bucket is padded with dummy words, empty for no padding
+        self.normalize = normalize
+        # Strip the quoted history, signature, HTML tags and repeated paragraphs from the searchable text
 
     async def handle_DATA(self, server, session, envelope):  # pylint: disable=C0103
         """Handle received emails."""
@@ -81,11 +90,17 @@ class ProxySMTPHandler:
 
         log.info("Secret shares constructed for the body")
 
-        # Remove ALL whitespace characters (spaces, tabs, newlines, returns, formfeeds)
-        truncated_msg_string = ' '.join(msg_string.split())
+        # Remove ALL whitespace characters (spaces, tabs, newlines, returns, formfeeds), the full body is kept
+        # in the body shares for the retrieval
+        if self.normalize:
+            truncated_msg_string = shr.normalize_mail_text(msg_string)
+        else:
+            truncated_msg_string = ' '.join(msg_string.split())
 
-        # Construct the shares for the truncated body
-        truncated_body_shares = shr.construct_shares(truncated_msg_string, N, log, True)
+        # Construct the shares for the truncated body (padded to its length class, such that the search
+        # circuits are the same for all mails of the class)
+        truncated_body_shares = shr.construct_shares(
+            shr.pad_to_length_class(truncated_msg_string, self.length_classes), N, log, True)
 
         # Make everything lowercase and remove certain characters when ending a sentence
         truncated_msg_string = truncated_msg_string.lower() \
@@ -102,7 +117,13 @@ class ProxySMTPHandler:
         log.info("Secret shares constructed for the truncated body")
 
         # Construct the shares for each distinct word and put in buckets
-        distinct_words_list = shr.separate_words_from_text(truncated_msg_string)
+        distinct_words_list = shr.separate_words_from_text(truncated_msg_string, self.stopwords)
+
+        # Construct the shares for the Bloom filter of the distinct words
+        bloom_filter = shr.create_bloom_filter([word[0] for word in distinct_words_list])
+        bloom_filter_shares = shr.construct_shares_from_array(bloom_filter, N, log)
+
+        log.info("Secret shares constructed for the Bloom filter")
 
         buckets = {}
         for _ in range(len(distinct_words_list)):
@@ -122,6 +143,15 @@ class ProxySMTPHandler:
             else:
                 buckets[len(bucketed_random_word)].append((bucketed_random_word, random_word[1]))
 
+        if self.word_count_classes:
+            # Pad each bucket with dummy words (consisting of padding characters only, which never match a keyword)
+            # to hide the number of distinct words, and shuffle again to hide which words are the dummy words
+            for bucket_size in shr.BUCKET_SCHEME:
+                bucket = buckets.setdefault(bucket_size, [])
+                num_of_dummy_words = shr.get_length_class(len(bucket), self.word_count_classes) - len(bucket)
+                bucket.extend([(shr.PADDING_CHARACTER * bucket_size, [])] * num_of_dummy_words)
+                secrets.SystemRandom().shuffle(bucket)
+
         log.debug(f"BUCKETS: {buckets}")
 
         # Secret share each word individually
@@ -148,6 +178,7 @@ class ProxySMTPHandler:
                                body_shares,
                                truncated_body_shares,
                                bucket_shares,
+                               bloom_filter_shares,
                                envelope)
 
     def _send_each_shares(self,                     # pylint: disable=R0913
@@ -157,6 +188,7 @@ class ProxySMTPHandler:
                           body_shares,
                           truncated_body_shares,
                           bucket_shares,
+                          bloom_filter_shares,
                           envelope):
         """Send the shares to the targets."""
         # Construct uid with length UID_BYTE_LEN
@@ -204,6 +236,11 @@ class ProxySMTPHandler:
                 bucket_block_string_list.append(shr.END_BUCKET.format(bucket_size))
                 email_content_string += "\n\n" + "\n".join(bucket_block_string_list)
 
+            # The Bloom filter
+            email_content_string += "\n\n" + "\n".join([shr.START_BLOOM,
+                                                       *textwrap.wrap(bloom_filter_shares[i],
+                                                        shr.CHAR_PER_LINE), shr.END_BLOOM])
+
             msg_with_share.set_content(email_content_string)
 
             log.debug(f"Final full email:\n{msg_with_share}")
@@ -250,10 +287,32 @@ def main():
                         help="Set this flag to start the server in the custom mode "
                              "(omits the outgoing SMTP server authentication)")
 
+    parser.add_argument('-c', "--length-classes", action="store", dest="length_classes", type=int, nargs='+',
+                        default=[], help="Pad the truncated body of each email to the smallest of these lengths "
+                                         "that fits it (or a multiple of the largest one)")
+
+    parser.add_argument('-s', "--stopwords", action="store", dest="stopwords", type=str, default=None,
+                        help="Path to a file with a stopword per line, the stopwords are not put in the buckets")
+
+    parser.add_argument('-w', "--word-count-classes", action="store", dest="word_count_classes", type=int, nargs='+',
+                        default=[], help="Pad the words of each bucket with dummy words to the smallest of these "
+                                         "numbers that fits them (or a multiple of the largest one)")
+
+    parser.add_argument('-n', "--normalize", action="store_true", dest="normalize", default=False,
+                        help="Strip the quoted history, signature, HTML tags and repeated paragraphs from the "
+                             "searchable text of each email")
+
     args = parser.parse_args()
     log.setLevel(getattr(logging, args.logLevel))
 
-    handler = ProxySMTPHandler(args.proxy_mode)
+    stopwords = set()
+    if args.stopwords:
+        with open(args.stopwords, 'r') as stopwords_file:
+            # The words of the buckets are lowercase
+            stopwords = {line.strip().lower() for line in stopwords_file if line.strip()}
+
+    handler = ProxySMTPHandler(args.proxy_mode, args.length_classes, stopwords, args.word_count_classes,
+                               args.normalize)
     server = aiosmtpd.controller.Controller(handler, hostname='0.0.0.0', port=args.port)
     server.start()
     input(f"PrivMail Sender Client Proxy (SCP) daemon running at port {args.port}. Press Return to quit...\n")